@@ -0,0 +1,1578 @@
+#ifndef BTREE_HPP
+#define BTREE_HPP
+/* BTree.hpp
+ *
+ * Ordered set of unique elements stored in a B-tree, with the lookup,
+ * insertion and erasure interface of BinarySearchTree
+ */
+
+#include <cassert>  //assert
+#include <cstdint>  //int32_t, uint32_t, int64_t, uint64_t
+#include <functional> //less
+#include <iostream> //ostream
+#include <memory>   //allocator
+#include <new>      //launder, placement new
+#include <string>
+#include <string_view>
+#include <type_traits> //is_same, remove_cv, remove_reference
+#include <utility>  //forward, move, pair, swap
+#include "NodePool.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Balance policy for Map (see Map.hpp) that stores its pairs in a BTree
+// rather than a BinarySearchTree. A B-tree is always balanced.
+struct BTreeBalanced {
+  static constexpr bool rebalances = true;
+};
+
+// Whether Compare orders Keys as std::less does.
+template <typename Key, typename Compare>
+struct btree_orders_by_less
+  : std::integral_constant<bool,
+      std::is_same<Compare, std::less<Key>>::value ||
+      std::is_same<Compare, std::less<>>::value> { };
+
+// The search key that a BTree keeps beside each element whose key is a
+// Key ordered by Compare, in an array per node, so that a node can be
+// searched with vector compares (see BTree::search_node_impl). Search
+// keys order as their Keys do, and are exact when they also tell
+// equivalent Keys apart from the rest; otherwise they narrow a search
+// down to the few elements whose search keys tie with the query's,
+// which are then compared. Each provides:
+//   c_enabled       whether Keys have search keys (if not, nodes are
+//                   binary searched)
+//   c_exact         whether equal search keys mean equivalent Keys
+//   type            the search key, a 32- or 64-bit integer
+//   accepts<Q>      whether a query of type Q has a search key
+//   make(key)       the search key of a Key or an accepted query
+template <typename Key, typename Compare, typename = void>
+struct BTree_search_key {
+  static constexpr bool c_enabled = false;
+  using type = void;
+  template <typename Q>
+  using accepts = std::false_type;
+};
+
+// 32- and 64-bit integers under std::less are their own search keys.
+template <typename Key, typename Compare>
+struct BTree_search_key<Key, Compare, std::enable_if_t<
+                          std::is_integral<Key>::value &&
+                          !std::is_same<Key, bool>::value &&
+                          (sizeof(Key) == 4 || sizeof(Key) == 8) &&
+                          btree_orders_by_less<Key, Compare>::value>> {
+  static constexpr bool c_enabled = true;
+  static constexpr bool c_exact = true;
+  using type = Key;
+  template <typename Q>
+  using accepts = std::is_same<Q, Key>;
+
+  static Key make(Key key) {
+    return key;
+  }
+};
+
+// A string under std::less is searched by its first 8 characters, read
+// as a big-endian number with zeros past the end, which orders strings
+// as std::string does (by unsigned char) but ties those that share that
+// prefix, such as "a" and "a\0".
+template <typename Compare>
+struct BTree_search_key<std::string, Compare, std::enable_if_t<
+                          btree_orders_by_less<std::string, Compare>::value>> {
+  static constexpr bool c_enabled = true;
+  static constexpr bool c_exact = false;
+  using type = std::uint64_t;
+  template <typename Q>
+  using accepts = std::is_convertible<const Q &, std::string_view>;
+
+  static std::uint64_t make(std::string_view text) {
+    std::uint64_t prefix = 0;
+    for (std::size_t i = 0; i < 8; ++i) {
+      unsigned char c = i < text.size() ? text[i] : 0;
+      prefix = prefix << 8 | c;
+    }
+    return prefix;
+  }
+};
+
+// The key by which Compare orders elements of type T: T itself, or the
+// key_type that a Compare naming one (like Map's) extracts with key(),
+// ordered by its key_compare.
+template <typename T, typename Compare, typename = void>
+struct BTree_key_of {
+  using type = T;
+  using compare = Compare;
+
+  static const T &get(const T &element) {
+    return element;
+  }
+};
+
+template <typename T, typename Compare>
+struct BTree_key_of<T, Compare, std::void_t<typename Compare::key_compare>> {
+  using type = typename Compare::key_type;
+  using compare = typename Compare::key_compare;
+
+  static const type &get(const T &element) {
+    return Compare::key(element);
+  }
+};
+
+// The search keys of a BTree node's slots, if its elements have them.
+template <typename Key, int n>
+struct BTree_node_keys {
+  Key keys[n];
+};
+
+struct BTree_no_node_keys { };
+
+template <typename T,
+          typename Compare=std::less<T>, // default if argument isn't provided
+          typename Allocator=std::allocator<T>
+         >
+class BTree {
+
+  // OVERVIEW: This class represents an ordered set of elements of type T,
+  // with the same invariants as BinarySearchTree (no duplicates, sorted
+  // by Compare) and the same interface for lookups, insertion, erasure
+  // and iteration, so that Map can be built on either (see
+  // BTreeBalanced).
+  //
+  // Instead of one node per element, a B-tree node holds a sorted run of
+  // up to c_node_slots elements, packed side by side in about
+  // c_node_bytes bytes, and an internal node with k elements has k + 1
+  // children, one between each pair of neighbours. Every leaf is at the
+  // same depth and every node but the root is at least half full, so
+  // the height is about log(n) / log(c_node_slots / 2): a search touches
+  // a handful of nodes, each a few adjacent cache lines, where a binary
+  // tree touches one scattered node per level. Inside a node, elements
+  // whose keys have search keys (see BTree_search_key: 32- and 64-bit
+  // integers and strings under std::less, whether the elements are the
+  // keys or, as in a Map, pairs that hold them) are searched through a
+  // separate array of those keys, several at a time with SSE2 (or AVX2
+  // or SSE4.2, when compiled for them); other elements are binary
+  // searched.
+  //
+  // NOTE: Unlike BinarySearchTree, elements move between nodes when
+  //       others are inserted or erased. Insertion and erasure invalidate
+  //       all Iterators (and references to elements) into the tree.
+
+public:
+
+  // Target size of the elements of one node, a few cache lines.
+  static constexpr size_t c_node_bytes = 256;
+
+  // Most elements a node holds. Nodes other than the root hold at least
+  // c_min_slots elements, except that the node split off the right end
+  // of a full node by an append may start out with fewer.
+  static constexpr int c_node_slots =
+    c_node_bytes / sizeof(T) < 4 ? 4
+    : c_node_bytes / sizeof(T) > 64 ? 64 : int(c_node_bytes / sizeof(T));
+  static constexpr int c_min_slots = c_node_slots / 2;
+
+private:
+
+  using Key_of = BTree_key_of<T, Compare>;
+  using Search_key =
+    BTree_search_key<std::remove_cv_t<typename Key_of::type>,
+                     typename Key_of::compare>;
+  static constexpr bool c_search_keys = Search_key::c_enabled;
+
+  // A Node stores a sorted run of elements in raw storage, of which the
+  // first 'count' slots are constructed, plus one spare slot that lets
+  // an insertion overfill it before it is split. It also knows its
+  // parent, its position among the parent's children and the size
+  // (number of elements) of its subtree. Internal_nodes add children.
+  // Where elements have search keys, the Node keeps those of its
+  // constructed slots in 'keys', ahead of everything else, so that a
+  // search reads them from the first cache line on.
+  struct Node
+    : std::conditional_t<c_search_keys,
+                         BTree_node_keys<typename Search_key::type,
+                                         c_node_slots + 1>,
+                         BTree_no_node_keys> {
+    explicit Node(bool leaf_in)
+      : parent(nullptr), position(0), count(0), leaf(leaf_in), size(0) { }
+
+    T &slot(int i) {
+      return *std::launder(reinterpret_cast<T *>(storage) + i);
+    }
+
+    // REQUIRES: slot i is unconstructed
+    // EFFECTS:  Constructs the element in slot i from args, and records
+    //           its search key.
+    template <typename... Args>
+    void construct(int i, Args&&... args) {
+      ::new (static_cast<void *>(storage + i * sizeof(T)))
+        T(std::forward<Args>(args)...);
+      if constexpr (c_search_keys) {
+        this->keys[i] = Search_key::make(Key_of::get(slot(i)));
+      }
+    }
+
+    Node *parent;
+    int position;
+    int count;
+    bool leaf;
+    size_t size;
+    alignas(T) unsigned char storage[(c_node_slots + 1) * sizeof(T)];
+  };
+
+  struct Internal_node : Node {
+    Internal_node()
+      : Node(false) { }
+
+    Node *children[c_node_slots + 2];
+  };
+
+  using Leaf_pool = NodePool<Node, Allocator>;
+  using Internal_pool = NodePool<Internal_node, Allocator>;
+
+public:
+
+  // Default constructor
+  // (Note this will default construct the less comparator)
+  BTree()
+    : root(nullptr) { }
+
+  // Creates an empty tree whose nodes are allocated through alloc.
+  explicit BTree(const Allocator &alloc)
+    : root(nullptr), leaves(alloc), internals(alloc) { }
+
+  // REQUIRES: [first, last) is a forward range sorted according to Compare
+  //           (equivalent elements may repeat)
+  // EFFECTS:  Creates a tree holding the first of each run of equivalent
+  //           elements in the range. See assign().
+  template <typename Iter>
+  BTree(Iter first, Iter last)
+    : root(nullptr) {
+    assign(first, last);
+  }
+
+  // Copy constructor
+  BTree(const BTree &other)
+    : root(nullptr), less(other.less),
+      leaves(std::allocator_traits<Allocator>::
+               select_on_container_copy_construction(other.get_allocator())),
+      internals(leaves.get_allocator()) {
+    root = copy_nodes_impl(other.root, nullptr, 0);
+  }
+
+  // Move constructor
+  // (Takes over the nodes of other, leaving it empty.)
+  BTree(BTree &&other)
+    : root(other.root), less(other.less), leaves(std::move(other.leaves)),
+      internals(std::move(other.internals)) {
+    other.root = nullptr;
+  }
+
+  // Assignment operator
+  BTree &operator=(const BTree &rhs) {
+    if (this == &rhs) {
+      return *this;
+    }
+    clear();
+    less = rhs.less;
+    root = copy_nodes_impl(rhs.root, nullptr, 0);
+    return *this;
+  }
+
+  // Move assignment operator
+  // (Takes over the nodes of rhs, leaving it empty. If the allocators
+  // differ, nodes cannot change hands, so the elements are copied.)
+  BTree &operator=(BTree &&rhs) {
+    if (this == &rhs) {
+      return *this;
+    }
+    if (!(get_allocator() == rhs.get_allocator())) {
+      return *this = rhs;
+    }
+    swap(rhs);
+    rhs.clear();
+    return *this;
+  }
+
+  // Destructor
+  ~BTree() {
+    destroy_nodes_impl(root);
+  }
+
+  // MODIFIES: this BTree
+  // EFFECTS:  Removes all elements and frees their memory.
+  void clear() {
+    destroy_nodes_impl(root);
+    leaves.release();
+    internals.release();
+    root = nullptr;
+  }
+
+  // REQUIRES: [first, last) is a forward range sorted according to Compare
+  //           (equivalent elements may repeat)
+  // MODIFIES: this BTree
+  // EFFECTS:  Replaces the contents of this tree with the first of each
+  //           run of equivalent elements in the range. Each element is
+  //           compared only with the current maximum and appended to the
+  //           rightmost leaf, and leaves fill up before they split, so
+  //           this takes linear time for a tree of bounded height.
+  template <typename Iter>
+  void assign(Iter first, Iter last) {
+    clear();
+    for (; first != last; ++first) {
+      if (root && !less(max_slot_impl(root), *first)) {
+        assert(!less(*first, max_slot_impl(root)));
+        continue;
+      }
+      append(T(*first));
+    }
+  }
+
+  // REQUIRES: the allocators of both trees compare equal (or propagate
+  //           on swap)
+  // MODIFIES: this BTree, other
+  // EFFECTS:  Exchanges the contents of this tree and other in constant
+  //           time.
+  void swap(BTree &other) {
+    using std::swap;
+    swap(root, other.root);
+    swap(less, other.less);
+    leaves.swap(other.leaves);
+    internals.swap(other.internals);
+  }
+
+  // EFFECTS: Returns a copy of the allocator that nodes come from.
+  Allocator get_allocator() const {
+    return leaves.get_allocator();
+  }
+
+  // MODIFIES: this BTree
+  // EFFECTS:  Sets aside room for the leaves that n more elements need
+  //           when appended in order (see assign).
+  void reserve(size_t n) {
+    leaves.reserve(n / (c_node_slots - 1) + 1);
+  }
+
+  // EFFECTS: Returns whether this BTree is empty.
+  bool empty() const {
+    return !root;
+  }
+
+  // EFFECTS: Returns the height of the tree, the number of nodes on the
+  //          path from the root to any leaf.
+  size_t height() const {
+    size_t levels = 0;
+    for (const Node *node = root; node; ++levels) {
+      node = node->leaf ? nullptr : child_impl(node, 0);
+    }
+    return levels;
+  }
+
+  // EFFECTS: Returns the number of elements in this BTree.
+  size_t size() const {
+    return root ? root->size : 0;
+  }
+
+  // EFFECTS: Returns whether the elements are in strictly increasing
+  //          order, and every node's cached size, parent links and search
+  //          keys agree with its contents.
+  bool check_sorting_invariant() const {
+    return check_node_impl(root, nullptr, nullptr, less);
+  }
+
+  class Iterator {
+    // OVERVIEW: Iterator interface for BTree. Iterates over the elements
+    //           in ascending order. Invalidated by any insertion or
+    //           erasure.
+
+  public:
+    Iterator()
+      : node(nullptr), position(0) { }
+
+    // EFFECTS:  Returns the current element by reference.
+    // WARNING:  Any modification must leave the element equivalent to its
+    //           old value. Otherwise, the sorting invariant will no longer
+    //           hold.
+    T &operator*() const {
+      return node->slot(position);
+    }
+
+    // EFFECTS:  Returns the current element by pointer.
+    // WARNING:  See operator*.
+    T *operator->() const {
+      return &node->slot(position);
+    }
+
+    // Prefix ++
+    Iterator &operator++() {
+      if (!node->leaf) {
+        // The next element is the first of the subtree to its right
+        node = child_impl(node, position + 1);
+        for (; !node->leaf; node = child_impl(node, 0)) { }
+        position = 0;
+      }
+      else if (++position == node->count) {
+        // Past the end of a leaf, climb to the first ancestor that has
+        // this leaf to the left of one of its elements
+        for (; node->parent && node->position == node->parent->count;
+             node = node->parent) { }
+        position = node->position;
+        node = node->parent;
+        if (!node) {
+          position = 0;
+        }
+      }
+      return *this;
+    }
+
+    // Postfix ++ (implemented in terms of prefix ++)
+    Iterator operator++(int) {
+      Iterator result(*this);
+      ++(*this);
+      return result;
+    }
+
+    bool operator==(const Iterator &rhs) const {
+      return node == rhs.node && position == rhs.position;
+    }
+
+    bool operator!=(const Iterator &rhs) const {
+      return !(*this == rhs);
+    }
+
+  private:
+    friend class BTree;
+
+    Node *node;
+    int position;
+
+    Iterator(Node *node_in, int position_in)
+      : node(node_in), position(node_in ? position_in : 0) { }
+
+  }; // BTree::Iterator
+  ////////////////////////////////////////
+
+  // EFFECTS : Returns an iterator to the first element in this BTree.
+  Iterator begin() const {
+    if (!root) {
+      return end();
+    }
+    Node *node = root;
+    for (; !node->leaf; node = child_impl(node, 0)) { }
+    return Iterator(node, 0);
+  }
+
+  // EFFECTS: Returns an iterator to past-the-end.
+  Iterator end() const {
+    return Iterator();
+  }
+
+  // EFFECTS: Searches this tree for an element equivalent to query.
+  //          Returns an iterator to it if found, and an end iterator
+  //          otherwise.
+  Iterator find(const T &query) const {
+    return find_impl(root, query, less);
+  }
+
+  // EFFECTS: Same as find(const T &), for any query type K the Compare
+  //          functor compares against T directly. Only available when
+  //          Compare is transparent (declares is_transparent).
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Iterator find(const K &query) const {
+    return find_impl(root, query, less);
+  }
+
+  // EFFECTS: Returns an Iterator to the first element that is not less
+  //          than query, or an end Iterator if there is none.
+  Iterator lower_bound(const T &query) const {
+    return lower_bound_impl(root, query, less, end());
+  }
+
+  // EFFECTS: Same as lower_bound(const T &), for any query type K the
+  //          Compare functor compares against T directly. Only available
+  //          when Compare is transparent (see find).
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Iterator lower_bound(const K &query) const {
+    return lower_bound_impl(root, query, less, end());
+  }
+
+  // EFFECTS: Returns an Iterator to the first element that is greater
+  //          than query, or an end Iterator if there is none.
+  Iterator upper_bound(const T &query) const {
+    return upper_bound_impl(root, query, less, end());
+  }
+
+  // EFFECTS: Same as upper_bound(const T &), for any query type K the
+  //          Compare functor compares against T directly. Only available
+  //          when Compare is transparent (see find).
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Iterator upper_bound(const K &query) const {
+    return upper_bound_impl(root, query, less, end());
+  }
+
+  // EFFECTS: Returns the range of elements equivalent to query, as the
+  //          pair (lower_bound(query), upper_bound(query)).
+  std::pair<Iterator, Iterator> equal_range(const T &query) const {
+    return {lower_bound(query), upper_bound(query)};
+  }
+
+  // EFFECTS: Same as equal_range(const T &), for any query type K the
+  //          Compare functor compares against T directly. Only available
+  //          when Compare is transparent (see find).
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  std::pair<Iterator, Iterator> equal_range(const K &query) const {
+    return {lower_bound(query), upper_bound(query)};
+  }
+
+  // REQUIRES: [first, last) is a forward range of queries, each a T or a
+  //           type Compare compares against T directly (see find)
+  // MODIFIES: out
+  // EFFECTS : Writes to the output iterator out, in order, what find()
+  //           returns for each query, and returns out advanced past them.
+  // NOTE:     As in BinarySearchTree::find_batch, c_batch_lanes searches
+  //           go down in lockstep, each prefetching its next node while
+  //           the others search theirs, and the searches in a group for
+  //           queries between its first and last start from the deepest
+  //           node on both of their paths.
+  template <typename Iter, typename Out>
+  Out find_batch(Iter first, Iter last, Out out) const {
+    using Query =
+      std::remove_cv_t<std::remove_reference_t<decltype(*first)>>;
+    const Query *queries[c_batch_lanes];
+    Node *nodes[c_batch_lanes];
+    Iterator found[c_batch_lanes];
+    while (first != last) {
+      size_t n = 0;
+      for (; n < c_batch_lanes && first != last; ++n, ++first) {
+        queries[n] = &*first;
+      }
+      const T *lower = nullptr;
+      const T *upper = nullptr;
+      Node *start = common_path_impl(root, *queries[0], *queries[n - 1],
+                                     less, lower, upper);
+      for (size_t i = 0; i < n; ++i) {
+        nodes[i] = start == root || between_impl(*queries[i], lower, upper,
+                                                 less) ? start : root;
+        found[i] = Iterator();
+      }
+      for (bool searching = true; searching; ) {
+        searching = false;
+        for (size_t i = 0; i < n; ++i) {
+          Node *node = nodes[i];
+          if (!node) { continue; }
+          int position = search_node_impl(node, *queries[i], less);
+          if (position < node->count &&
+              !less(*queries[i], node->slot(position))) {
+            found[i] = Iterator(node, position);
+            node = nullptr;
+          }
+          else {
+            node = node->leaf ? nullptr : child_impl(node, position);
+          }
+          if (node) {
+            prefetch_impl(node);
+            searching = true;
+          }
+          nodes[i] = node;
+        }
+      }
+      for (size_t i = 0; i < n; ++i) {
+        *out++ = found[i];
+      }
+    }
+    return out;
+  }
+
+  // EFFECTS: Returns an Iterator to the element that has exactly k smaller
+  //          elements in this BTree (counting from 0), or an end Iterator
+  //          if k >= size().
+  Iterator select(size_t k) const {
+    if (k >= size()) {
+      return end();
+    }
+    return select_impl(root, k);
+  }
+
+  // EFFECTS: Returns the number of elements in this BTree that are less
+  //          than query.
+  size_t rank(const T &query) const {
+    return rank_impl(root, query, less, 0);
+  }
+
+  // EFFECTS: Same as rank(const T &), for any query type K the Compare
+  //          functor compares against T directly. Only available when
+  //          Compare is transparent (see find).
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  size_t rank(const K &query) const {
+    return rank_impl(root, query, less, 0);
+  }
+
+  // REQUIRES: The given item is not already contained in this BTree
+  // MODIFIES: this BTree
+  // EFFECTS : Inserts item and returns an Iterator to it.
+  Iterator insert(const T &item) {
+    std::pair<Iterator, bool> result = try_emplace(item, item);
+    assert(result.second);
+    return result.first;
+  }
+
+  // REQUIRES: The given item is not already contained in this BTree
+  // MODIFIES: this BTree, item
+  // EFFECTS : Same as insert(const T &), but moves item into the tree.
+  Iterator insert(T &&item) {
+    std::pair<Iterator, bool> result = try_emplace(item, std::move(item));
+    assert(result.second);
+    return result.first;
+  }
+
+  // REQUIRES: T(args...) is equivalent to key, and Compare can compare key
+  //           against T directly
+  // MODIFIES: this BTree
+  // EFFECTS : Searches for an element equivalent to key. If there is none,
+  //           inserts the element constructed from args into the leaf
+  //           where the search ended, splitting nodes that overflow on the
+  //           way back up. Returns an Iterator to the element equivalent
+  //           to key, and whether it was inserted. When the key is already
+  //           present, args are left untouched.
+  template <typename K, typename... Args>
+  std::pair<Iterator, bool> try_emplace(const K &key, Args&&... args) {
+    if (!root) {
+      root = leaves.create(true);
+      root->construct(0, std::forward<Args>(args)...);
+      root->count = 1;
+      root->size = 1;
+      return {Iterator(root, 0), true};
+    }
+    int position = 0;
+    Node *node = descend_impl(root, key, less, position);
+    if (position < node->count && !less(key, node->slot(position))) {
+      return {Iterator(node, position), false};
+    }
+    T item(std::forward<Args>(args)...);
+    return {insert_leaf(node, position, std::move(item)), true};
+  }
+
+  // REQUIRES: hint is a valid Iterator into this BTree, possibly end()
+  // MODIFIES: this BTree
+  // EFFECTS : Inserts item unless an equivalent element is already
+  //           present, and returns an Iterator to the element equivalent
+  //           to item. When hint is in a leaf (or is end()) and item
+  //           belongs just before or just after the element there, it
+  //           goes straight into that leaf after at most three
+  //           comparisons instead of a search from the root; otherwise
+  //           the hint is ignored. See BinarySearchTree::insert(Iterator,
+  //           const T &).
+  Iterator insert(Iterator hint, const T &item) {
+    return try_emplace_hint(hint, item, item);
+  }
+
+  // REQUIRES: hint is a valid Iterator into this BTree, possibly end()
+  // MODIFIES: this BTree, item
+  // EFFECTS : Same as insert(Iterator, const T &), but moves item into the
+  //           tree if it is inserted.
+  Iterator insert(Iterator hint, T &&item) {
+    return try_emplace_hint(hint, item, std::move(item));
+  }
+
+  // REQUIRES: hint is a valid Iterator into this BTree, possibly end();
+  //           T(args...) is equivalent to key
+  // MODIFIES: this BTree
+  // EFFECTS : Same as try_emplace(key, args...), but first tries to place
+  //           the new element next to hint (see insert(Iterator,
+  //           const T &)). Returns an Iterator to the element equivalent
+  //           to key.
+  template <typename K, typename... Args>
+  Iterator try_emplace_hint(Iterator hint, const K &key, Args&&... args) {
+    Node *leaf = nullptr;
+    int position = 0;
+    if (!root || !hint_slot_impl(hint, key, leaf, position)) {
+      return try_emplace(key, std::forward<Args>(args)...).first;
+    }
+    T item(std::forward<Args>(args)...);
+    return insert_leaf(leaf, position, std::move(item));
+  }
+
+  // REQUIRES: position is a valid, dereferenceable Iterator into this BTree
+  // MODIFIES: this BTree
+  // EFFECTS : Removes the element at position and returns an Iterator to
+  //           the element after it. An element of an internal node is
+  //           replaced by its predecessor, which is taken from a leaf;
+  //           a leaf left less than half full then borrows from or merges
+  //           with a sibling, and so on up the tree.
+  Iterator erase(Iterator position) {
+    size_t index = index_impl(position.node, position.position);
+    erase_slot(position.node, position.position);
+    return select(index);
+  }
+
+  // MODIFIES: this BTree
+  // EFFECTS : Removes the elements in [first, last), which must be a valid
+  //           range of Iterators into this BTree, and returns an Iterator
+  //           to the element last referred to.
+  Iterator erase(Iterator first, Iterator last) {
+    if (first == last) {
+      return last;
+    }
+    size_t index = index_impl(first.node, first.position);
+    size_t count = (last == end() ? size()
+                    : index_impl(last.node, last.position)) - index;
+    for (; count > 0; --count) {
+      first = erase(first);
+    }
+    return first;
+  }
+
+  // MODIFIES: this BTree
+  // EFFECTS : Removes the element equivalent to query, if there is one.
+  //           Returns the number of elements removed (0 or 1).
+  size_t erase(const T &query) {
+    return erase_impl(find(query));
+  }
+
+  // MODIFIES: this BTree
+  // EFFECTS : Same as erase(const T &), for any query type K the Compare
+  //           functor compares against T directly. Only available when
+  //           Compare is transparent (see find).
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  size_t erase(const K &query) {
+    return erase_impl(find(query));
+  }
+
+private:
+
+  // Searches that find_batch advances together.
+  static const size_t c_batch_lanes = 16;
+
+  // DATA REPRESENTATION
+  // The root node of this BTree, or null if it is empty.
+  Node *root;
+
+  // An instance of the Compare type. Use this to compare elements.
+  Compare less;
+
+  // Where the leaves and the internal nodes are allocated.
+  Leaf_pool leaves;
+  Internal_pool internals;
+
+  // MODIFIES: this BTree
+  // EFFECTS : Erases the element at position unless it is an end Iterator.
+  //           Returns the number of elements removed.
+  size_t erase_impl(Iterator position) {
+    if (position == end()) {
+      return 0;
+    }
+    erase(position);
+    return 1;
+  }
+
+  // REQUIRES: this tree is not empty
+  // EFFECTS : Looks for the slot in a leaf next to 'hint' where an element
+  //           equivalent to 'key' belongs: just before the element at
+  //           'hint' (after the last element, for end()), or else just
+  //           after it. Makes at most three comparisons, against the
+  //           elements on either side of the slot. If 'hint' is in an
+  //           internal node, or 'key' falls in neither slot or is
+  //           equivalent to one of those elements, returns false.
+  //           Otherwise returns true and sets 'leaf' and 'position' to
+  //           the slot.
+  template <typename K>
+  bool hint_slot_impl(Iterator hint, const K &key, Node *&leaf,
+                      int &position) const {
+    Node *node = hint.node;
+    int slot = hint.position;
+    if (!node) {
+      for (node = root; !node->leaf; node = child_impl(node, node->count)) { }
+      slot = node->count;
+    }
+    else if (!node->leaf) {
+      return false;
+    }
+    if (slot < node->count && !less(key, node->slot(slot))) {
+      // Not before the hint; try the slot after it
+      if (!less(node->slot(slot), key)) { return false; }
+      ++slot;
+      const T *after = element_after_impl(node, slot);
+      if (after && !less(key, *after)) { return false; }
+    }
+    else {
+      const T *before = element_before_impl(node, slot);
+      if (before && !less(*before, key)) { return false; }
+    }
+    leaf = node;
+    position = slot;
+    return true;
+  }
+
+  // REQUIRES: 'leaf' is a leaf and 0 <= position <= its count
+  // EFFECTS : Returns the element before slot 'position' of 'leaf': the
+  //           one before it in the leaf or, at its start, the element of
+  //           the nearest ancestor that has it to the right. Returns a
+  //           null pointer if there is none.
+  static const T *element_before_impl(Node *leaf, int position) {
+    if (position > 0) {
+      return &leaf->slot(position - 1);
+    }
+    Node *node = leaf;
+    for (; node->parent && node->position == 0; node = node->parent) { }
+    return node->parent ? &node->parent->slot(node->position - 1) : nullptr;
+  }
+
+  // REQUIRES: 'leaf' is a leaf and 0 <= position <= its count
+  // EFFECTS : Returns the element at slot 'position' of 'leaf' or, past
+  //           its end, the element of the nearest ancestor that has it to
+  //           the left. Returns a null pointer if there is none.
+  static const T *element_after_impl(Node *leaf, int position) {
+    if (position < leaf->count) {
+      return &leaf->slot(position);
+    }
+    Node *node = leaf;
+    for (; node->parent && node->position == node->parent->count;
+         node = node->parent) { }
+    return node->parent ? &node->parent->slot(node->position) : nullptr;
+  }
+
+  // REQUIRES: item is greater than every element, or the tree is empty
+  // MODIFIES: this BTree
+  // EFFECTS : Inserts item after the last element of the rightmost leaf.
+  void append(T &&item) {
+    if (!root) {
+      root = leaves.create(true);
+      root->construct(0, std::move(item));
+      root->count = 1;
+      root->size = 1;
+      return;
+    }
+    Node *leaf = root;
+    for (; !leaf->leaf; leaf = child_impl(leaf, leaf->count)) { }
+    insert_leaf(leaf, leaf->count, std::move(item));
+  }
+
+  // REQUIRES: 'leaf' is a leaf, and item belongs at 'position' in it
+  // MODIFIES: this BTree
+  // EFFECTS : Inserts item there, then splits each node on the way up that
+  //           overflows, moving its middle element into its parent (or a
+  //           new root). A node overflowing at its end keeps all but its
+  //           last element, so that appends leave nodes nearly full.
+  //           Returns an Iterator to item.
+  Iterator insert_leaf(Node *leaf, int position, T &&item) {
+    for (Node *node = leaf; node; node = node->parent) {
+      ++node->size;
+    }
+    insert_slot_impl(leaf, position, std::move(item), nullptr);
+    Iterator result(leaf, position);
+    bool result_is_median = false;
+    Node *node = leaf;
+    while (node->count > c_node_slots) {
+      int middle = position == c_node_slots ? c_node_slots - 1
+                   : node->count / 2;
+      Node *sibling = split_impl(node, middle);
+      if (result.node == node && result.position > middle) {
+        result = Iterator(sibling, result.position - middle - 1);
+      }
+      result_is_median = result.node == node && result.position == middle;
+      T median(std::move(node->slot(middle)));
+      node->slot(middle).~T();
+      Node *parent = node->parent;
+      if (!parent) {
+        Internal_node *new_root = internals.create();
+        new_root->construct(0, std::move(median));
+        new_root->count = 1;
+        set_child_impl(new_root, 0, node);
+        set_child_impl(new_root, 1, sibling);
+        new_root->size = node->size + sibling->size + 1;
+        root = new_root;
+        parent = new_root;
+        position = 0;
+      }
+      else {
+        position = node->position;
+        insert_slot_impl(parent, position, std::move(median), sibling);
+      }
+      if (result_is_median) {
+        result = Iterator(parent, position);
+      }
+      node = parent;
+    }
+    return result;
+  }
+
+  // REQUIRES: 'node' and 'position' name an element of this tree
+  // MODIFIES: this BTree
+  // EFFECTS : Removes that element, rebalancing the nodes above the leaf
+  //           it is finally taken from.
+  void erase_slot(Node *node, int position) {
+    if (!node->leaf) {
+      // Replace the element with its predecessor, the last element of the
+      // rightmost leaf of the subtree to its left
+      Node *leaf = child_impl(node, position);
+      for (; !leaf->leaf; leaf = child_impl(leaf, leaf->count)) { }
+      replace_slot_impl(node, position, leaf, leaf->count - 1);
+      node = leaf;
+      position = leaf->count - 1;
+    }
+    else {
+      node->slot(position).~T();
+    }
+    close_slot_impl(node, position);
+    --node->count;
+    for (Node *ancestor = node; ancestor; ancestor = ancestor->parent) {
+      --ancestor->size;
+    }
+    while (node != root && node->count < c_min_slots) {
+      Node *parent = node->parent;
+      refill_impl(node);
+      node = parent;
+    }
+    if (root->count == 0) {
+      Node *old_root = root;
+      root = root->leaf ? nullptr : child_impl(root, 0);
+      if (root) {
+        root->parent = nullptr;
+        root->position = 0;
+      }
+      free_node(old_root);
+    }
+  }
+
+  // REQUIRES: 'node' is not the root and has fewer than c_min_slots
+  //           elements
+  // MODIFIES: this BTree
+  // EFFECTS : Moves an element into 'node' through its parent from a
+  //           sibling that can spare one, or else merges 'node' with a
+  //           sibling and the element between them, which takes an
+  //           element out of the parent.
+  void refill_impl(Node *node) {
+    Node *parent = node->parent;
+    int k = node->position;
+    Node *left = k > 0 ? child_impl(parent, k - 1) : nullptr;
+    Node *right = k < parent->count ? child_impl(parent, k + 1) : nullptr;
+    if (left && left->count > c_min_slots) {
+      rotate_right_impl(parent, k - 1);
+    }
+    else if (right && right->count > c_min_slots) {
+      rotate_left_impl(parent, k);
+    }
+    else if (left) {
+      merge_impl(parent, k - 1);
+    }
+    else {
+      merge_impl(parent, k);
+    }
+  }
+
+  // EFFECTS: Returns the position of the element at 'position' in 'node'
+  //          among all elements of the tree (its rank).
+  static size_t index_impl(const Node *node, int position) {
+    size_t index = position;
+    if (!node->leaf) {
+      for (int i = 0; i <= position; ++i) {
+        index += child_impl(node, i)->size;
+      }
+    }
+    for (; node->parent; node = node->parent) {
+      const Node *parent = node->parent;
+      index += node->position;
+      for (int i = 0; i < node->position; ++i) {
+        index += child_impl(parent, i)->size;
+      }
+    }
+    return index;
+  }
+
+  // EFFECTS: Frees a node whose elements have been destroyed or moved out.
+  void free_node(Node *node) {
+    if (node->leaf) {
+      leaves.destroy(node);
+    }
+    else {
+      internals.destroy(static_cast<Internal_node *>(node));
+    }
+  }
+
+  // EFFECTS: Returns a new node of the same kind as 'node'.
+  Node *new_node_like(const Node *node) {
+    if (node->leaf) {
+      return leaves.create(true);
+    }
+    return internals.create();
+  }
+
+  // EFFECTS: Creates a copy of the tree rooted at 'node' under 'parent'
+  //          at 'position' and returns its root.
+  // NOTE:    This function is tree recursive, but a B-tree is shallow.
+  Node *copy_nodes_impl(Node *node, Node *parent, int position) {
+    if (!node) { return nullptr; }
+    Node *copy = new_node_like(node);
+    copy->parent = parent;
+    copy->position = position;
+    for (int i = 0; i < node->count; ++i) {
+      copy->construct(i, node->slot(i));
+      copy->count = i + 1;
+    }
+    copy->size = node->size;
+    if (!node->leaf) {
+      for (int i = 0; i <= node->count; ++i) {
+        children_impl(copy)[i] = copy_nodes_impl(child_impl(node, i), copy, i);
+      }
+    }
+    return copy;
+  }
+
+  // EFFECTS: Destroys the elements and frees all nodes of the tree rooted
+  //          at 'node'.
+  // NOTE:    This function is tree recursive, but a B-tree is shallow.
+  void destroy_nodes_impl(Node *node) {
+    if (!node) { return; }
+    for (int i = 0; i < node->count; ++i) {
+      node->slot(i).~T();
+    }
+    if (!node->leaf) {
+      for (int i = 0; i <= node->count; ++i) {
+        destroy_nodes_impl(child_impl(node, i));
+      }
+    }
+    free_node(node);
+  }
+
+  // REQUIRES: 'node' overflows by one element, and middle is a position
+  //           with elements on both sides
+  // MODIFIES: 'node'
+  // EFFECTS : Moves the elements after position middle (and the children
+  //           after them) into a new sibling, which is returned, leaving
+  //           the element at middle constructed in 'node' past its new
+  //           count. Recomputes both sizes.
+  Node *split_impl(Node *node, int middle) {
+    Node *sibling = new_node_like(node);
+    for (int i = middle + 1; i < node->count; ++i) {
+      sibling->construct(i - middle - 1, std::move(node->slot(i)));
+      node->slot(i).~T();
+    }
+    if (!node->leaf) {
+      for (int i = middle + 1; i <= node->count; ++i) {
+        set_child_impl(sibling, i - middle - 1, child_impl(node, i));
+      }
+    }
+    sibling->count = node->count - middle - 1;
+    node->count = middle;
+    update_size_impl(node);
+    update_size_impl(sibling);
+    return sibling;
+  }
+
+  // REQUIRES: the children of 'parent' at k and k + 1 have fewer than
+  //           c_node_slots elements together
+  // MODIFIES: 'parent' and those children
+  // EFFECTS : Moves the element at k of 'parent' and everything in the
+  //           child at k + 1 to the end of the child at k, and frees the
+  //           emptied child.
+  void merge_impl(Node *parent, int k) {
+    Node *left = child_impl(parent, k);
+    Node *right = child_impl(parent, k + 1);
+    left->construct(left->count, std::move(parent->slot(k)));
+    parent->slot(k).~T();
+    for (int i = 0; i < right->count; ++i) {
+      left->construct(left->count + 1 + i, std::move(right->slot(i)));
+      right->slot(i).~T();
+    }
+    if (!left->leaf) {
+      for (int i = 0; i <= right->count; ++i) {
+        set_child_impl(left, left->count + 1 + i, child_impl(right, i));
+      }
+    }
+    left->count += right->count + 1;
+    left->size += right->size + 1;
+    close_slot_impl(parent, k);
+    close_child_impl(parent, k + 1);
+    --parent->count;
+    free_node(right);
+  }
+
+  // REQUIRES: the child of 'parent' at k has more than c_min_slots elements
+  // MODIFIES: 'parent' and its children at k and k + 1
+  // EFFECTS : Moves the element at k of 'parent' to the front of the child
+  //           at k + 1, and the last element of the child at k (with its
+  //           last child) up in its place.
+  static void rotate_right_impl(Node *parent, int k) {
+    Node *left = child_impl(parent, k);
+    Node *right = child_impl(parent, k + 1);
+    open_slot_impl(right, 0);
+    right->construct(0, std::move(parent->slot(k)));
+    size_t moved = 1;
+    if (!right->leaf) {
+      Node *child = child_impl(left, left->count);
+      open_child_impl(right, 0);
+      set_child_impl(right, 0, child);
+      moved += child->size;
+    }
+    ++right->count;
+    replace_slot_impl(parent, k, left, left->count - 1);
+    --left->count;
+    left->size -= moved;
+    right->size += moved;
+  }
+
+  // REQUIRES: the child of 'parent' at k + 1 has more than c_min_slots
+  //           elements
+  // MODIFIES: 'parent' and its children at k and k + 1
+  // EFFECTS : Moves the element at k of 'parent' to the end of the child
+  //           at k, and the first element of the child at k + 1 (with its
+  //           first child) up in its place.
+  static void rotate_left_impl(Node *parent, int k) {
+    Node *left = child_impl(parent, k);
+    Node *right = child_impl(parent, k + 1);
+    left->construct(left->count, std::move(parent->slot(k)));
+    size_t moved = 1;
+    if (!left->leaf) {
+      Node *child = child_impl(right, 0);
+      set_child_impl(left, left->count + 1, child);
+      close_child_impl(right, 0);
+      moved += child->size;
+    }
+    ++left->count;
+    replace_slot_impl(parent, k, right, 0);
+    close_slot_impl(right, 0);
+    --right->count;
+    left->size += moved;
+    right->size -= moved;
+  }
+
+  // REQUIRES: 'node' has room for one more element; 'right' is null for a
+  //           leaf and the subtree that follows item otherwise
+  // MODIFIES: 'node'
+  // EFFECTS : Inserts item at 'position' in 'node', and 'right' as the
+  //           child after it. Sizes are left to the caller.
+  static void insert_slot_impl(Node *node, int position, T &&item,
+                               Node *right) {
+    open_slot_impl(node, position);
+    node->construct(position, std::move(item));
+    if (right) {
+      open_child_impl(node, position + 1);
+      set_child_impl(node, position + 1, right);
+    }
+    ++node->count;
+  }
+
+  // MODIFIES: 'node', 'source'
+  // EFFECTS : Replaces the element at 'position' in 'node' with the one at
+  //           'from' in 'source', which is moved out, leaving that slot
+  //           unconstructed. T need not be assignable.
+  static void replace_slot_impl(Node *node, int position, Node *source,
+                                int from) {
+    node->slot(position).~T();
+    node->construct(position, std::move(source->slot(from)));
+    source->slot(from).~T();
+  }
+
+  // EFFECTS: Moves the elements of 'node' from 'position' on one slot to
+  //          the right, leaving 'position' unconstructed.
+  static void open_slot_impl(Node *node, int position) {
+    for (int i = node->count; i > position; --i) {
+      node->construct(i, std::move(node->slot(i - 1)));
+      node->slot(i - 1).~T();
+    }
+  }
+
+  // REQUIRES: the slot at 'position' is unconstructed
+  // EFFECTS:  Moves the elements of 'node' after 'position' one slot to
+  //           the left, leaving the last slot unconstructed.
+  static void close_slot_impl(Node *node, int position) {
+    for (int i = position + 1; i < node->count; ++i) {
+      node->construct(i - 1, std::move(node->slot(i)));
+      node->slot(i).~T();
+    }
+  }
+
+  // EFFECTS: Moves the children of internal 'node' from 'position' on
+  //          one place to the right.
+  static void open_child_impl(Node *node, int position) {
+    for (int i = node->count + 1; i > position; --i) {
+      set_child_impl(node, i, child_impl(node, i - 1));
+    }
+  }
+
+  // EFFECTS: Moves the children of internal 'node' after 'position' one
+  //          place to the left, dropping the child at 'position'.
+  static void close_child_impl(Node *node, int position) {
+    for (int i = position; i < node->count; ++i) {
+      set_child_impl(node, i, child_impl(node, i + 1));
+    }
+  }
+
+  static Node **children_impl(Node *node) {
+    return static_cast<Internal_node *>(node)->children;
+  }
+
+  static Node *child_impl(const Node *node, int i) {
+    return static_cast<const Internal_node *>(node)->children[i];
+  }
+
+  static void set_child_impl(Node *node, int i, Node *child) {
+    children_impl(node)[i] = child;
+    child->parent = node;
+    child->position = i;
+  }
+
+  // MODIFIES: 'node'
+  // EFFECTS : Recomputes the cached size of 'node' from its contents.
+  static void update_size_impl(Node *node) {
+    size_t size = node->count;
+    if (!node->leaf) {
+      for (int i = 0; i <= node->count; ++i) {
+        size += child_impl(node, i)->size;
+      }
+    }
+    node->size = size;
+  }
+
+  // EFFECTS: Returns the greatest element of the nonempty tree rooted at
+  //          'node'.
+  static T &max_slot_impl(Node *node) {
+    for (; !node->leaf; node = child_impl(node, node->count)) { }
+    return node->slot(node->count - 1);
+  }
+
+  // EFFECTS: Returns the number of elements of 'node' that are less than
+  //          query, which is the position of the first element not less
+  //          than query (or count). A query with a search key (an element,
+  //          or a key the elements have search keys for) is counted
+  //          against the node's search keys; only elements whose search
+  //          keys tie with the query's, if they are not exact, are
+  //          compared. Other queries are binary searched.
+  template <typename K>
+  static int search_node_impl(Node *node, const K &query, Compare less) {
+    if constexpr (c_search_keys &&
+                  (std::is_same<K, T>::value ||
+                   Search_key::template accepts<K>::value)) {
+      typename Search_key::type key;
+      if constexpr (std::is_same<K, T>::value) {
+        key = Search_key::make(Key_of::get(query));
+      }
+      else {
+        key = Search_key::make(query);
+      }
+      int low = count_less_keys_impl(node->keys, node->count, key);
+      if constexpr (Search_key::c_exact) {
+        return low;
+      }
+      else {
+        int high = low;
+        for (; high < node->count && node->keys[high] == key; ++high) { }
+        return binary_search_impl(node, query, less, low, high);
+      }
+    }
+    else {
+      return binary_search_impl(node, query, less, 0, node->count);
+    }
+  }
+
+  // EFFECTS: Returns the position of the first element of 'node' in
+  //          [low, high) that is not less than query, or high.
+  template <typename K>
+  static int binary_search_impl(Node *node, const K &query, Compare less,
+                                int low, int high) {
+    while (low < high) {
+      int middle = low + (high - low) / 2;
+      if (less(node->slot(middle), query)) {
+        low = middle + 1;
+      }
+      else {
+        high = middle;
+      }
+    }
+    return low;
+  }
+
+  // EFFECTS: Returns the number of the n sorted 32- or 64-bit integer
+  //          keys that are less than query, comparing all of them without
+  //          branching on the result. Unsigned keys are compared as signed
+  //          after flipping their top bit. 64-bit keys need AVX2 or
+  //          SSE4.2; without them, they are counted one at a time.
+  template <typename K>
+  static int count_less_keys_impl(const K *keys, int n, K query) {
+    int i = 0;
+    int result = 0;
+    if constexpr (sizeof(K) == 4) {
+#if defined(__SSE2__)
+      const std::uint32_t flip = std::is_unsigned<K>::value ? 0x80000000u : 0;
+      std::int32_t q = static_cast<std::int32_t>(query ^ flip);
+#if defined(__AVX2__)
+      __m256i query8 = _mm256_set1_epi32(q);
+      __m256i flip8 = _mm256_set1_epi32(static_cast<std::int32_t>(flip));
+      __m256i less8 = _mm256_setzero_si256();
+      for (; i + 8 <= n; i += 8) {
+        __m256i keys8 = _mm256_xor_si256(flip8, _mm256_loadu_si256(
+                          reinterpret_cast<const __m256i *>(keys + i)));
+        // each lane is -1 where the key is less than the query
+        less8 = _mm256_sub_epi32(less8, _mm256_cmpgt_epi32(query8, keys8));
+      }
+      alignas(32) std::int32_t lanes8[8];
+      _mm256_store_si256(reinterpret_cast<__m256i *>(lanes8), less8);
+      for (std::int32_t lane : lanes8) {
+        result += lane;
+      }
+#endif // __AVX2__
+      __m128i query4 = _mm_set1_epi32(q);
+      __m128i flip4 = _mm_set1_epi32(static_cast<std::int32_t>(flip));
+      __m128i less4 = _mm_setzero_si128();
+      for (; i + 4 <= n; i += 4) {
+        __m128i keys4 = _mm_xor_si128(flip4, _mm_loadu_si128(
+                          reinterpret_cast<const __m128i *>(keys + i)));
+        less4 = _mm_sub_epi32(less4, _mm_cmpgt_epi32(query4, keys4));
+      }
+      alignas(16) std::int32_t lanes4[4];
+      _mm_store_si128(reinterpret_cast<__m128i *>(lanes4), less4);
+      for (std::int32_t lane : lanes4) {
+        result += lane;
+      }
+#endif // __SSE2__
+    }
+    else {
+#if defined(__AVX2__) || defined(__SSE4_2__)
+      const std::uint64_t flip = std::is_unsigned<K>::value
+                                 ? 0x8000000000000000u : 0;
+      long long q = static_cast<long long>(query ^ flip);
+#endif
+#if defined(__AVX2__)
+      __m256i query4 = _mm256_set1_epi64x(q);
+      __m256i flip4 = _mm256_set1_epi64x(static_cast<long long>(flip));
+      __m256i less4 = _mm256_setzero_si256();
+      for (; i + 4 <= n; i += 4) {
+        __m256i keys4 = _mm256_xor_si256(flip4, _mm256_loadu_si256(
+                          reinterpret_cast<const __m256i *>(keys + i)));
+        less4 = _mm256_sub_epi64(less4, _mm256_cmpgt_epi64(query4, keys4));
+      }
+      alignas(32) long long lanes4[4];
+      _mm256_store_si256(reinterpret_cast<__m256i *>(lanes4), less4);
+      for (long long lane : lanes4) {
+        result += int(lane);
+      }
+#endif // __AVX2__
+#if defined(__SSE4_2__)
+      __m128i query2 = _mm_set1_epi64x(q);
+      __m128i flip2 = _mm_set1_epi64x(static_cast<long long>(flip));
+      __m128i less2 = _mm_setzero_si128();
+      for (; i + 2 <= n; i += 2) {
+        __m128i keys2 = _mm_xor_si128(flip2, _mm_loadu_si128(
+                          reinterpret_cast<const __m128i *>(keys + i)));
+        less2 = _mm_sub_epi64(less2, _mm_cmpgt_epi64(query2, keys2));
+      }
+      alignas(16) long long lanes2[2];
+      _mm_store_si128(reinterpret_cast<__m128i *>(lanes2), less2);
+      for (long long lane : lanes2) {
+        result += int(lane);
+      }
+#endif // __SSE4_2__
+    }
+    for (; i < n; ++i) {
+      result += keys[i] < query;
+    }
+    return result;
+  }
+
+  // EFFECTS : Returns the deepest node of the tree rooted at 'node' on the
+  //           search paths of both 'low' and 'high': the first that holds
+  //           an element in [low, high], or else the leaf where both
+  //           paths end. Sets 'lower' and 'upper' to the elements that
+  //           bound its subtree, if any, as in BinarySearchTree.
+  // NOTE: This function must be tail recursive.
+  template <typename Query>
+  static Node *common_path_impl(Node *node, const Query &low,
+                                const Query &high, Compare less,
+                                const T *&lower, const T *&upper) {
+    if (!node || node->leaf) { return node; }
+    int position = search_node_impl(node, low, less);
+    if (position < node->count && !less(high, node->slot(position))) {
+      return node;
+    }
+    if (position > 0) { lower = &node->slot(position - 1); }
+    if (position < node->count) { upper = &node->slot(position); }
+    return common_path_impl(child_impl(node, position), low, high, less,
+                            lower, upper);
+  }
+
+  // EFFECTS : Returns whether query is greater than 'lower' and less than
+  //           'upper', either of which may be null for no bound.
+  template <typename Query>
+  static bool between_impl(const Query &query, const T *lower,
+                           const T *upper, Compare less) {
+    return (!lower || less(*lower, query)) && (!upper || less(query, *upper));
+  }
+
+  // EFFECTS : Hints to the processor that 'node' will be read soon: its
+  //           header and the first few cache lines of its elements.
+  static void prefetch_impl(const Node *node) {
+#if defined(__GNUC__)
+    const char *bytes = reinterpret_cast<const char *>(node);
+    for (size_t offset = 0; offset < sizeof(Node) && offset < 256;
+         offset += 64) {
+      __builtin_prefetch(bytes + offset);
+    }
+#else
+    (void)node;
+#endif
+  }
+
+  // REQUIRES: the tree rooted at 'node' is nonempty
+  // EFFECTS : Returns the node holding an element equivalent to key and
+  //           sets 'position' to its index, or else returns the leaf
+  //           where key belongs and sets 'position' to where in it.
+  // NOTE: This function must be tail recursive.
+  template <typename K>
+  static Node *descend_impl(Node *node, const K &key, Compare less,
+                            int &position) {
+    position = search_node_impl(node, key, less);
+    if (node->leaf ||
+        (position < node->count && !less(key, node->slot(position)))) {
+      return node;
+    }
+    return descend_impl(child_impl(node, position), key, less, position);
+  }
+
+  // EFFECTS : Returns an Iterator to the element equivalent to query in
+  //           the tree rooted at 'node', or an end Iterator.
+  // NOTE: This function must be tail recursive.
+  template <typename K>
+  static Iterator find_impl(Node *node, const K &query, Compare less) {
+    if (!node) { return Iterator(); }
+    int position = search_node_impl(node, query, less);
+    if (position < node->count && !less(query, node->slot(position))) {
+      return Iterator(node, position);
+    }
+    if (node->leaf) { return Iterator(); }
+    return find_impl(child_impl(node, position), query, less);
+  }
+
+  // EFFECTS : Returns an Iterator to the first element not less than query
+  //           in the tree rooted at 'node', or 'bound' (the best candidate
+  //           found above it) if there is none.
+  // NOTE: This function must be tail recursive.
+  template <typename K>
+  static Iterator lower_bound_impl(Node *node, const K &query, Compare less,
+                                   Iterator bound) {
+    if (!node) { return bound; }
+    int position = search_node_impl(node, query, less);
+    if (position < node->count) {
+      bound = Iterator(node, position);
+      if (!less(query, node->slot(position))) { return bound; }
+    }
+    if (node->leaf) { return bound; }
+    return lower_bound_impl(child_impl(node, position), query, less, bound);
+  }
+
+  // EFFECTS : Returns an Iterator to the first element greater than query
+  //           in the tree rooted at 'node', or 'bound' (the best candidate
+  //           found above it) if there is none.
+  // NOTE: This function must be tail recursive.
+  template <typename K>
+  static Iterator upper_bound_impl(Node *node, const K &query, Compare less,
+                                   Iterator bound) {
+    if (!node) { return bound; }
+    int position = search_node_impl(node, query, less);
+    if (position < node->count && !less(query, node->slot(position))) {
+      // An equivalent element: the answer is the first one after it
+      return ++Iterator(node, position);
+    }
+    if (position < node->count) {
+      bound = Iterator(node, position);
+    }
+    if (node->leaf) { return bound; }
+    return upper_bound_impl(child_impl(node, position), query, less, bound);
+  }
+
+  // REQUIRES: k < size of the tree rooted at 'node'
+  // EFFECTS : Returns an Iterator to the k-th smallest element of the tree
+  //           rooted at 'node' (counting from 0).
+  // NOTE: This function must be tail recursive.
+  static Iterator select_impl(Node *node, size_t k) {
+    if (node->leaf) { return Iterator(node, static_cast<int>(k)); }
+    int i = 0;
+    for (; k >= child_impl(node, i)->size; ++i) {
+      k -= child_impl(node, i)->size;
+      if (k == 0) { return Iterator(node, i); }
+      --k;
+    }
+    return select_impl(child_impl(node, i), k);
+  }
+
+  // EFFECTS : Returns 'smaller' plus the number of elements in the tree
+  //           rooted at 'node' that are less than query.
+  // NOTE: This function must be tail recursive.
+  template <typename K>
+  static size_t rank_impl(Node *node, const K &query, Compare less,
+                          size_t smaller) {
+    if (!node) { return smaller; }
+    int position = search_node_impl(node, query, less);
+    smaller += position;
+    if (node->leaf) { return smaller; }
+    for (int i = 0; i < position; ++i) {
+      smaller += child_impl(node, i)->size;
+    }
+    if (position < node->count && !less(query, node->slot(position))) {
+      return smaller + child_impl(node, position)->size;
+    }
+    return rank_impl(child_impl(node, position), query, less, smaller);
+  }
+
+  // EFFECTS: Returns whether the tree rooted at 'node' is sorted, lies
+  //          strictly between *low and *high (where not null), has a
+  //          correct cached size in every node and correct parent links,
+  //          and keeps its leaves at one depth.
+  static bool check_node_impl(Node *node, const T *low, const T *high,
+                              Compare less) {
+    if (!node) { return true; }
+    for (int i = 0; i < node->count; ++i) {
+      const T *previous = i > 0 ? &node->slot(i - 1) : low;
+      if (previous && !less(*previous, node->slot(i))) { return false; }
+      if constexpr (c_search_keys) {
+        if (node->keys[i] != Search_key::make(Key_of::get(node->slot(i)))) {
+          return false;
+        }
+      }
+    }
+    if (high && node->count > 0 && !less(node->slot(node->count - 1), *high)) {
+      return false;
+    }
+    size_t size = node->count;
+    if (!node->leaf) {
+      for (int i = 0; i <= node->count; ++i) {
+        Node *child = child_impl(node, i);
+        if (child->parent != node || child->position != i ||
+            child->leaf != child_impl(node, 0)->leaf ||
+            !check_node_impl(child, i > 0 ? &node->slot(i - 1) : low,
+                             i < node->count ? &node->slot(i) : high, less)) {
+          return false;
+        }
+        size += child->size;
+      }
+    }
+    return size == node->size;
+  }
+
+}; // END of BTree class
+
+// MODIFIES: os
+// EFFECTS : Prints the elements in the tree to the given ostream, like
+//           operator<< for BinarySearchTree: [ 3 5 7 ]
+template <typename T, typename Compare, typename Allocator>
+std::ostream &operator<<(std::ostream &os,
+                         const BTree<T, Compare, Allocator> &tree) {
+  os << "[ ";
+  for (const T& elt : tree) {
+    os << elt << " ";
+  }
+  return os << "]";
+}
+
+#endif // BTREE_HPP
@@ -0,0 +1,166 @@
+/* BTree_bench.cpp
+ *
+ * Compares BTree<int> with BinarySearchTree<int> (AVLBalanced) for
+ * 10^4 keys up to 10^MAX_EXPONENT keys: the time to insert the keys in
+ * random order, and the time per lookup of keys that are present, looked
+ * up one at a time with find() and in batches with find_batch(), both
+ * in random order and as sorted groups of c_group_size keys. Also times
+ * freezing the BinarySearchTree and the same lookups in the resulting
+ * FrozenTree. Then times the same for a Map<int, int> with BTreeBalanced,
+ * whose nodes are searched through their keys with vector compares, and
+ * for one whose key comparator is not std::less, which binary searches
+ * its nodes instead.
+ *
+ * Usage: BTree_bench.exe [MAX_EXPONENT]   (default 7; 8 needs ~6 GB)
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <type_traits>
+#include <vector>
+#include "BinarySearchTree.hpp"
+#include "BTree.hpp"
+#include "Map.hpp"
+
+using namespace std;
+
+// Lookups timed at each size (fewer if there are fewer keys).
+static const size_t c_max_lookups = 1000000;
+
+// Keys per sorted group, about the number of distinct words in a post.
+static const size_t c_group_size = 32;
+
+// EFFECTS: Returns the milliseconds elapsed since start.
+static double elapsed_ms(chrono::steady_clock::time_point start) {
+  chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+// EFFECTS: Inserts keys into an empty Tree, then looks up each of queries,
+//          and prints both times and the height of the tree.
+template <typename Tree>
+void time_tree(const char *label, const vector<int> &keys,
+               const vector<int> &queries) {
+  auto start = chrono::steady_clock::now();
+  Tree tree;
+  for (int key : keys) {
+    tree.insert(key);
+  }
+  double insert_ms = elapsed_ms(start);
+
+  start = chrono::steady_clock::now();
+  long long checksum = 0;
+  for (int query : queries) {
+    checksum += *tree.find(query);
+  }
+  double lookup_ms = elapsed_ms(start);
+
+  cout << "  " << label << ": insert " << insert_ms << " ms, lookup "
+       << lookup_ms * 1e6 / queries.size() << " ns, height " << tree.height()
+       << " (checksum " << checksum << ")" << endl;
+
+  // The same queries in sorted groups, as the words of a post come
+  vector<int> grouped(queries);
+  for (size_t i = 0; i < grouped.size(); i += c_group_size) {
+    sort(grouped.begin() + i,
+         grouped.begin() + min(i + c_group_size, grouped.size()));
+  }
+  vector<typename Tree::Iterator> found(queries.size());
+  const vector<int> *batches[] = {&queries, &grouped};
+  for (const vector<int> *batch : batches) {
+    start = chrono::steady_clock::now();
+    checksum = 0;
+    for (int query : *batch) {
+      checksum += *tree.find(query);
+    }
+    double loop_ms = elapsed_ms(start);
+
+    start = chrono::steady_clock::now();
+    tree.find_batch(batch->begin(), batch->end(), found.begin());
+    for (const auto &it : found) {
+      checksum -= *it;
+    }
+    double batch_ms = elapsed_ms(start);
+    cout << "    " << (batch == &queries ? "random" : "sorted groups")
+         << ": find " << loop_ms * 1e6 / queries.size() << " ns, find_batch "
+         << batch_ms * 1e6 / queries.size() << " ns (difference "
+         << checksum << ")" << endl;
+  }
+
+  if constexpr (std::is_same<Tree, BinarySearchTree<int, less<int>,
+                                                    AVLBalanced>>::value) {
+    start = chrono::steady_clock::now();
+    FrozenTree<int> frozen = tree.freeze();
+    double freeze_ms = elapsed_ms(start);
+
+    start = chrono::steady_clock::now();
+    checksum = 0;
+    for (int query : queries) {
+      checksum += *frozen.find(query);
+    }
+    lookup_ms = elapsed_ms(start);
+    cout << "  FrozenTree: freeze " << freeze_ms << " ms, lookup "
+         << lookup_ms * 1e6 / queries.size() << " ns (checksum " << checksum
+         << ")" << endl;
+  }
+}
+
+// Orders ints as std::less does, but is not std::less, so a BTree has no
+// search keys for them (see BTree_search_key).
+struct Plain_less {
+  bool operator()(int a, int b) const {
+    return a < b;
+  }
+};
+
+// EFFECTS: Inserts keys into an empty Map_type, then looks up each of
+//          queries, and prints both times.
+template <typename Map_type>
+void time_map(const char *label, const vector<int> &keys,
+              const vector<int> &queries) {
+  auto start = chrono::steady_clock::now();
+  Map_type map;
+  for (int key : keys) {
+    map[key] = key;
+  }
+  double insert_ms = elapsed_ms(start);
+
+  start = chrono::steady_clock::now();
+  long long checksum = 0;
+  for (int query : queries) {
+    checksum += map.find(query)->second;
+  }
+  double lookup_ms = elapsed_ms(start);
+
+  cout << "  " << label << ": insert " << insert_ms << " ms, lookup "
+       << lookup_ms * 1e6 / queries.size() << " ns (checksum " << checksum
+       << ")" << endl;
+}
+
+int main(int argc, char *argv[]) {
+  int max_exponent = argc > 1 ? atoi(argv[1]) : 7;
+  mt19937 gen(280);
+  size_t num_keys = 10000;
+  for (int exponent = 4; exponent <= max_exponent; ++exponent) {
+    vector<int> keys(num_keys);
+    iota(keys.begin(), keys.end(), 0);
+    shuffle(keys.begin(), keys.end(), gen);
+    vector<int> queries(keys.begin(),
+                        keys.begin() + min(num_keys, c_max_lookups));
+    shuffle(queries.begin(), queries.end(), gen);
+
+    cout << num_keys << " keys" << endl;
+    time_tree<BinarySearchTree<int, less<int>, AVLBalanced>>(
+      "BinarySearchTree (AVL)", keys, queries);
+    time_tree<BTree<int>>("BTree", keys, queries);
+    time_map<Map<int, int, less<int>, BTreeBalanced>>(
+      "Map (BTreeBalanced)", keys, queries);
+    time_map<Map<int, int, Plain_less, BTreeBalanced>>(
+      "Map (BTreeBalanced, binary search)", keys, queries);
+    num_keys *= 10;
+  }
+}
@@ -0,0 +1,336 @@
+#include <cstdint>
+#include <iterator>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "BTree.hpp"
+#include "unit_test_framework.hpp"
+
+using namespace std;
+
+
+TEST(test_empty) {
+   BTree<int> tree;
+   ASSERT_TRUE(tree.empty());
+   ASSERT_EQUAL(tree.size(), 0u);
+   ASSERT_EQUAL(tree.height(), 0u);
+   ASSERT_TRUE(tree.begin() == tree.end());
+   ASSERT_TRUE(tree.find(1) == tree.end());
+   ASSERT_TRUE(tree.lower_bound(1) == tree.end());
+   ASSERT_EQUAL(tree.rank(1), 0u);
+   ASSERT_EQUAL(tree.erase(1), 0u);
+   ASSERT_TRUE(tree.check_sorting_invariant());
+}
+
+TEST(test_insert_find_iterate) {
+   BTree<int> tree;
+   const int n = 10000;
+   // 0, 7919, 2 * 7919, ... mod n visits every key once, out of order
+   for (int i = 0; i < n; ++i) {
+      int key = static_cast<int>((i * 7919LL) % n);
+      ASSERT_EQUAL(*tree.insert(key), key);
+   }
+   ASSERT_EQUAL(tree.size(), static_cast<size_t>(n));
+   ASSERT_TRUE(tree.check_sorting_invariant());
+   ASSERT_TRUE(tree.height() <= 3u);
+   ASSERT_TRUE(tree.try_emplace(5, 5).second == false);
+
+   int expected = 0;
+   for (int key : tree) {
+      ASSERT_EQUAL(key, expected++);
+   }
+   ASSERT_EQUAL(expected, n);
+   for (int i = 0; i < n; i += 37) {
+      ASSERT_EQUAL(*tree.find(i), i);
+      ASSERT_EQUAL(*tree.select(i), i);
+      ASSERT_EQUAL(tree.rank(i), static_cast<size_t>(i));
+   }
+   ASSERT_TRUE(tree.find(-1) == tree.end());
+   ASSERT_TRUE(tree.find(n) == tree.end());
+   ASSERT_TRUE(tree.select(n) == tree.end());
+}
+
+TEST(test_simd_search_edges) {
+   // negative keys and unsigned keys above INT32_MAX order correctly
+   BTree<int> ints;
+   for (int i = -100; i <= 100; i += 2) {
+      ints.insert(i);
+   }
+   ASSERT_EQUAL(*ints.lower_bound(-99), -98);
+   ASSERT_EQUAL(*ints.upper_bound(-100), -98);
+   ASSERT_EQUAL(*ints.find(-100), -100);
+   ASSERT_EQUAL(ints.rank(0), 50u);
+
+   BTree<uint32_t> big;
+   for (uint32_t i = 0; i < 200; ++i) {
+      big.insert(4000000000u - i * 3);
+      big.insert(i);
+   }
+   ASSERT_TRUE(big.check_sorting_invariant());
+   ASSERT_EQUAL(*big.lower_bound(4000000000u - 4), 4000000000u - 3);
+   ASSERT_EQUAL(*big.lower_bound(200u), 4000000000u - 597);
+   ASSERT_EQUAL(big.rank(3000000000u), 200u);
+}
+
+TEST(test_bounds) {
+   BTree<string> tree;
+   for (const char *word : {"kiwi", "apple", "fig", "date", "lime",
+                            "mango", "pear", "plum", "grape", "cherry"}) {
+      tree.insert(word);
+   }
+   ASSERT_EQUAL(*tree.lower_bound("d"), "date");
+   ASSERT_EQUAL(*tree.lower_bound("fig"), "fig");
+   ASSERT_EQUAL(*tree.upper_bound("fig"), "grape");
+   ASSERT_TRUE(tree.upper_bound("plum") == tree.end());
+   auto range = tree.equal_range("lime");
+   ASSERT_EQUAL(*range.first, "lime");
+   ASSERT_EQUAL(*range.second, "mango");
+
+   ostringstream oss;
+   oss << tree;
+   ASSERT_EQUAL(oss.str(),
+                "[ apple cherry date fig grape kiwi lime mango pear plum ]");
+}
+
+// EFFECTS: Returns whether tree holds exactly the elements of reference.
+bool same_elements(const BTree<string> &tree, const set<string> &reference) {
+   auto expected = reference.begin();
+   for (const string &elt : tree) {
+      if (expected == reference.end() || elt != *expected++) {
+         return false;
+      }
+   }
+   return expected == reference.end() && tree.size() == reference.size();
+}
+
+TEST(test_random_against_set) {
+   // strings give small nodes, so this splits, borrows and merges a lot
+   BTree<string> tree;
+   set<string> reference;
+   mt19937 gen(280);
+   uniform_int_distribution<int> dist(0, 3000);
+   for (int step = 0; step < 20000; ++step) {
+      string key = to_string(dist(gen));
+      if (gen() % 3 != 0) {
+         bool inserted = tree.try_emplace(key, key).second;
+         ASSERT_EQUAL(inserted, reference.insert(key).second);
+      }
+      else {
+         ASSERT_EQUAL(tree.erase(key), reference.erase(key));
+      }
+      if (step % 1000 == 0) {
+         ASSERT_TRUE(tree.check_sorting_invariant());
+      }
+   }
+   ASSERT_TRUE(tree.check_sorting_invariant());
+   ASSERT_EQUAL(tree.size(), reference.size());
+   ASSERT_TRUE(same_elements(tree, reference));
+
+   // erase returns the element after the one removed
+   auto it = tree.lower_bound("5");
+   string key = *it;
+   string after = *next(reference.find(key));
+   ASSERT_EQUAL(*tree.erase(it), after);
+   reference.erase(key);
+
+   // erase everything in a range, then all the rest
+   auto first = tree.lower_bound("2");
+   auto last = tree.lower_bound("4");
+   string last_key = *last;
+   ASSERT_EQUAL(*tree.erase(first, last), last_key);
+   reference.erase(reference.lower_bound("2"), reference.lower_bound("4"));
+   ASSERT_TRUE(tree.check_sorting_invariant());
+   ASSERT_TRUE(same_elements(tree, reference));
+   ASSERT_TRUE(tree.erase(tree.begin(), tree.end()) == tree.end());
+   ASSERT_TRUE(tree.empty());
+}
+
+TEST(test_search_keys) {
+   // 64-bit keys at both ends of their range
+   BTree<int64_t> wide;
+   BTree<uint64_t> uwide;
+   for (int64_t i = 0; i < 200; ++i) {
+      wide.insert(INT64_MIN + i * 3);
+      wide.insert(INT64_MAX - i * 3);
+      uwide.insert(UINT64_MAX - uint64_t(i) * 3);
+      uwide.insert(uint64_t(i));
+   }
+   ASSERT_TRUE(wide.check_sorting_invariant());
+   ASSERT_EQUAL(*wide.lower_bound(INT64_MIN + 1), INT64_MIN + 3);
+   ASSERT_EQUAL(*wide.lower_bound(int64_t(0)), INT64_MAX - 597);
+   ASSERT_EQUAL(wide.rank(int64_t(0)), 200u);
+   ASSERT_TRUE(uwide.check_sorting_invariant());
+   ASSERT_EQUAL(*uwide.lower_bound(uint64_t(200)), UINT64_MAX - 597);
+   ASSERT_EQUAL(uwide.rank(UINT64_MAX), 399u);
+
+   // strings that tie on their first 8 characters
+   BTree<string> words;
+   set<string> reference;
+   for (int i = 0; i < 500; ++i) {
+      string key = (i % 2 ? "prefix__" : "a") + to_string(i * 7 % 500);
+      words.insert(key);
+      reference.insert(key);
+   }
+   words.insert(string("a\0", 2));
+   reference.insert(string("a\0", 2));
+   words.insert("a");
+   reference.insert("a");
+   ASSERT_TRUE(words.check_sorting_invariant());
+   ASSERT_TRUE(same_elements(words, reference));
+   for (const string &key : reference) {
+      ASSERT_EQUAL(*words.find(key), key);
+      auto after = reference.upper_bound(key);
+      if (after == reference.end()) {
+         ASSERT_TRUE(words.upper_bound(key) == words.end());
+      }
+      else {
+         ASSERT_EQUAL(*words.upper_bound(key), *after);
+      }
+   }
+   ASSERT_EQUAL(words.rank("a"), 0u);
+   ASSERT_EQUAL(words.rank(string("a\0", 2)), 1u);
+   ASSERT_TRUE(words.find("prefix_") == words.end());
+}
+
+// Orders pairs by their first member, and names it as their key, as
+// Map's comparator does
+struct First_less {
+   using is_transparent = void;
+   using key_type = int;
+   using key_compare = less<int>;
+
+   static const int &key(const pair<int, double> &element) {
+      return element.first;
+   }
+   bool operator()(const pair<int, double> &a,
+                   const pair<int, double> &b) const {
+      return a.first < b.first;
+   }
+   bool operator()(const pair<int, double> &a, int b) const {
+      return a.first < b;
+   }
+   bool operator()(int a, const pair<int, double> &b) const {
+      return a < b.first;
+   }
+};
+
+TEST(test_search_keys_of_pairs) {
+   BTree<pair<int, double>, First_less> tree;
+   set<int> reference;
+   mt19937 gen(280);
+   uniform_int_distribution<int> dist(-3000, 3000);
+   for (int step = 0; step < 20000; ++step) {
+      int key = dist(gen);
+      if (gen() % 3 != 0) {
+         bool inserted = tree.try_emplace(key, key, 0.5).second;
+         ASSERT_EQUAL(inserted, reference.insert(key).second);
+      }
+      else {
+         ASSERT_EQUAL(tree.erase(key), reference.erase(key));
+      }
+   }
+   ASSERT_TRUE(tree.check_sorting_invariant());
+   for (int key = -3001; key <= 3001; ++key) {
+      auto found = tree.find(key);
+      ASSERT_EQUAL(found != tree.end(), reference.count(key) == 1);
+      ASSERT_TRUE(found == tree.find(make_pair(key, 0.0)));
+      ASSERT_EQUAL(tree.rank(key), size_t(distance(reference.begin(),
+                                          reference.lower_bound(key))));
+   }
+}
+
+TEST(test_copy_move_assign) {
+   vector<int> sorted;
+   for (int i = 0; i < 5000; ++i) {
+      sorted.push_back(i / 2 * 3); // each key twice
+   }
+   BTree<int> tree(sorted.begin(), sorted.end());
+   ASSERT_EQUAL(tree.size(), 2500u);
+   ASSERT_TRUE(tree.check_sorting_invariant());
+   ASSERT_EQUAL(*tree.select(100), 300);
+
+   BTree<int> copy(tree);
+   copy.erase(300);
+   ASSERT_EQUAL(tree.size(), 2500u);
+   ASSERT_EQUAL(copy.size(), 2499u);
+   ASSERT_TRUE(copy.check_sorting_invariant());
+
+   BTree<int> moved(std::move(copy));
+   ASSERT_TRUE(copy.empty());
+   ASSERT_EQUAL(moved.size(), 2499u);
+   copy = moved;
+   ASSERT_EQUAL(copy.size(), 2499u);
+   moved = std::move(tree);
+   ASSERT_EQUAL(moved.size(), 2500u);
+   ASSERT_TRUE(moved.check_sorting_invariant());
+}
+
+TEST(test_insert_hint) {
+   BTree<int> tree;
+   auto hint = tree.end();
+   for (int i = 0; i < 5000; ++i) {
+      hint = tree.insert(hint, 2 * i);
+      ++hint;
+      ASSERT_TRUE(hint == tree.end());
+   }
+   ASSERT_TRUE(tree.check_sorting_invariant());
+   ASSERT_EQUAL(tree.size(), 5000u);
+
+   // odd keys next to every element, whether in a leaf or not
+   for (int i = 1; i < 10000; i += 2) {
+      if (i % 4 == 1) {
+         ASSERT_EQUAL(*tree.insert(tree.find(i + 1), i), i);
+      }
+      else {
+         ASSERT_EQUAL(*tree.insert(tree.find(i - 1), i), i);
+      }
+   }
+   ASSERT_TRUE(tree.check_sorting_invariant());
+   ASSERT_EQUAL(tree.size(), 10000u);
+   for (int i = 0; i < 10000; i += 7) {
+      ASSERT_EQUAL(*tree.select(i), i);
+   }
+
+   // an existing element, and a hint far from the key
+   ASSERT_EQUAL(*tree.insert(tree.find(9), 9), 9);
+   ASSERT_EQUAL(*tree.insert(tree.begin(), 20000), 20000);
+   ASSERT_EQUAL(*tree.insert(tree.end(), -1), -1);
+   ASSERT_EQUAL(tree.size(), 10002u);
+   ASSERT_TRUE(tree.check_sorting_invariant());
+}
+
+TEST(test_find_batch) {
+   BTree<int> tree;
+   for (int i = 0; i < 20000; ++i) {
+      tree.insert(3 * i);
+   }
+   vector<int> queries;
+   for (int i = -5; i < 61000; i += 7) {
+      queries.push_back(i);
+   }
+   for (int i = 0; i < 100; ++i) {
+      queries.push_back(60000 - 99 * i);
+   }
+   vector<BTree<int>::Iterator> found(queries.size());
+   auto end = tree.find_batch(queries.begin(), queries.end(), found.begin());
+   ASSERT_TRUE(end == found.end());
+   for (size_t i = 0; i < queries.size(); ++i) {
+      ASSERT_TRUE(found[i] == tree.find(queries[i]));
+   }
+
+   BTree<string> words;
+   for (const char *word : {"kiwi", "apple", "fig", "date", "lime"}) {
+      words.insert(word);
+   }
+   vector<string> batch = {"apple", "banana", "fig", "lime", "zebra"};
+   vector<BTree<string>::Iterator> results;
+   words.find_batch(batch.begin(), batch.end(), back_inserter(results));
+   ASSERT_EQUAL(*results[0], "apple");
+   ASSERT_TRUE(results[1] == words.end());
+   ASSERT_EQUAL(*results[3], "lime");
+   ASSERT_TRUE(results[4] == words.end());
+}
+
+TEST_MAIN()
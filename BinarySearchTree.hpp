@@ -15,23 +15,196 @@
  * for the private static member functions as directed.
  */
 
+#include <atomic>   //atomic
 #include <cassert>  //assert
+#include <cstddef>  //ptrdiff_t
+#include <cstdint>  //uint32_t, uintptr_t
+#include <exception> //exception_ptr, rethrow_exception
 #include <iostream> //ostream
 #include <functional> //less
+#include <iterator> //bidirectional_iterator_tag, reverse_iterator
+#include <memory> //allocator
+#include <system_error> //system_error
+#include <thread>
+#include <type_traits> //is_trivially_destructible, remove_cv, ...
+#include <utility> //forward, in_place, move, pair
+#include <vector>
+#include "FrozenTree.hpp"
+#include "NodeArray.hpp"
+#include "NodePool.hpp"
 
 // You may add aditional libraries here if needed. You may use any
 // part of the STL except for containers.
 
+// Balancing policies for BinarySearchTree, selected by its third template
+// argument. Unbalanced keeps the plain leaf-insertion tree, whose height
+// depends on the order elements arrive in (sorted input yields a chain).
+// AVLBalanced rotates along the path back up from each insertion so that the
+// heights of sibling subtrees never differ by more than one, keeping the
+// height below 1.45 * log2(n + 2) whatever the insertion order.
+struct Unbalanced {
+  static constexpr bool rebalances = false;
+};
+
+struct AVLBalanced {
+  static constexpr bool rebalances = true;
+};
+
+// Compact storage for either policy, e.g. CompactNodes<AVLBalanced>: the
+// tree keeps its nodes in a single array (a NodeArray) and links them by
+// 32-bit offsets instead of pointers, with 32-bit sizes and heights, so
+// each node carries 20 bytes besides its element rather than 40, and the
+// array can be copied, moved or written out without fixing up any links.
+// When the array fills up, an insertion moves every node to an array
+// twice as large, which invalidates all Iterators, as growing a
+// std::vector does; reserve() sets aside room in advance.
+template <typename Balance>
+struct CompactNodes {
+  static constexpr bool rebalances = Balance::rebalances;
+};
+
+// Instrumentation for any of the above, e.g. Instrumented<AVLBalanced> or
+// Instrumented<CompactNodes<Unbalanced>>: the tree counts its comparisons,
+// searches, the nodes they visit and the nodes it allocates, which
+// stats() reports (see BinarySearchTree::Stats). Without it, none of the
+// counting is compiled in and the tree is exactly as fast and as large.
+template <typename Balance>
+struct Instrumented {
+  static constexpr bool rebalances = Balance::rebalances;
+};
+
+template <typename Balance>
+struct is_compact_nodes : std::false_type { };
+
+template <typename Balance>
+struct is_compact_nodes<CompactNodes<Balance>> : std::true_type { };
+
+template <typename Balance>
+struct is_compact_nodes<Instrumented<Balance>> : is_compact_nodes<Balance> { };
+
+template <typename Balance>
+struct is_instrumented : std::false_type { };
+
+template <typename Balance>
+struct is_instrumented<Instrumented<Balance>> : std::true_type { };
+
+template <typename Balance>
+struct is_instrumented<CompactNodes<Balance>> : is_instrumented<Balance> { };
+
+// Operation counts kept by a tree whose Balance policy is Instrumented,
+// since it was created or last reset_stats(). A moved-from tree's
+// counts go with its elements; a copy starts from zero.
+struct Tree_stats {
+  // Calls to the Compare functor, from any operation.
+  size_t comparisons = 0;
+  // Searches from the root by find() and by insertions, and the nodes
+  // they visited in total: the node found, or the last node visited by
+  // one that missed, and all those above it.
+  size_t searches = 0;
+  size_t nodes_visited = 0;
+  // depth_histogram[d] is the number of those searches that visited d
+  // nodes.
+  std::vector<size_t> depth_histogram;
+  // Nodes created, including those a copy, assign(), compact() or a
+  // growing NodeArray creates.
+  size_t allocations = 0;
+  // Insertions handed an Iterator as a hint that had to search from
+  // the root after all.
+  size_t redescents = 0;
+
+  // EFFECTS: Prints the counts on one line, e.g.
+  //          comparisons 12 searches 4 nodes visited 9 (2.25 per
+  //          search) allocations 3 redescents 0 depths [ 1 1 1 1 ]
+  friend std::ostream &operator<<(std::ostream &os, const Tree_stats &stats) {
+    os << "comparisons " << stats.comparisons << " searches "
+       << stats.searches << " nodes visited " << stats.nodes_visited
+       << " (" << (stats.searches == 0 ? 0.0
+                   : static_cast<double>(stats.nodes_visited) /
+                     stats.searches)
+       << " per search) allocations " << stats.allocations
+       << " redescents " << stats.redescents << " depths [ ";
+    for (size_t count : stats.depth_histogram) {
+      os << count << " ";
+    }
+    return os << "]";
+  }
+};
+
+// The comparator of an Instrumented tree: a Compare that counts its
+// calls, and keeps the rest of the tree's Tree_stats alongside, so that
+// const operations can count too. Copying one copies only the Compare.
+template <typename Compare>
+struct Counting_less {
+  Compare compare;
+  mutable Tree_stats stats;
+
+  Counting_less() = default;
+  Counting_less(const Counting_less &other) : compare(other.compare) { }
+  Counting_less(Counting_less &&other) = default;
+  Counting_less &operator=(const Counting_less &rhs) {
+    compare = rhs.compare;
+    return *this;
+  }
+  Counting_less &operator=(Counting_less &&rhs) = default;
+
+  template <typename A, typename B>
+  bool operator()(const A &a, const B &b) const {
+    ++stats.comparisons;
+    return compare(a, b);
+  }
+};
+
+// Holds the comparator of a container that derives from it. An empty
+// comparator, such as std::less, becomes a base class in turn, so that it
+// takes no room in the container (the empty base optimization).
+template <typename C,
+          bool = std::is_empty<C>::value && !std::is_final<C>::value>
+class Compare_holder : private C {
+protected:
+  C &get() {
+    return *this;
+  }
+
+  const C &get() const {
+    return *this;
+  }
+};
+
+template <typename C>
+class Compare_holder<C, false> {
+protected:
+  C &get() {
+    return held;
+  }
+
+  const C &get() const {
+    return held;
+  }
+
+private:
+  C held;
+};
+
 template <typename T,
-          typename Compare=std::less<T> // default if argument isn't provided
+          typename Compare=std::less<T>, // default if argument isn't provided
+          typename Balance=Unbalanced,
+          typename Allocator=std::allocator<T>
          >
-class BinarySearchTree {
+class BinarySearchTree
+  : private Compare_holder<std::conditional_t<is_instrumented<Balance>::value,
+                                              Counting_less<Compare>,
+                                              Compare>> {
 
   // OVERVIEW: This class represents a binary search tree, storing
   // elements of type T. The Compare functor determines the ordering
   // between elements. The default is std::less<T>, which orders
   // according to the < operator on T. (For simplicity, we assume only
   // comparators that can be default constructed will be used.)
+  // The Balance policy (Unbalanced or AVLBalanced) determines whether
+  // the tree restructures itself on insertion to bound its height.
+  // Nodes are carved out of contiguous slabs by a NodePool, which gets
+  // its memory from Allocator (e.g. std::pmr::polymorphic_allocator<T>),
+  // or, if the policy is wrapped in CompactNodes, kept in one NodeArray.
 
   // INVARIANTS: All these invariants must hold for valid implementations
   // of BinarySearchTree. The invariants may also be considered as an implicit
@@ -61,27 +234,55 @@ class BinarySearchTree {
   // "greater than" end up meaning the same thing when duplicates are
   // not allowed.
 
-  // NOTE: Any operation you define must use RECURSION rather than iteration.
-  //       You may NOT use any looping constructs.
+  // NOTE: Searches from the root down are written recursively. Walks
+  //       down to the least or greatest element and up the parent links,
+  //       walks over the whole tree (copying, destroying, traversing) and
+  //       passes over input ranges are loops, so that their stack use
+  //       does not grow with the height of the tree or the length of the
+  //       range: even a chain of millions of nodes, as sorted input makes
+  //       of an Unbalanced tree, can be copied, printed and destroyed.
 
 private:
 
-  // A Node stores an element and pointers to its left and right children
-  // DO NOT change this struct definition.
+  static constexpr bool c_compact = is_compact_nodes<Balance>::value;
+  static constexpr bool c_instrumented = is_instrumented<Balance>::value;
+
+  struct Node;
+  // The type of the links between nodes, and of their cached counts.
+  using Link = std::conditional_t<c_compact, RelativeLink<Node>, Node *>;
+  using Count = std::conditional_t<c_compact, std::uint32_t, size_t>;
+
+  // A Node stores an element, links to its left and right children and
+  // its parent (null for the root), and the height and size (number of
+  // elements) of the subtree rooted at it.
   struct Node {
 
     // Default constructor - does nothing
     Node() {}
 
     // Custom constructor provided for convenience
-    Node(const T &datum_in, Node *left_in, Node *right_in)
-            : datum(datum_in), left(left_in), right(right_in) { }
+    Node(const T &datum_in, Node *left_in, Node *right_in,
+         Node *parent_in = nullptr)
+            : datum(datum_in), left(left_in), right(right_in),
+              parent(parent_in), height(1), size(1) { }
+
+    // Builds an unlinked node whose datum is constructed from args
+    template <typename... Args>
+    explicit Node(std::in_place_t, Args&&... args)
+            : datum(std::forward<Args>(args)...), left(nullptr),
+              right(nullptr), parent(nullptr), height(1), size(1) { }
 
     T datum;
-    Node *left;
-    Node *right;
+    Link left;
+    Link right;
+    Link parent;
+    int height;
+    Count size;
   };
 
+  using Node_pool = std::conditional_t<c_compact, NodeArray<Node, Allocator>,
+                                       NodePool<Node, Allocator>>;
+
 public:
 
   // Default constructor
@@ -89,23 +290,123 @@ public:
   BinarySearchTree()
     : root(nullptr) { }
 
+  // Creates an empty tree whose nodes are allocated through alloc, e.g.
+  // a std::pmr::polymorphic_allocator<T> wrapping a memory_resource.
+  explicit BinarySearchTree(const Allocator &alloc)
+    : root(nullptr), pool(alloc) { }
+
   // Copy constructor
+  // (The copy's nodes are allocated as a single slab.)
   BinarySearchTree(const BinarySearchTree &other)
-    : root(copy_nodes_impl(other.root)) { }
+    : root(nullptr),
+      pool(std::allocator_traits<Allocator>::
+             select_on_container_copy_construction(other.get_allocator())) {
+    copy_nodes_from(other);
+  }
+
+  // REQUIRES: [first, last) is a forward range sorted according to Compare
+  //           (equivalent elements may repeat)
+  // EFFECTS:  Creates a perfectly balanced tree holding the first of each
+  //           run of equivalent elements in the range, in linear time.
+  //           (Note this will default construct the less comparator)
+  template <typename Iter>
+  BinarySearchTree(Iter first, Iter last)
+    : root(nullptr) {
+    assign(first, last);
+  }
+
+  // Move constructor
+  // (Takes over the nodes of other, leaving it empty. Iterators into
+  // other remain valid and now refer to this tree.)
+  BinarySearchTree(BinarySearchTree &&other)
+    : Compare_holder<Less>(std::move(other)), root(other.root),
+      pool(std::move(other.pool)) {
+    other.root = nullptr;
+  }
 
   // Assignment operator
   BinarySearchTree &operator=(const BinarySearchTree &rhs) {
     if (this == &rhs) {
       return *this;
     }
-    destroy_nodes_impl(root);
-    root = copy_nodes_impl(rhs.root);
+    clear();
+    copy_nodes_from(rhs);
+    return *this;
+  }
+
+  // Move assignment operator
+  // (Takes over the nodes of rhs, leaving it empty. If the allocators
+  // differ, nodes cannot change hands, so the elements are copied.)
+  BinarySearchTree &operator=(BinarySearchTree &&rhs) {
+    if (this == &rhs) {
+      return *this;
+    }
+    if (!(get_allocator() == rhs.get_allocator())) {
+      return *this = rhs;
+    }
+    swap(rhs);
+    discard_nodes_impl(rhs.root, rhs.pool);
+    rhs.pool.release();
+    rhs.root = nullptr;
     return *this;
   }
 
   // Destructor
+  // (When T is trivially destructible, this only frees the slabs.)
   ~BinarySearchTree() {
-    destroy_nodes_impl(root);
+    discard_nodes_impl(root, pool);
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS:  Removes all elements and frees their memory.
+  void clear() {
+    discard_nodes_impl(root, pool);
+    pool.release();
+    root = nullptr;
+  }
+
+  // REQUIRES: [first, last) is a forward range sorted according to Compare
+  //           (equivalent elements may repeat)
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS:  Replaces the contents of this tree with the first of each
+  //           run of equivalent elements in the range, arranged as a
+  //           perfectly balanced tree (so valid under any Balance policy)
+  //           whose nodes are contiguous and in order. Takes linear time.
+  template <typename Iter>
+  void assign(Iter first, Iter last) {
+    clear();
+    size_t count = count_distinct_impl(first, last, less());
+    pool.reserve(count);
+    root = build_impl(first, last, count, nullptr, less(), pool);
+    note_allocations(count);
+  }
+
+  // REQUIRES: the allocators of both trees compare equal (or propagate
+  //           on swap)
+  // MODIFIES: this BinarySearchTree, other
+  // EFFECTS:  Exchanges the contents of this tree and other in constant
+  //           time. Iterators stay valid and follow their elements.
+  void swap(BinarySearchTree &other) {
+    using std::swap;
+    swap(root, other.root);
+    swap(less(), other.less());
+    pool.swap(other.pool);
+  }
+
+  // EFFECTS: Returns a copy of the allocator that nodes come from.
+  Allocator get_allocator() const {
+    return pool.get_allocator();
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS:  Sets aside room so that the tree can grow to n elements
+  //           without further allocation, with the new nodes stored
+  //           contiguously. Under CompactNodes, insertions up to n
+  //           elements then keep all Iterators valid (see insert).
+  void reserve(size_t n) {
+    if (n > size()) {
+      reserve_nodes(n - size());
+    }
   }
 
   // EFFECTS: Returns whether this BinarySearchTree is empty.
@@ -120,7 +421,7 @@ public:
 
   // EFFECTS: Returns the number of elements in this BinarySearchTree.
   size_t size() const {
-    return static_cast<size_t>(size_impl(root));
+    return size_impl(root);
   }
 
   // EFFECTS: Traverses the tree using an in-order traversal,
@@ -139,24 +440,181 @@ public:
     traverse_preorder_impl(root, os);
   }
 
+  // EFFECTS: Calls f(elt) for each element in order, following the links
+  //          directly with constant stack, where a loop over Iterators
+  //          copies an Iterator per step. f may modify the elements, as
+  //          through an Iterator, but not their order.
+  template <typename F>
+  void for_each(F &&f) const {
+    for_each_impl(root, f);
+  }
+
+  // REQUIRES: f may be called concurrently on different elements
+  // EFFECTS:  Calls f(elt) for each element, in no particular order, on up
+  //           to 'threads' threads (0, the default, means one per core).
+  //           The tree is cut into disjoint subtrees by their cached
+  //           sizes, and the threads take subtrees off a shared counter
+  //           until none are left; the few nodes above them are visited
+  //           at the end by the calling thread. If f throws, the others
+  //           stop early and the first exception is rethrown here. The
+  //           subtrees of a balanced tree are even; those of a chain are
+  //           not, so rebalance() a degenerate tree first.
+  template <typename F>
+  void parallel_for_each(F f, size_t threads = 0) const {
+    threads = threads_impl(threads);
+    std::vector<Node *> tops;
+    std::vector<Node *> pieces = cut_impl(root, threads, tops);
+    run_pieces_impl(pieces.size(), threads, [&](size_t i) {
+      for_each_impl(pieces[i], f);
+    });
+    for (Node *node : tops) {
+      f(node->datum);
+    }
+  }
+
+  // REQUIRES: combine is associative and commutative and 'identity' is
+  //           its identity element (e.g. 0 for +); transform and combine
+  //           may be called concurrently
+  // EFFECTS:  Returns the combination of transform(elt) over all the
+  //           elements, computed like parallel_for_each: each thread
+  //           reduces whole subtrees, starting from 'identity', and the
+  //           calling thread combines their results.
+  template <typename R, typename Transform, typename Combine>
+  R parallel_reduce(R identity, Transform transform, Combine combine,
+                    size_t threads = 0) const {
+    threads = threads_impl(threads);
+    std::vector<Node *> tops;
+    std::vector<Node *> pieces = cut_impl(root, threads, tops);
+    struct Partial {
+      R value;
+    };
+    std::vector<Partial> partials(pieces.size(), Partial{identity});
+    run_pieces_impl(pieces.size(), threads, [&](size_t i) {
+      R value = identity;
+      auto add = [&](T &elt) {
+        value = combine(std::move(value), transform(elt));
+      };
+      for_each_impl(pieces[i], add);
+      partials[i].value = std::move(value);
+    });
+    R result = std::move(identity);
+    for (Partial &partial : partials) {
+      result = combine(std::move(result), std::move(partial.value));
+    }
+    for (Node *node : tops) {
+      result = combine(std::move(result), transform(node->datum));
+    }
+    return result;
+  }
+
   // EFFECTS: Returns whether or not the sorting invariant holds on
   //          the root of this BinarySearchTree.
   //
-  // NOTE: This function must be recursive.
+  // NOTE: This takes one in-order pass, O(n) time and constant stack,
+  //       so it is cheap enough to leave on in debug builds.
   bool check_sorting_invariant() const {
-    return check_sorting_invariant_impl(root, less);
+    return check_sorting_invariant_impl(root, less());
+  }
+
+  // A summary of the shape of a tree, for spotting one that has
+  // degenerated, e.g. an Unbalanced tree fed sorted keys.
+  struct Health {
+    size_t size;
+    size_t height;
+    // The least height any tree of this size can have, ceil(log2(n + 1)),
+    // and height divided by it (1 for a perfectly balanced tree; an AVL
+    // tree stays below about 1.44; a chain reaches n / log2(n + 1)).
+    size_t optimal_height;
+    double height_ratio;
+    // depth_histogram[d] is the number of elements at depth d, counting
+    // the root as depth 1, for d from 0 (always 0) to height.
+    std::vector<size_t> depth_histogram;
+    // The mean depth of the elements, which is the number of nodes a
+    // successful find() visits on average.
+    double average_depth;
+
+    // EFFECTS: Prints the report on one line, with the histogram from
+    //          depth 1 to height, e.g.
+    //          size 6 height 4 (1.33333x optimal 3) average depth 2.5
+    //          depths [ 1 2 2 1 ]
+    friend std::ostream &operator<<(std::ostream &os, const Health &health) {
+      os << "size " << health.size << " height " << health.height << " ("
+         << health.height_ratio << "x optimal " << health.optimal_height
+         << ") average depth " << health.average_depth << " depths [ ";
+      for (size_t depth = 1; depth < health.depth_histogram.size(); ++depth) {
+        os << health.depth_histogram[depth] << " ";
+      }
+      return os << "]";
+    }
+  };
+
+  // Operation counts kept by a tree whose Balance policy is Instrumented
+  // (see Tree_stats).
+  using Stats = Tree_stats;
+
+  // REQUIRES: the Balance policy is Instrumented
+  // EFFECTS:  Returns the operation counts of this tree.
+  const Stats &stats() const {
+    static_assert(c_instrumented, "stats() needs an Instrumented policy");
+    return less().stats;
+  }
+
+  // REQUIRES: the Balance policy is Instrumented
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS:  Sets all the operation counts back to zero.
+  void reset_stats() {
+    static_assert(c_instrumented, "stats() needs an Instrumented policy");
+    less().stats = Stats();
+  }
+
+  // EFFECTS: Returns a Health report on the shape of this tree, gathered
+  //          in one pass over it in O(n) time and constant stack.
+  Health health() const {
+    Health health;
+    health.size = size();
+    health.height = height();
+    health.optimal_height = 0;
+    for (size_t full = 0; full < health.size; full = 2 * full + 1) {
+      ++health.optimal_height;
+    }
+    health.height_ratio = health.optimal_height == 0 ? 1.0
+      : static_cast<double>(health.height) / health.optimal_height;
+    health.depth_histogram.assign(health.height + 1, 0);
+    depth_histogram_impl(root, health.depth_histogram);
+    size_t total_depth = 0;
+    for (size_t depth = 1; depth <= health.height; ++depth) {
+      total_depth += depth * health.depth_histogram[depth];
+    }
+    health.average_depth = health.size == 0 ? 0.0
+      : static_cast<double>(total_depth) / health.size;
+    return health;
   }
 
   class Iterator {
     // OVERVIEW: Iterator interface for BinarySearchTree.
     //           Iterates over the elements in ascending order as defined
-    //           by the sorted ordering of the BinarySearchTree.
+    //           by the sorted ordering of the BinarySearchTree, and back
+    //           in descending order: decrementing end() reaches the
+    //           maximum element, as for a std::set.
+    //
+    //           An end Iterator remembers a node of its tree, the root
+    //           for end() or the last element for one that ++ moved past
+    //           it, and -- climbs from there to find the maximum. So it
+    //           can be compared at any time, but not decremented once
+    //           that node is erased. A default-constructed Iterator is
+    //           an end Iterator that cannot be decremented.
 
     // Big Three for Iterator not needed
 
   public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = T *;
+    using reference = T &;
+
     Iterator()
-      : root(nullptr), current_node(nullptr) {}
+      : current_node(nullptr) {}
 
     // EFFECTS:  Returns the current element by reference.
     // WARNING:  Dereferencing an iterator returns an element from the tree
@@ -188,14 +646,17 @@ public:
 
     // Prefix ++
     Iterator &operator++() {
+      Node *next;
       if (current_node->right) {
         // If has right child, next element is minimum of right subtree
-        current_node = min_element_impl(current_node->right);
+        next = min_element_impl(current_node->right);
       }
       else {
-        // Otherwise, look in the whole tree for the next biggest element
-        current_node = min_greater_than_impl(root, current_node->datum, less);
+        // Otherwise, the next element is the closest ancestor that has
+        // this node in its left subtree
+        next = next_ancestor_impl(current_node);
       }
+      current_node = next ? next : end_mark(current_node);
       return *this;
     }
 
@@ -206,60 +667,186 @@ public:
       return result;
     }
 
+    // REQUIRES: this Iterator is not at the first element
+    // Prefix --
+    Iterator &operator--() {
+      if (at_end()) {
+        // Climb from the node remembered to the root, then take the
+        // maximum
+        Node *node = unmarked(current_node);
+        assert(node);
+        while (node->parent) {
+          node = node->parent;
+        }
+        current_node = max_element_impl(node);
+      }
+      else if (current_node->left) {
+        // If has left child, previous element is maximum of left subtree
+        current_node = max_element_impl(current_node->left);
+      }
+      else {
+        // Otherwise, the previous element is the closest ancestor that
+        // has this node in its right subtree
+        current_node = prev_ancestor_impl(current_node);
+        assert(current_node);
+      }
+      return *this;
+    }
+
+    // Postfix -- (implemented in terms of prefix --)
+    Iterator operator--(int) {
+      Iterator result(*this);
+      --(*this);
+      return result;
+    }
+
     bool operator==(const Iterator &rhs) const {
-      return current_node == rhs.current_node;
+      return current_node == rhs.current_node || (at_end() && rhs.at_end());
     }
 
     bool operator!=(const Iterator &rhs) const {
-      return current_node != rhs.current_node;
+      return !(*this == rhs);
     }
 
   private:
     friend class BinarySearchTree;
 
-    Node *root;
+    // The node of the element, or, for an end Iterator, the node it
+    // remembers with its lowest bit set (see end_mark), or null. This is
+    // all an Iterator holds: the next node is found by following the
+    // links of the tree, so it need not know the root or the Compare.
     Node *current_node;
-    Compare less;
 
-    Iterator(Node *root_in, Node* current_node_in, Compare less_in)
-      : root(root_in), current_node(current_node_in), less(less_in) { }
+    explicit Iterator(Node *current_node_in)
+      : current_node(current_node_in) { }
+
+    // EFFECTS: Returns node with its lowest bit set, which no pointer to
+    //          a Node has, as alignof(Node) > 1. Null stays null.
+    static Node *end_mark(Node *node) {
+      static_assert(alignof(Node) > 1, "the lowest bit marks end Iterators");
+      return reinterpret_cast<Node *>(reinterpret_cast<std::uintptr_t>(node) |
+                                      std::uintptr_t(node != nullptr));
+    }
+
+    // EFFECTS: Returns node with its lowest bit cleared.
+    static Node *unmarked(Node *node) {
+      return reinterpret_cast<Node *>(reinterpret_cast<std::uintptr_t>(node) &
+                                      ~std::uintptr_t(1));
+    }
+
+    bool at_end() const {
+      return !current_node ||
+             (reinterpret_cast<std::uintptr_t>(current_node) & 1);
+    }
+
+    // EFFECTS: Returns the node of the element, or null for an end
+    //          Iterator.
+    Node *node() const {
+      return at_end() ? nullptr : current_node;
+    }
 
   }; // BinarySearchTree::Iterator
   ////////////////////////////////////////
 
 
+  // Iterates over the elements in descending order, from rbegin() to
+  // rend(). Reading the last k elements this way takes O(height + k)
+  // time.
+  using Reverse_iterator = std::reverse_iterator<Iterator>;
+
   // EFFECTS : Returns an iterator to the first element
   //           in this BinarySearchTree.
   Iterator begin() const {
     if (root == nullptr) {
-      return Iterator();
+      return end();
     }
-    return Iterator(root, min_element_impl(root), less);
+    return Iterator(min_element_impl(root));
   }
 
   // EFFECTS: Returns an iterator to past-the-end.
   Iterator end() const {
-    return Iterator();
+    return Iterator(Iterator::end_mark(root));
+  }
+
+  // EFFECTS: Returns a reverse iterator to the maximum element, or rend()
+  //          if the tree is empty.
+  Reverse_iterator rbegin() const {
+    return Reverse_iterator(end());
+  }
+
+  // EFFECTS: Returns a reverse iterator to before the minimum element.
+  Reverse_iterator rend() const {
+    return Reverse_iterator(begin());
   }
 
 
   // EFFECTS: Returns an Iterator to the minimum element in this
   //          BinarySearchTree or an end Iterator if the tree is empty.
   Iterator min_element() const {
-    return Iterator(root, min_element_impl(root), less);
+    return iterator_at(min_element_impl(root));
   }
 
   // EFFECTS: Returns an Iterator to the maximum element in this
   //          BinarySearchTree or an end Iterator if the tree is empty.
   Iterator max_element() const {
-    return Iterator(root, max_element_impl(root), less);
+    return iterator_at(max_element_impl(root));
   }
 
   // EFFECTS: Returns an Iterator to the minimum element in this
   //          BinarySearchTree greater than the given value.
   //          If the tree is empty, returns an end Iterator.
   Iterator min_greater_than(const T &value) const {
-    return Iterator(root, min_greater_than_impl(root, value, less), less);
+    return upper_bound(value);
+  }
+
+  // EFFECTS: Returns an Iterator to the first element in this
+  //          BinarySearchTree that is not less than query, or an end
+  //          Iterator if there is none. Iterating from there to
+  //          upper_bound() visits every element equivalent to (or in a
+  //          range of) queries in O(height + k) time for k elements.
+  Iterator lower_bound(const T &query) const {
+    return iterator_at(lower_bound_impl(root, query, less(), nullptr));
+  }
+
+  // EFFECTS: Same as lower_bound(const T &), for any query type K the
+  //          Compare functor compares against T directly. Only available
+  //          when Compare is transparent (see find).
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Iterator lower_bound(const K &query) const {
+    return iterator_at(lower_bound_impl(root, query, less(), nullptr));
+  }
+
+  // EFFECTS: Returns an Iterator to the first element in this
+  //          BinarySearchTree that is greater than query, or an end
+  //          Iterator if there is none.
+  Iterator upper_bound(const T &query) const {
+    return iterator_at(upper_bound_impl(root, query, less(), nullptr));
+  }
+
+  // EFFECTS: Same as upper_bound(const T &), for any query type K the
+  //          Compare functor compares against T directly. Only available
+  //          when Compare is transparent (see find).
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Iterator upper_bound(const K &query) const {
+    return iterator_at(upper_bound_impl(root, query, less(), nullptr));
+  }
+
+  // EFFECTS: Returns the range of elements equivalent to query, as the
+  //          pair (lower_bound(query), upper_bound(query)). It is empty
+  //          or holds one element, since there are no duplicates.
+  std::pair<Iterator, Iterator> equal_range(const T &query) const {
+    return {lower_bound(query), upper_bound(query)};
+  }
+
+  // EFFECTS: Same as equal_range(const T &), for any query type K the
+  //          Compare functor compares against T directly. Only available
+  //          when Compare is transparent (see find).
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  std::pair<Iterator, Iterator> equal_range(const K &query) const {
+    return {lower_bound(query), upper_bound(query)};
   }
 
 
@@ -273,35 +860,571 @@ public:
   //          to the existing value. Otherwise, the sorting invariant
   //          will no longer hold.
   Iterator find(const T &query) const {
-    return Iterator(root, find_impl(root, query, less), less);
+    return iterator_at(search(query));
+  }
+
+  // EFFECTS: Same as find(const T &), but query may be of any type K that
+  //          the Compare functor compares against T directly, so no T has
+  //          to be built for the lookup. Only available when Compare is
+  //          transparent (declares is_transparent, as std::less<> does).
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Iterator find(const K &query) const {
+    return iterator_at(search(query));
+  }
+
+  // REQUIRES: [first, last) is a forward range of queries, each a T or a
+  //           type Compare compares against T directly (see find)
+  // MODIFIES: out
+  // EFFECTS : Writes to the output iterator out, in order, what find()
+  //           returns for each query, and returns out advanced past them.
+  // NOTE:     A search misses the cache at almost every level of a large
+  //           tree, and a loop over find() waits out each miss in turn.
+  //           Here c_batch_lanes searches advance in lockstep instead: each
+  //           takes one step down and prefetches the node it moves to,
+  //           which then arrives while the other searches take theirs.
+  //           Searches in a group also share the top of their paths:
+  //           those for queries between the first and the last of the
+  //           group start from the deepest node on both of their paths.
+  //           When the queries are in ascending order, as when they come
+  //           from a std::set, that is all of them.
+  template <typename Iter, typename Out>
+  Out find_batch(Iter first, Iter last, Out out) const {
+    using Query =
+      std::remove_cv_t<std::remove_reference_t<decltype(*first)>>;
+    const Query *queries[c_batch_lanes];
+    Node *nodes[c_batch_lanes];
+    Node *found[c_batch_lanes];
+    while (first != last) {
+      size_t n = 0;
+      for (; n < c_batch_lanes && first != last; ++n, ++first) {
+        queries[n] = &*first;
+      }
+      const T *lower = nullptr;
+      const T *upper = nullptr;
+      Node *start = common_path_impl(root, *queries[0], *queries[n - 1],
+                                     less(), lower, upper);
+      for (size_t i = 0; i < n; ++i) {
+        nodes[i] = start == root || between_impl(*queries[i], lower, upper,
+                                                 less()) ? start : root;
+        found[i] = nullptr;
+      }
+      for (bool searching = true; searching; ) {
+        searching = false;
+        for (size_t i = 0; i < n; ++i) {
+          Node *node = nodes[i];
+          if (!node) { continue; }
+          if (less()(*queries[i], node->datum)) {
+            node = node->left;
+          }
+          else if (less()(node->datum, *queries[i])) {
+            node = node->right;
+          }
+          else {
+            found[i] = node;
+            node = nullptr;
+          }
+          if (node) {
+            prefetch_impl(node);
+            searching = true;
+          }
+          nodes[i] = node;
+        }
+      }
+      for (size_t i = 0; i < n; ++i) {
+        *out++ = iterator_at(found[i]);
+      }
+    }
+    return out;
+  }
+
+  // EFFECTS: Returns an Iterator to the element that has exactly k smaller
+  //          elements in this BinarySearchTree (the k-th smallest,
+  //          counting from 0), or an end Iterator if k >= size().
+  Iterator select(size_t k) const {
+    return iterator_at(select_impl(root, k));
+  }
+
+  // EFFECTS: Returns the number of elements in this BinarySearchTree that
+  //          are less than query. If query is contained in the tree, this
+  //          is its position in sorted order, so select(rank(x)) finds x.
+  size_t rank(const T &query) const {
+    return rank_impl(root, query, less(), 0);
+  }
+
+  // EFFECTS: Same as rank(const T &), for any query type K the Compare
+  //          functor compares against T directly. Only available when
+  //          Compare is transparent (see find).
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  size_t rank(const K &query) const {
+    return rank_impl(root, query, less(), 0);
   }
 
   // REQUIRES: The given item is not already contained in this BinarySearchTree
   // MODIFIES: this BinarySearchTree
   // EFFECTS : Inserts the element k into this BinarySearchTree, maintaining
-  //           the sorting invariant.
+  //           the sorting invariant. Returns an Iterator to the new element,
+  //           found during the same descent that placed it.
+  //           Iterators to other elements stay valid, except under
+  //           CompactNodes when the node array is full: the insertion then
+  //           moves every node to a larger array, which invalidates all
+  //           Iterators, as growing a std::vector does. Choosing
+  //           CompactNodes opts into this; reserve() avoids it. The same
+  //           holds for every other way of inserting an element.
   Iterator insert(const T &item) {
-    assert(find(item) == end());
-    root = insert_impl(root, item, less);
-    return find(item);
+    std::pair<Iterator, bool> result = try_emplace(item, item);
+    assert(result.second);
+    return result.first;
+  }
+
+  // REQUIRES: The given item is not already contained in this BinarySearchTree
+  // MODIFIES: this BinarySearchTree, item
+  // EFFECTS : Same as insert(const T &), but moves item into the tree
+  //           rather than copying it.
+  Iterator insert(T &&item) {
+    std::pair<Iterator, bool> result = try_emplace(item, std::move(item));
+    assert(result.second);
+    return result.first;
+  }
+
+  // REQUIRES: The element T(args...) is not already contained in this
+  //           BinarySearchTree
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Inserts the element constructed in place from args, and
+  //           returns an Iterator to it.
+  template <typename... Args>
+  Iterator emplace(Args&&... args) {
+    if constexpr (c_compact) {
+      if (pool.available() == 0) {
+        // No slot to build the element in: build it aside, so the array
+        // grows only once the search shows it is new
+        T item(std::forward<Args>(args)...);
+        return try_emplace(item, std::move(item)).first;
+      }
+    }
+    Node *leaf = pool.create(std::in_place, std::forward<Args>(args)...);
+    note_allocations(1);
+    Node *parent = nullptr;
+    bool go_left = false;
+    Node *existing = descend_impl(root, leaf->datum, less(), parent, go_left);
+    note_search(existing ? existing : parent);
+    assert(!existing);
+    if (existing) {
+      pool.destroy(leaf);
+      return Iterator(existing);
+    }
+    link_leaf(leaf, parent, go_left);
+    return Iterator(leaf);
+  }
+
+  // REQUIRES: T(args...) is equivalent to key, and Compare can compare key
+  //           against T directly (key is usually a T itself, or the
+  //           Compare functor is transparent)
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Searches for an element equivalent to key. If there is none,
+  //           inserts the element constructed in place from args, found
+  //           in the same descent. Returns an Iterator to the element
+  //           equivalent to key, and whether it was inserted. When the key
+  //           is already present, args are left untouched.
+  template <typename K, typename... Args>
+  std::pair<Iterator, bool> try_emplace(const K &key, Args&&... args) {
+    Node *parent = nullptr;
+    bool go_left = false;
+    Node *existing = descend_impl(root, key, less(), parent, go_left);
+    note_search(existing ? existing : parent);
+    if (existing) {
+      return {Iterator(existing), false};
+    }
+    parent = room_for_leaf(parent);
+    Node *leaf = pool.create(std::in_place, std::forward<Args>(args)...);
+    note_allocations(1);
+    link_leaf(leaf, parent, go_left);
+    return {Iterator(leaf), true};
+  }
+
+  // REQUIRES: hint is a valid Iterator into this BinarySearchTree,
+  //           possibly end()
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Inserts item unless an equivalent element is already
+  //           present, and returns an Iterator to the element equivalent
+  //           to item. When item belongs just before the element at hint
+  //           (or at the end, for end()) or just after it, it is linked
+  //           in next to hint after at most three comparisons, instead of
+  //           a search from the root; otherwise the hint is ignored. So
+  //           ascending input can be fed as insert(end(), item), or as
+  //           hint = insert(hint, item), and a sorted batch is merged in
+  //           with a constant number of comparisons per element. Above
+  //           the new leaf, heights are refreshed only as far as they
+  //           change (O(1) steps amortized under AVLBalanced), but every
+  //           ancestor's cached size is still incremented, so the insert
+  //           takes O(depth) time: O(log n) under AVLBalanced, and O(n) on
+  //           the chain that ascending input makes of an Unbalanced tree,
+  //           where ingesting n sorted elements takes O(n^2) time. For
+  //           those, use assign(), or AVLBalanced.
+  Iterator insert(Iterator hint, const T &item) {
+    return try_emplace_hint(hint, item, item);
+  }
+
+  // REQUIRES: hint is a valid Iterator into this BinarySearchTree,
+  //           possibly end()
+  // MODIFIES: this BinarySearchTree, item
+  // EFFECTS : Same as insert(Iterator, const T &), but moves item into the
+  //           tree if it is inserted.
+  Iterator insert(Iterator hint, T &&item) {
+    return try_emplace_hint(hint, item, std::move(item));
+  }
+
+  // REQUIRES: hint is a valid Iterator into this BinarySearchTree,
+  //           possibly end(); T(args...) is equivalent to key
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Same as try_emplace(key, args...), but first tries to link
+  //           the new element in next to hint (see insert(Iterator,
+  //           const T &)). Returns an Iterator to the element equivalent
+  //           to key.
+  template <typename K, typename... Args>
+  Iterator try_emplace_hint(Iterator hint, const K &key, Args&&... args) {
+    Node *parent = nullptr;
+    bool go_left = false;
+    if (!hint_position_impl(root, hint.node(), key, less(),
+                            parent, go_left)) {
+      note_redescent();
+      return try_emplace(key, std::forward<Args>(args)...).first;
+    }
+    parent = room_for_leaf(parent);
+    Node *leaf = pool.create(std::in_place, std::forward<Args>(args)...);
+    note_allocations(1);
+    link_leaf(leaf, parent, go_left);
+    return Iterator(leaf);
+  }
+
+  // REQUIRES: position is a valid, dereferenceable Iterator into this
+  //           BinarySearchTree
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Removes the element at position, rebalancing the path above
+  //           it, and returns an Iterator to the element after it.
+  //           Iterators to other elements remain valid. The node goes on
+  //           a free list that later insertions reuse.
+  Iterator erase(Iterator position) {
+    Node *node = position.current_node;
+    Iterator next = position;
+    ++next;
+    Node *changed; // the lowest node whose subtree changed shape
+    if (!node->left || !node->right) {
+      changed = node->parent;
+      replace_subtree(node, node->left ? node->left : node->right);
+    }
+    else {
+      // Move the successor, which has no left child, into node's place
+      Node *successor = min_element_impl(node->right);
+      if (successor->parent == node) {
+        changed = successor;
+      }
+      else {
+        changed = successor->parent;
+        replace_subtree(successor, successor->right);
+        successor->right = node->right;
+        successor->right->parent = successor;
+      }
+      successor->left = node->left;
+      successor->left->parent = successor;
+      replace_subtree(node, successor);
+    }
+    pool.destroy(node);
+    rebalance_path(changed);
+    return iterator_at(next.node());
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Removes the elements in [first, last), which must be a valid
+  //           range of Iterators into this BinarySearchTree, and returns
+  //           last.
+  Iterator erase(Iterator first, Iterator last) {
+    while (first != last) {
+      first = erase(first);
+    }
+    return last;
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Removes the element equivalent to query, if there is one.
+  //           Returns the number of elements removed (0 or 1).
+  size_t erase(const T &query) {
+    return erase_impl(find(query));
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Same as erase(const T &), for any query type K the Compare
+  //           functor compares against T directly. Only available when
+  //           Compare is transparent (see find).
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  size_t erase(const K &query) {
+    return erase_impl(find(query));
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Removes the elements that are not less than key from this
+  //           tree and returns them as a new tree (with the same
+  //           allocator). The nodes are relinked rather than compared or
+  //           copied, in O(height) time, which is O(log n) under
+  //           AVLBalanced, and both parts keep their Balance policy. As
+  //           each tree allocates from a pool of its own, the smaller
+  //           part is then copied into fresh nodes, and iterators into it
+  //           are invalidated; iterators into the larger part stay valid.
+  //           (Under CompactNodes the elements of the smaller part are
+  //           moved into a perfectly balanced tree instead.)
+  BinarySearchTree split(const T &key) {
+    return split_at_impl(key);
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Same as split(const T &), for any key type K the Compare
+  //           functor compares against T directly. Only available when
+  //           Compare is transparent (see find).
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  BinarySearchTree split(const K &key) {
+    return split_at_impl(key);
+  }
+
+  // REQUIRES: every element of other is greater than every element of
+  //           this tree
+  // MODIFIES: this BinarySearchTree, other
+  // EFFECTS : Moves all the elements of other to the end of this tree,
+  //           leaving other empty; the reverse of split. When the
+  //           allocators compare equal, this tree takes over the nodes of
+  //           other and links them in, in O(height) time, which is
+  //           O(log n) under AVLBalanced; iterators into other then refer
+  //           to this tree. Otherwise, or if this tree has enough slots
+  //           freed by an earlier split to hold them, the elements are
+  //           copied, in O(m + log n) time, so that repeated splits and
+  //           joins reuse memory rather than accumulate it. Under
+  //           CompactNodes, where links cannot reach into the array of
+  //           other, the elements of other are moved into new nodes, in
+  //           O(m + log n) time, which may invalidate all iterators (see
+  //           reserve).
+  void join(BinarySearchTree &other) {
+    if (this == &other || other.empty()) {
+      return;
+    }
+    Node *right = take_nodes(other);
+    if (!root) {
+      root = right;
+      return;
+    }
+    Node *pivot = unlink_max_impl(root);
+    root = join_impl(root, pivot, right);
+  }
+
+  // MODIFIES: this BinarySearchTree, other
+  // EFFECTS : Moves into this tree every element of other that has no
+  //           equivalent here, like std::set::merge, leaving in other only
+  //           the elements that were already present in both. Walks both
+  //           trees in order once and rebuilds them perfectly balanced,
+  //           moving the elements, so it takes O(n + m) time rather than
+  //           the O(m log(n + m)) of inserting one at a time. Iterators
+  //           into both trees are invalidated.
+  void merge(BinarySearchTree &other) {
+    if (this == &other) {
+      return;
+    }
+    std::vector<T *> merged;
+    std::vector<T *> left_over;
+    merged.reserve(size() + other.size());
+    Iterator a = begin();
+    Iterator b = other.begin();
+    while (a != end() || b != other.end()) {
+      if (b == other.end() || (a != end() && less()(*a, *b))) {
+        merged.push_back(&*a++);
+      }
+      else if (a == end() || less()(*b, *a)) {
+        merged.push_back(&*b++);
+      }
+      else {
+        merged.push_back(&*a++);
+        left_over.push_back(&*b++);
+      }
+    }
+    BinarySearchTree result(get_allocator());
+    result.less() = less();
+    result.build_from_pointers_impl<T &&>(merged);
+    BinarySearchTree rest(other.get_allocator());
+    rest.less() = other.less();
+    rest.build_from_pointers_impl<T &&>(left_over);
+    *this = std::move(result);
+    other = std::move(rest);
+  }
+
+  // EFFECTS: Returns a new tree holding copies of the elements that are in
+  //          this tree, other, or both (taken from this tree when in
+  //          both). Like the three functions below, it walks both trees
+  //          in order once and builds the result perfectly balanced, in
+  //          O(n + m) time.
+  BinarySearchTree set_union(const BinarySearchTree &other) const {
+    return set_operation_impl(other, true, true, true);
+  }
+
+  // EFFECTS: Returns a new tree holding copies of the elements of this
+  //          tree that have an equivalent in other, in O(n + m) time.
+  BinarySearchTree set_intersection(const BinarySearchTree &other) const {
+    return set_operation_impl(other, false, true, false);
+  }
+
+  // EFFECTS: Returns a new tree holding copies of the elements of this
+  //          tree that have no equivalent in other, in O(n + m) time.
+  BinarySearchTree set_difference(const BinarySearchTree &other) const {
+    return set_operation_impl(other, true, false, false);
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Reshapes the tree to the least possible height, with every
+  //           level full except perhaps the last, in O(n) time and
+  //           constant extra space (the Day-Stout-Warren algorithm):
+  //           right rotations straighten it into a chain of right
+  //           children, the "vine", and passes of left rotations down the
+  //           vine then fold it in half, again and again. Only links
+  //           change, so iterators stay valid, and the result is valid
+  //           under any Balance policy.
+  void rebalance() {
+    if (empty()) {
+      return;
+    }
+    size_t n = size();
+    Node *vine = tree_to_vine_impl(root);
+    // Fold the leaves of the last level off first, leaving a perfect tree
+    size_t perfect = 1;
+    while (2 * perfect + 1 <= n) {
+      perfect = 2 * perfect + 1;
+    }
+    compress_impl(vine, n - perfect);
+    for (size_t m = perfect / 2; m > 0; m /= 2) {
+      compress_impl(vine, m);
+    }
+    root = vine;
+    relink_impl(root);
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Moves the elements into new nodes that lie side by side in
+  //           one slab (or array) in order, with the same shape, so that
+  //           iteration reads memory sequentially and searches near the
+  //           bottom of the tree share cache lines. Takes O(n) time and
+  //           frees the old slabs along with their free slots, so it also
+  //           trims a tree after many erasures. Invalidates all iterators.
+  //           Calling rebalance() first gives the best layout for lookups.
+  void compact() {
+    Node_pool packed(get_allocator());
+    packed.reserve(size());
+    Node *first = nullptr;
+    size_t k = 0;
+    for (Node *node = min_element_impl(root); node;
+         node = node->right ? min_element_impl(node->right)
+                            : next_ancestor_impl(node), ++k) {
+      Node *copy = packed.create(std::in_place, std::move(node->datum));
+      if (!first) {
+        first = copy;
+      }
+      assert(copy == first + k);
+      place_links_impl(node, copy, first, k);
+    }
+    Node *packed_root = root ? first + size_impl(root->left) : nullptr;
+    note_allocations(k);
+    discard_nodes_impl(root, pool);
+    pool.swap(packed);
+    root = packed_root;
+  }
+
+  // EFFECTS: Returns an immutable copy of this tree laid out in one array
+  //          for faster lookups (see FrozenTree.hpp), e.g. once a tree is
+  //          done being built. Later changes to this tree do not affect it.
+  FrozenTree<T, Compare> freeze() const {
+    return FrozenTree<T, Compare>(begin(), end());
+  }
+
+  // EFFECTS: Writes the elements of this tree to the file at path in the
+  //          snapshot format of FrozenTree::save (see Snapshot.hpp), in
+  //          linear time and without building a FrozenTree. Throws
+  //          snapshot_exception on failure.
+  void save(const std::string &path) const {
+    FrozenTree<T, Compare>::save_sorted(path, begin(), end());
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS:  Replaces the contents of this tree with the elements saved
+  //           in the file at path, built as by assign() in linear time.
+  //           Throws snapshot_exception, leaving this tree unchanged, if
+  //           the file cannot be loaded or its elements are not in
+  //           strictly increasing order by Compare (see
+  //           FrozenTree::load). To look up elements straight from the
+  //           file, load a FrozenTree instead.
+  void load(const std::string &path) {
+    FrozenTree<T, Compare> frozen = FrozenTree<T, Compare>::load(path);
+    assign(frozen.begin(), frozen.end());
   }
 
   // EFFECTS: Returns a human-readable string representation of this
-  //          BinarySearchTree. Works best for small trees.
+  //          BinarySearchTree. Works best for small trees: a tree more
+  //          than 16 levels tall is cut off below 16 levels, as by
+  //          to_string(16).
   //
   // NOTE: This member function is implemented for you in TreePrint.hpp.
   //       You may use it, but you don't need to worry about how it works.
   std::string to_string() const;
 
+  // EFFECTS: Same as to_string(), but draws only the top max_depth levels
+  //          of the tree, and "..." in place of each subtree below them.
+  //          The drawing is about 2^max_depth columns wide whatever the
+  //          size of the tree, and only the elements drawn are printed,
+  //          so a look at the top of a huge or degenerate tree is cheap.
+  //          At most 16 levels are drawn, whatever max_depth is.
+  std::string to_string(size_t max_depth) const;
+
+  // MODIFIES: os
+  // EFFECTS:  Writes this tree to os as a Graphviz DOT digraph, e.g. for
+  //           "dot -Tsvg": one node per element, labeled with the element
+  //           as printed by <<, and an edge to each child, leaving the
+  //           parent from the bottom left for a left child and the bottom
+  //           right for a right child. The nodes are numbered in
+  //           pre-order. Takes linear time and constant memory, as each
+  //           line is written out as soon as it is known.
+  void to_dot(std::ostream &os) const;
+
 
 private:
 
+  // Searches that find_batch advances together.
+  static const size_t c_batch_lanes = 16;
+
+  // Subtrees that parallel_for_each aims to cut the tree into per thread,
+  // so that threads that get smaller ones can take more.
+  static const size_t c_pieces_per_thread = 8;
+
+  // The comparator the tree holds, and how it hands it to the static
+  // helpers: Compare itself by value unless the tree is Instrumented, in
+  // which case the helpers must count into the tree's own Counting_less.
+  using Less = std::conditional_t<c_instrumented, Counting_less<Compare>,
+                                  Compare>;
+  using Less_ref = std::conditional_t<c_instrumented,
+                                      const Counting_less<Compare> &,
+                                      Compare>;
+
   // DATA REPRESENTATION
   // The root node of this BinarySearchTree.
   Node *root;
 
-  // An instance of the Compare type. Use this to compare elements.
-  Compare less;
+  // The instance of the Compare type is held by the Compare_holder base.
+  // Use less() to compare elements.
+  Less &less() {
+    return Compare_holder<Less>::get();
+  }
+
+  const Less &less() const {
+    return Compare_holder<Less>::get();
+  }
+
+  // Where the nodes of this BinarySearchTree are allocated.
+  Node_pool pool;
 
     
   // NOTE: These member types are implemented for you in TreePrint.hpp.
@@ -310,10 +1433,347 @@ private:
   class Tree_grid_square;
   class Tree_grid;
 
-  // NOTE: This member function is implemented for you in TreePrint.hpp.
-  //       It supports the to_string function. You do not have to do
-  //       anything with it. DO NOT CHANGE.
-  int get_max_elt_width() const;
+  // EFFECTS : Returns an Iterator to node, or end() if node is null.
+  Iterator iterator_at(Node *node) const {
+    return node ? Iterator(node) : end();
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Erases the element at position unless it is an end Iterator.
+  //           Returns the number of elements removed.
+  size_t erase_impl(Iterator position) {
+    if (position == end()) {
+      return 0;
+    }
+    erase(position);
+    return 1;
+  }
+
+  // A pointer to an element seen as the element itself: build_impl reads
+  // elements through it, by copy (Ref = const T &) or by move (T &&).
+  template <typename Ref>
+  struct Pointee_iterator {
+    T * const *position;
+
+    Ref operator*() const {
+      return static_cast<Ref>(**position);
+    }
+
+    Pointee_iterator &operator++() {
+      ++position;
+      return *this;
+    }
+
+    bool operator!=(const Pointee_iterator &rhs) const {
+      return position != rhs.position;
+    }
+  };
+
+  // REQUIRES: this tree is empty; 'elements' point to elements in strictly
+  //           increasing order
+  // MODIFIES: this BinarySearchTree, the elements if Ref is T &&
+  // EFFECTS : Builds a perfectly balanced tree from the elements, copied
+  //           or moved into place according to Ref (see Pointee_iterator).
+  template <typename Ref>
+  void build_from_pointers_impl(const std::vector<T *> &elements) {
+    Pointee_iterator<Ref> first{elements.data()};
+    Pointee_iterator<Ref> last{elements.data() + elements.size()};
+    pool.reserve(elements.size());
+    root = build_impl(first, last, elements.size(), nullptr, less(), pool);
+    note_allocations(elements.size());
+  }
+
+  // EFFECTS : Walks this tree and other in order and returns a new tree
+  //           holding copies of the elements found only in this tree (if
+  //           'keep_this'), in both (if 'keep_both', taking the one here)
+  //           and only in other (if 'keep_other').
+  BinarySearchTree set_operation_impl(const BinarySearchTree &other,
+                                      bool keep_this, bool keep_both,
+                                      bool keep_other) const {
+    std::vector<T *> chosen;
+    Iterator a = begin();
+    Iterator b = other.begin();
+    while (a != end() || b != other.end()) {
+      if (b == other.end() || (a != end() && less()(*a, *b))) {
+        if (keep_this) { chosen.push_back(&*a); }
+        ++a;
+      }
+      else if (a == end() || less()(*b, *a)) {
+        if (keep_other) { chosen.push_back(&*b); }
+        ++b;
+      }
+      else {
+        if (keep_both) { chosen.push_back(&*a); }
+        ++a;
+        ++b;
+      }
+    }
+    BinarySearchTree result(get_allocator());
+    result.less() = less();
+    result.build_from_pointers_impl<const T &>(chosen);
+    return result;
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Implements split: relinks the nodes into the part less than
+  //           key and the rest, then hands the nodes of the rest to the
+  //           new tree, copying whichever part is smaller into a pool of
+  //           its own.
+  template <typename K>
+  BinarySearchTree split_at_impl(const K &key) {
+    BinarySearchTree upper(get_allocator());
+    upper.less() = less();
+    Node *low;
+    Node *high;
+    split_impl(root, key, less(), low, high);
+    if (size_impl(low) < size_impl(high)) {
+      // The new tree keeps the whole pool; the low part moves out
+      pool.swap(upper.pool);
+      root = nullptr;
+      upper.root = high;
+      adopt_part(low, upper.pool);
+    }
+    else {
+      root = low;
+      upper.adopt_part(high, pool);
+    }
+    return upper;
+  }
+
+  // REQUIRES: 'leaf' is a single node that belongs as the left (go_left)
+  //           or right child of 'parent', where that child is null, or
+  //           'parent' is null and this tree is empty
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Links 'leaf' into place and rebalances the path above it
+  //           (see grow_path_impl).
+  void link_leaf(Node *leaf, Node *parent, bool go_left) {
+    leaf->parent = parent;
+    if (!parent) {
+      root = leaf;
+      return;
+    }
+    if (go_left) {
+      parent->left = leaf;
+    }
+    else {
+      parent->right = leaf;
+    }
+    root = grow_path_impl(parent);
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Rebalances 'node' and then each of its ancestors in turn (see
+  //           rebalance_impl), relinking every subtree that a rotation
+  //           gave a new root, including the root of the tree.
+  void rebalance_path(Node *node) {
+    if (node) {
+      root = rebalance_up_impl(node);
+    }
+  }
+
+  // REQUIRES: 'node' is in this tree; 'replacement' is null or a subtree
+  //           that may take its place
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Makes 'replacement' the child of the parent of 'node' in
+  //           place of 'node' (or the root, if 'node' is the root).
+  //           Does not update any heights or sizes.
+  void replace_subtree(Node *node, Node *replacement) {
+    Node *parent = node->parent;
+    if (!parent) {
+      root = replacement;
+    }
+    else if (parent->left == node) {
+      parent->left = replacement;
+    }
+    else {
+      parent->right = replacement;
+    }
+    if (replacement) {
+      replacement->parent = parent;
+    }
+  }
+
+  // REQUIRES: this tree is empty
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Gives this tree copies of the nodes of other, in EXACTLY
+  //           the same structure, and a single slab (or array) of its own.
+  void copy_nodes_from(const BinarySearchTree &other) {
+    if constexpr (c_compact) {
+      // A node copied to the same index has its links copied with it
+      pool.mirror(other.pool, 0);
+      visit_nodes_impl(other.root, [&](const Node *node) {
+        pool.construct_at(pool.counterpart(other.pool, node), *node);
+      });
+      root = other.root ? pool.counterpart(other.pool, other.root) : nullptr;
+    }
+    else {
+      pool.reserve(other.size());
+      root = copy_nodes_impl(other.root, nullptr, pool);
+    }
+    note_allocations(other.size());
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Guarantees that the next n nodes can be created without
+  //           further allocation. A full NodeArray is replaced by one at
+  //           least twice as large, which moves every node: no pointer to
+  //           a node of this tree may be kept across this call.
+  void reserve_nodes(size_t n) {
+    if constexpr (c_compact) {
+      if (pool.available() < n) {
+        grow_nodes(n);
+      }
+    }
+    else {
+      pool.reserve(n);
+    }
+  }
+
+  // EFFECTS : Searches for an element equivalent to query, as find()
+  //           does, and returns its node, or null if there is none.
+  template <typename K>
+  Node *search(const K &query) const {
+    if constexpr (c_instrumented) {
+      // descend_impl also reports the last node of a search that misses
+      Node *parent = nullptr;
+      bool go_left = false;
+      Node *found = descend_impl(root, query, less(), parent, go_left);
+      note_search(found ? found : parent);
+      return found;
+    }
+    else {
+      return find_impl(root, query, less());
+    }
+  }
+
+  // EFFECTS : If this tree is Instrumented, counts a search from the root
+  //           whose last node was 'last' (null if the tree was empty).
+  //           Otherwise does nothing.
+  void note_search(const Node *last) const {
+    if constexpr (c_instrumented) {
+      size_t depth = 0;
+      for (; last; last = last->parent) {
+        ++depth;
+      }
+      Stats &stats = less().stats;
+      ++stats.searches;
+      stats.nodes_visited += depth;
+      if (stats.depth_histogram.size() <= depth) {
+        stats.depth_histogram.resize(depth + 1);
+      }
+      ++stats.depth_histogram[depth];
+    }
+  }
+
+  // EFFECTS : If this tree is Instrumented, counts n nodes created.
+  void note_allocations(size_t n) const {
+    if constexpr (c_instrumented) {
+      less().stats.allocations += n;
+    }
+  }
+
+  // EFFECTS : If this tree is Instrumented, counts a hinted insertion that
+  //           searched from the root instead.
+  void note_redescent() const {
+    if constexpr (c_instrumented) {
+      ++less().stats.redescents;
+    }
+  }
+
+  // REQUIRES: parent is a node of this tree, or null
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Makes room for one more node once an insertion has found
+  //           its place under parent, and returns parent, which moves if
+  //           the NodeArray has to grow (see reserve_nodes). Growing only
+  //           after the search has missed keeps lookups of present keys
+  //           from moving nodes. A NodePool needs no help: it adds slabs
+  //           as it goes.
+  Node *room_for_leaf(Node *parent) {
+    if constexpr (c_compact) {
+      if (pool.available() == 0) {
+        return grow_nodes(1, parent);
+      }
+    }
+    return parent;
+  }
+
+  // REQUIRES: keep is a node of this tree, or null
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Moves every node to a new NodeArray with room for at least
+  //           n more, each to the same index as before, so the links
+  //           between them carry over unchanged. Returns where keep
+  //           moved to.
+  Node *grow_nodes(size_t n, Node *keep = nullptr) {
+    size_t extra = pool.slab_capacity() < Node_pool::c_min_nodes
+                   ? Node_pool::c_min_nodes : pool.slab_capacity();
+    Node_pool larger(get_allocator());
+    larger.mirror(pool, extra < n ? n : extra);
+    visit_nodes_impl(root, [&](Node *node) {
+      larger.construct_at(larger.counterpart(pool, node), std::move(*node));
+    });
+    Node *moved_root = root ? larger.counterpart(pool, root) : nullptr;
+    Node *moved_keep = keep ? larger.counterpart(pool, keep) : nullptr;
+    discard_nodes_impl(root, pool);
+    pool.swap(larger);
+    root = moved_root;
+    note_allocations(size());
+    return moved_keep;
+  }
+
+  // REQUIRES: this tree is empty; 'part' is a tree of nodes from 'from'
+  //           with no parent
+  // MODIFIES: this BinarySearchTree, 'from'
+  // EFFECTS : Gives this tree copies of the nodes of 'part' and destroys
+  //           the originals. Under CompactNodes, where links cannot reach
+  //           from one NodeArray into another, the elements are moved
+  //           into a perfectly balanced tree instead.
+  void adopt_part(Node *part, Node_pool &from) {
+    if constexpr (c_compact) {
+      std::vector<T *> elements = elements_impl(part);
+      build_from_pointers_impl<T &&>(elements);
+    }
+    else {
+      pool.reserve(size_impl(part));
+      root = copy_nodes_impl(part, nullptr, pool);
+      note_allocations(size());
+    }
+    destroy_nodes_impl(part, from);
+  }
+
+  // MODIFIES: this BinarySearchTree, other
+  // EFFECTS : Hands the nodes of other over to this tree, leaving other
+  //           empty, and returns their root (whose parent is null). The
+  //           pools are spliced if the allocators compare equal, unless
+  //           this pool has enough freed slots for the nodes of other (as
+  //           a split leaves it), which are then reused rather than
+  //           keeping both; otherwise, and always under CompactNodes, the
+  //           elements are copied (moved, under CompactNodes) into new
+  //           nodes.
+  Node *take_nodes(BinarySearchTree &other) {
+    Node *taken = other.root;
+    if constexpr (c_compact) {
+      std::vector<T *> elements = elements_impl(other.root);
+      Pointee_iterator<T &&> first{elements.data()};
+      Pointee_iterator<T &&> last{elements.data() + elements.size()};
+      reserve_nodes(elements.size());
+      taken = build_impl(first, last, elements.size(), nullptr, less(), pool);
+      note_allocations(elements.size());
+      other.clear();
+    }
+    else if (get_allocator() == other.get_allocator() &&
+             pool.free_slot_count() < other.size()) {
+      pool.splice(other.pool);
+    }
+    else {
+      pool.reserve(other.size());
+      taken = copy_nodes_impl(other.root, nullptr, pool);
+      note_allocations(other.size());
+      discard_nodes_impl(other.root, other.pool);
+      other.pool.release();
+    }
+    other.root = nullptr;
+    return taken;
+  }
 
 
 
@@ -336,52 +1796,289 @@ private:
   // EFFECTS: Returns the size of the tree rooted at 'node', which is the
   //          total number of nodes in that tree. The size of an empty
   //          tree is 0.
-  // NOTE:    This function must be tree recursive.
-  static int size_impl(const Node *node) {
+  // NOTE:    Every node caches its size, so this runs in constant time.
+  static size_t size_impl(const Node *node) {
     if (empty_impl(node)) { return 0; }
-    int size = 1;
-    if (node->left) { size += size_impl(node->left); } 
-    if (node->right) { size += size_impl(node->right); } 
-    return size;
+    return node->size;
   }
 
   // EFFECTS: Returns the height of the tree rooted at 'node', which is the
   //          number of nodes in the longest path from the 'node' to a leaf.
   //          The height of an empty tree is 0.
-  // NOTE:    This function must be tree recursive.
+  // NOTE:    Every node caches its height, so this runs in constant time.
   static int height_impl(const Node *node) {
     if (empty_impl(node)) { return 0; }
-    int height_left = 0;
-    int height_right = 0;
-    if (node->left) { height_left += height_impl(node->left); } 
-    if (node->right) { height_right += height_impl(node->right); } 
-    return (height_left > height_right ? height_left : height_right) + 1;  
+    return node->height;
   }
 
   // EFFECTS: Creates and returns a pointer to the root of a new node structure
   //          with the same elements and EXACTLY the same structure as the
-  //          tree rooted at 'node'.
-  // NOTE:    This function must be tree recursive.
-  static Node *copy_nodes_impl(Node *node) {
+  //          tree rooted at 'node', whose root has 'parent' as its parent.
+  //          The new nodes are allocated from 'pool' in pre-order.
+  // NOTE:    This function uses constant stack and compares no elements.
+  //          Each copy starts out with its right link pointing at the
+  //          source node's right child, which is still to be copied. The
+  //          copy goes down left links, and from each subtree it has
+  //          finished climbs the parent links of the new nodes, which are
+  //          contiguous and recently written, to the nearest such pending
+  //          right subtree. The source tree is only read downwards.
+  static Node *copy_nodes_impl(const Node *node, Node *parent,
+                               Node_pool &pool) {
     if (empty_impl(node)) { return nullptr; }
-    Node * ptr = 
-      new Node(node->datum, copy_nodes_impl(node->left), copy_nodes_impl(node->right));
-    return ptr;
+    Node *top = copy_node_impl(node, parent, pool);
+    Node *copy = top;
+    for (;;) {
+      for (; node->left; node = node->left) {
+        copy = copy->left = copy_node_impl(node->left, copy, pool);
+      }
+      while (!copy->right) {
+        Node *child;
+        do {
+          if (copy == top) { return top; }
+          child = copy;
+          copy = copy->parent;
+        } while (copy->right == child);
+      }
+      node = copy->right;
+      copy = copy->right = copy_node_impl(node, copy, pool);
+    }
+  }
+
+  // EFFECTS: Creates a copy of 'node', including its cached height and
+  //          size, from 'pool' under 'parent', with no left child and the
+  //          right child of 'node' (a source node) as its right link. See
+  //          copy_nodes_impl.
+  static Node *copy_node_impl(const Node *node, Node *parent,
+                              Node_pool &pool) {
+    Node *copy = pool.create(node->datum, nullptr,
+                             const_cast<Node *>(node->right), parent);
+    copy->height = node->height;
+    copy->size = node->size;
+    return copy;
+  }
+
+  // REQUIRES: [first, last) is sorted according to 'less'
+  // EFFECTS:  Returns the number of runs of equivalent elements in the
+  //           range [first, last).
+  template <typename Iter>
+  static size_t count_distinct_impl(Iter first, Iter last, Less_ref less) {
+    if (first == last) { return 0; }
+    size_t count = 1;
+    for (Iter prev = first++; first != last; prev = first++) {
+      assert(!less(*first, *prev));
+      if (less(*prev, *first)) { ++count; }
+    }
+    return count;
+  }
+
+  // REQUIRES: [first, last) is sorted according to 'less' and holds at
+  //           least n runs of equivalent elements
+  // MODIFIES: first, 'pool'
+  // EFFECTS:  Builds a perfectly balanced tree from the first element of
+  //           each of the next n runs, advancing first past them, and
+  //           returns its root, whose parent is set to 'parent'. Nodes
+  //           are created in order.
+  // NOTE:     This function must be tree recursive.
+  template <typename Iter>
+  static Node *build_impl(Iter &first, Iter last, size_t n, Node *parent,
+                          Less_ref less, Node_pool &pool) {
+    if (n == 0) { return nullptr; }
+    size_t size_left = n / 2;
+    Node *left = build_impl(first, last, size_left, nullptr, less, pool);
+    Node *node = pool.create(std::in_place, *first);
+    for (++first; first != last && !less(node->datum, *first); ++first) { }
+    node->left = left;
+    if (left) { left->parent = node; }
+    node->parent = parent;
+    node->right = build_impl(first, last, n - size_left - 1, node, less, pool);
+    update_impl(node);
+    return node;
+  }
+
+  // EFFECTS: Destroys all nodes used in the tree rooted at 'node' and
+  //          puts their slots on the free list of 'pool' for reuse.
+  // NOTE:    This function uses constant stack: it goes down to a leaf,
+  //          destroys it after unlinking it from its parent, and carries
+  //          on from the parent, which eventually becomes a leaf too.
+  static void destroy_nodes_impl(Node *node, Node_pool &pool) {
+    if (empty_impl(node)) {
+      return;
+    }
+    Node *stop = node->parent;
+    while (node != stop) {
+      if (node->left) {
+        node = node->left;
+      }
+      else if (node->right) {
+        node = node->right;
+      }
+      else {
+        Node *parent = node->parent;
+        if (parent != stop) {
+          (parent->left == node ? parent->left : parent->right) = nullptr;
+        }
+        pool.destroy(node);
+        node = parent;
+      }
+    }
+  }
+
+  // REQUIRES: 'pool' is released (or destroyed) before it creates another
+  //           node
+  // EFFECTS:  Destroys all nodes used in the tree rooted at 'node',
+  //           leaving their memory to be given back with the slabs of
+  //           'pool'. Nodes holding trivially destructible elements need
+  //           no destruction, so then it returns immediately.
+  static void discard_nodes_impl(Node *node, Node_pool &pool) {
+    if constexpr (!std::is_trivially_destructible<Node>::value) {
+      destroy_nodes_impl(node, pool);
+    }
+  }
+
+  // EFFECTS: Returns pointers to the elements of the tree rooted at
+  //          'node' (whose parent is null) in order.
+  static std::vector<T *> elements_impl(Node *node) {
+    std::vector<T *> elements;
+    elements.reserve(size_impl(node));
+    for (node = min_element_impl(node); node;
+         node = node->right ? min_element_impl(node->right)
+                            : next_ancestor_impl(node)) {
+      elements.push_back(&node->datum);
+    }
+    return elements;
   }
 
-  // EFFECTS: Frees the memory for all nodes used in the tree rooted at 'node'.
-  // NOTE:    This function must be tree recursive.
-  static void destroy_nodes_impl(Node *node) {
+  // MODIFIES: what f modifies
+  // EFFECTS:  Calls f(elt) for each element of the tree rooted at 'node',
+  //           in order.
+  // NOTE:     This function follows the child and parent links, using
+  //           constant stack, like traverse_inorder_impl.
+  template <typename F>
+  static void for_each_impl(Node *node, F &f) {
     if (empty_impl(node)) { return; }
-    destroy_nodes_impl(node->left);
-    destroy_nodes_impl(node->right);
-    delete node;
+    Node *stop = node->parent;
+    for (; node->left; node = node->left) { }
+    while (node != stop) {
+      f(node->datum);
+      if (node->right) {
+        for (node = node->right; node->left; node = node->left) { }
+      }
+      else {
+        for (; node->parent != stop && node->parent->right == node;
+             node = node->parent) { }
+        node = node->parent;
+      }
+    }
+  }
+
+  // EFFECTS: Returns the number of threads to use for a request of
+  //          'threads', where 0 means one per core.
+  static size_t threads_impl(size_t threads) {
+    if (threads == 0) {
+      threads = std::thread::hardware_concurrency();
+    }
+    return threads == 0 ? 1 : threads;
+  }
+
+  // MODIFIES: tops
+  // EFFECTS:  Cuts the tree rooted at 'node' into disjoint subtrees of
+  //           about size / (c_pieces_per_thread * threads) elements at
+  //           most, which it returns (some may be empty), by taking off
+  //           the roots of larger ones, which it appends to 'tops'.
+  //           Stops early after a few cuts per piece wanted, which keeps
+  //           a chain from being cut into single nodes.
+  static std::vector<Node *> cut_impl(Node *node, size_t threads,
+                                      std::vector<Node *> &tops) {
+    std::vector<Node *> pieces;
+    if (empty_impl(node)) { return pieces; }
+    size_t wanted = c_pieces_per_thread * threads;
+    size_t largest = size_impl(node) / wanted + 1;
+    pieces.push_back(node);
+    for (size_t i = 0; i < pieces.size() && tops.size() < 4 * wanted; ) {
+      Node *piece = pieces[i];
+      if (size_impl(piece) <= largest) {
+        ++i;
+        continue;
+      }
+      tops.push_back(piece);
+      pieces[i] = piece->left;
+      pieces.push_back(piece->right);
+    }
+    return pieces;
+  }
+
+  // EFFECTS: Calls work(i) once for each i in [0, count), on up to
+  //          'threads' threads including the calling one, which take the
+  //          next i off a shared counter. Rethrows the first exception
+  //          that work throws once all the threads are done; the counter
+  //          is then run out so that they finish early. If a thread cannot
+  //          be started, the others do its share.
+  template <typename Work>
+  static void run_pieces_impl(size_t count, size_t threads, Work work) {
+    std::atomic<size_t> next(0);
+    size_t helpers = (threads < count ? threads : count);
+    helpers = helpers > 0 ? helpers - 1 : 0;
+    std::vector<std::exception_ptr> errors(helpers + 1);
+    auto worker = [&](size_t id) {
+      try {
+        for (size_t i = next++; i < count; i = next++) {
+          work(i);
+        }
+      }
+      catch (...) {
+        errors[id] = std::current_exception();
+        next = count;
+      }
+    };
+    std::vector<std::thread> workers;
+    workers.reserve(helpers);
+    for (size_t id = 1; id <= helpers; ++id) {
+      try {
+        workers.emplace_back(worker, id);
+      }
+      catch (const std::system_error &) {
+        break;
+      }
+    }
+    worker(0);
+    for (std::thread &thread : workers) {
+      thread.join();
+    }
+    for (const std::exception_ptr &error : errors) {
+      if (error) {
+        std::rethrow_exception(error);
+      }
+    }
+  }
+
+  // MODIFIES: what 'visit' modifies
+  // EFFECTS:  Calls visit(n) for every node n of the tree rooted at
+  //           'node', in pre-order.
+  // NOTE:     This function follows the child and parent links, using
+  //           constant stack, like traverse_preorder_impl. 'visit' must
+  //           leave the links alone.
+  template <typename Visit>
+  static void visit_nodes_impl(Node *node, Visit visit) {
+    Node *stop = empty_impl(node) ? nullptr : node->parent;
+    while (node != stop) {
+      visit(node);
+      if (node->left || node->right) {
+        node = node->left ? node->left : node->right;
+        continue;
+      }
+      Node *child = node;
+      for (node = node->parent;
+           node != stop && (node->right == child || !node->right);
+           child = node, node = node->parent) { }
+      if (node != stop) { node = node->right; }
+    }
   }
 
   // EFFECTS : Searches the tree rooted at 'node' for an element equivalent
   //           to 'query'. If one is found, returns a pointer to the node
   //           containing it. If the tree is empty or the element is not
-  //           found, returns a null pointer.
+  //           found, returns a null pointer. Only the path from 'node'
+  //           down to the element is visited.
   //
   // NOTE: This function must be tail recursive.
   // HINT: Equivalence is defined according to the Compare functor
@@ -390,125 +2087,632 @@ private:
   //       parameter to compare elements.
   //       Two elements A and B are equivalent if and only if A is
   //       not less than B and B is not less than A.
-  static Node * find_impl(Node *node, const T &query, Compare less) {
-    Node * ptr = nullptr;
+  template <typename K>
+  static Node * find_impl(Node *node, const K &query, Less_ref less) {
+    if (empty_impl(node)) { return nullptr; }
+    if (less(query, node->datum)) { return find_impl(node->left, query, less); }
+    if (less(node->datum, query)) { return find_impl(node->right, query, less); }
+    return node;
+  }
+
+  // EFFECTS : Searches the tree rooted at 'node' for an element equivalent
+  //           to 'key', like find_impl, and returns its node if there is
+  //           one. Otherwise returns a null pointer and reports where such
+  //           an element would be inserted as a leaf: under 'parent' (left
+  //           if 'go_left'), which is left untouched if the tree is empty.
+  // NOTE: This function must be tail recursive.
+  template <typename K>
+  static Node * descend_impl(Node *node, const K &key, Less_ref less,
+                             Node *&parent, bool &go_left) {
     if (empty_impl(node)) { return nullptr; }
-    if (!(less(node->datum, query) || less(query, node->datum))) { return node; }
-    ptr = find_impl(node->left, query, less);
-    if (!ptr) { ptr = find_impl(node->right, query, less); }
-    return ptr;
+    if (less(key, node->datum)) {
+      parent = node;
+      go_left = true;
+      return descend_impl(node->left, key, less, parent, go_left);
+    }
+    if (less(node->datum, key)) {
+      parent = node;
+      go_left = false;
+      return descend_impl(node->right, key, less, parent, go_left);
+    }
+    return node;
+  }
+
+  // EFFECTS : Returns the deepest node of the tree rooted at 'node' on the
+  //           search paths of both 'low' and 'high': the first whose
+  //           element is not outside [low, high], or the null link where
+  //           both paths end. Sets 'lower' and 'upper' to the elements
+  //           that bound its subtree, the last ones passed on the way
+  //           down that are less than 'low' and greater than 'high', if
+  //           any. The search for any query between them goes through it.
+  // NOTE: This function must be tail recursive.
+  template <typename Query>
+  static Node * common_path_impl(Node *node, const Query &low,
+                                 const Query &high, Less_ref less,
+                                 const T *&lower, const T *&upper) {
+    if (empty_impl(node)) { return node; }
+    if (less(high, node->datum)) {
+      upper = &node->datum;
+      return common_path_impl(node->left, low, high, less, lower, upper);
+    }
+    if (less(node->datum, low)) {
+      lower = &node->datum;
+      return common_path_impl(node->right, low, high, less, lower, upper);
+    }
+    return node;
+  }
+
+  // EFFECTS : Returns whether query is greater than 'lower' and less than
+  //           'upper', either of which may be null for no bound.
+  template <typename Query>
+  static bool between_impl(const Query &query, const T *lower,
+                           const T *upper, Less_ref less) {
+    return (!lower || less(*lower, query)) && (!upper || less(query, *upper));
+  }
+
+  // EFFECTS : Hints to the processor that 'node' will be read soon.
+  static void prefetch_impl(const Node *node) {
+#if defined(__GNUC__)
+    __builtin_prefetch(node);
+#else
+    (void)node;
+#endif
+  }
+
+  // MODIFIES: 'node'
+  // EFFECTS : Recomputes the cached height and size of 'node' from its
+  //           children.
+  static void update_impl(Node *node) {
+    int height_left = height_impl(node->left);
+    int height_right = height_impl(node->right);
+    node->height = (height_left > height_right ? height_left : height_right) + 1;
+    node->size = size_impl(node->left) + size_impl(node->right) + 1;
   }
 
-  // REQUIRES: item is not already contained in the tree rooted at 'node'
   // MODIFIES: the tree rooted at 'node'
-  // EFFECTS : If 'node' represents an empty tree, allocates a new
-  //           Node to represent a single-element tree with 'item' as
-  //           its only element and returns a pointer to the new Node.
-  //           If the tree rooted at 'node' is not empty, inserts
-  //           'item' into the proper location as a leaf in the
-  //           existing tree structure according to the sorting
-  //           invariant and returns the original parameter 'node'.
-  // NOTE: This function must be linear recursive, but does not
-  //       need to be tail recursive.
-  // HINT: Element ordering is defined according to the Compare functor
-  //       associated with this instantiation of the BinarySearchTree
-  //       template, NOT according to the < operator. Use the "less"
-  //       parameter to compare elements.
-  static Node * insert_impl(Node *node, const T &item, Compare less) {
-    if (empty_impl(node)) { return new Node(item, nullptr, nullptr); }
-    if (less(item, node->datum)) { 
-      if (!node->left) { 
-        node->left = insert_impl(node->left, item, less);
-        return node;
+  // EFFECTS : Rotates the tree rooted at 'node' right until no node has a
+  //           left child, and returns the first node of the resulting
+  //           chain of right children. Every rotation puts one more node
+  //           on the chain for good, so it takes O(n) time. Parent links,
+  //           heights and sizes are left stale (see relink_impl).
+  static Node * tree_to_vine_impl(Node *node) {
+    Node *head = node;
+    Node *tail = nullptr; // the last node known to be on the chain
+    while (node) {
+      if (!node->left) {
+        tail = node;
+        node = node->right;
+        continue;
+      }
+      Node *pivot = node->left;
+      node->left = pivot->right;
+      pivot->right = node;
+      node = pivot;
+      if (tail) {
+        tail->right = pivot;
       }
       else {
-        insert_impl(node->left, item, less);
-        return node;
+        head = pivot;
+      }
+    }
+    return head;
+  }
+
+  // REQUIRES: the first 2 * count nodes down the right links from 'head'
+  //           exist
+  // MODIFIES: head, the nodes on its right links
+  // EFFECTS : Rotates every other one of the first 2 * count nodes down
+  //           the right links from 'head' left, under the node after it,
+  //           which halves that stretch of the chain; 'head' is updated
+  //           to the new first node. Parent links, heights and sizes are
+  //           left stale.
+  static void compress_impl(Node *&head, size_t count) {
+    Node *scanner = nullptr;
+    for (size_t i = 0; i < count; ++i) {
+      Node *child = scanner ? static_cast<Node *>(scanner->right) : head;
+      Node *next = child->right;
+      if (scanner) {
+        scanner->right = next;
+      }
+      else {
+        head = next;
+      }
+      scanner = next;
+      child->right = scanner->left;
+      scanner->left = child;
+    }
+  }
+
+  // MODIFIES: the tree rooted at 'node'
+  // EFFECTS : Makes 'node' a root with no parent, sets every parent link
+  //           below it from the child links, and recomputes every cached
+  //           height and size, in post-order.
+  // NOTE:     This function uses constant stack: it sets the parent link
+  //           of each node on the way down to it, before it climbs back
+  //           up that link.
+  static void relink_impl(Node *node) {
+    node->parent = nullptr;
+    Node *prev = nullptr;
+    while (node) {
+      Node *next = nullptr;
+      if (prev == node->parent) {
+        next = node->left ? node->left : node->right;
+      }
+      else if (prev == node->left) {
+        next = node->right;
+      }
+      prev = node;
+      if (next) {
+        next->parent = node;
+        node = next;
       }
+      else {
+        update_impl(node);
+        node = node->parent;
+      }
+    }
+  }
+
+  // REQUIRES: 'node' is the k-th node in order (counting from 0) of a
+  //           tree whose nodes are being copied in order into consecutive
+  //           slots starting at 'first'
+  // MODIFIES: 'copy'
+  // EFFECTS : Links 'copy', the copy of 'node', where its parent and
+  //           children are going to be, computed from the sizes of the
+  //           subtrees around 'node', and copies its height and size.
+  static void place_links_impl(const Node *node, Node *copy, Node *first,
+                               size_t k) {
+    const Node *left = node->left;
+    const Node *right = node->right;
+    const Node *parent = node->parent;
+    copy->left = left ? first + (k - size_impl(left) + size_impl(left->left))
+                      : nullptr;
+    copy->right = right ? first + (k + 1 + size_impl(right->left)) : nullptr;
+    if (!parent) {
+      copy->parent = nullptr;
+    }
+    else if (parent->left == node) {
+      copy->parent = first + (k + size_impl(right) + 1);
     }
     else {
-      if (!node->right) {
-        node->right = insert_impl(node->right, item, less);
-        return node;
+      copy->parent = first + (k - size_impl(left) - 1);
+    }
+    copy->height = node->height;
+    copy->size = node->size;
+  }
+
+  // REQUIRES: 'node' has a right child
+  // MODIFIES: the tree rooted at 'node'
+  // EFFECTS : Rotates the right child of 'node' up into its place and
+  //           returns it as the new root of the subtree.
+  static Node * rotate_left_impl(Node *node) {
+    Node *pivot = node->right;
+    node->right = pivot->left;
+    if (node->right) { node->right->parent = node; }
+    pivot->left = node;
+    pivot->parent = node->parent;
+    node->parent = pivot;
+    update_impl(node);
+    update_impl(pivot);
+    return pivot;
+  }
+
+  // REQUIRES: 'node' has a left child
+  // MODIFIES: the tree rooted at 'node'
+  // EFFECTS : Rotates the left child of 'node' up into its place and
+  //           returns it as the new root of the subtree.
+  static Node * rotate_right_impl(Node *node) {
+    Node *pivot = node->left;
+    node->left = pivot->right;
+    if (node->left) { node->left->parent = node; }
+    pivot->right = node;
+    pivot->parent = node->parent;
+    node->parent = pivot;
+    update_impl(node);
+    update_impl(pivot);
+    return pivot;
+  }
+
+  // REQUIRES: the subtrees of 'node' are balanced according to the
+  //           Balance policy and their heights differ by at most two
+  // MODIFIES: the tree rooted at 'node'
+  // EFFECTS : Refreshes the cached height and size of 'node'. Under AVLBalanced,
+  //           also restores the AVL property at 'node' with a single or
+  //           double rotation. Returns the root of the resulting subtree.
+  static Node * rebalance_impl(Node *node) {
+    update_impl(node);
+    if constexpr (Balance::rebalances) {
+      int skew = height_impl(node->left) - height_impl(node->right);
+      if (skew > 1) {
+        if (height_impl(node->left->left) < height_impl(node->left->right)) {
+          node->left = rotate_left_impl(node->left);
+        }
+        return rotate_right_impl(node);
+      }
+      if (skew < -1) {
+        if (height_impl(node->right->right) < height_impl(node->right->left)) {
+          node->right = rotate_right_impl(node->right);
+        }
+        return rotate_left_impl(node);
+      }
+    }
+    return node;
+  }
+
+  // REQUIRES: 'node' is not null
+  // MODIFIES: the tree containing 'node'
+  // EFFECTS : Rebalances 'node' and then each of its ancestors in turn
+  //           (see rebalance_impl), relinking every subtree that a
+  //           rotation gave a new root, and returns the root of the tree.
+  static Node * rebalance_up_impl(Node *node) {
+    for (;;) {
+      Node *parent = node->parent;
+      bool was_left = parent && parent->left == node;
+      Node *subtree = rebalance_impl(node);
+      if (!parent) {
+        return subtree;
+      }
+      if (was_left) {
+        parent->left = subtree;
+      }
+      else {
+        parent->right = subtree;
+      }
+      node = parent;
+    }
+  }
+
+  // REQUIRES: 'node' has just gained a leaf, and its cached counts and
+  //           those of its ancestors are as they were before
+  // MODIFIES: the tree containing 'node'
+  // EFFECTS : Rebalances 'node' and its ancestors, like
+  //           rebalance_up_impl, until one of them comes out as tall as it
+  //           was (which under AVLBalanced happens after at most one
+  //           rotation, and after O(1) steps amortized over a series of
+  //           insertions). The heights above it are then unchanged, so the
+  //           rest of the path only has its sizes incremented. Returns the
+  //           root of the tree.
+  static Node * grow_path_impl(Node *node) {
+    for (;;) {
+      int old_height = node->height;
+      Node *parent = node->parent;
+      bool was_left = parent && parent->left == node;
+      Node *subtree = rebalance_impl(node);
+      if (!parent) {
+        return subtree;
+      }
+      if (was_left) {
+        parent->left = subtree;
       }
       else {
-        insert_impl(node->right, item, less);
+        parent->right = subtree;
+      }
+      node = parent;
+      if (subtree->height == old_height) {
+        break;
+      }
+    }
+    for (;; node = node->parent) {
+      ++node->size;
+      if (!node->parent) {
         return node;
       }
     }
   }
 
+  // REQUIRES: 'left' and 'right' are valid trees under the Balance policy
+  //           (possibly empty), and every element of 'left' is less than
+  //           the datum of the unlinked node 'pivot', which is less than
+  //           every element of 'right'
+  // MODIFIES: the three trees
+  // EFFECTS : Joins them into one valid tree and returns its root, whose
+  //           parent is null. Under AVLBalanced, 'pivot' goes down the
+  //           spine of the taller tree to the first subtree no more than
+  //           one level taller than the other tree, takes both as its
+  //           children, and the path above it is rebalanced: O(1 + the
+  //           difference in heights). Otherwise 'pivot' just becomes the
+  //           root.
+  static Node * join_impl(Node *left, Node *pivot, Node *right) {
+    if (left) { left->parent = nullptr; }
+    if (right) { right->parent = nullptr; }
+    if constexpr (Balance::rebalances) {
+      if (height_impl(left) > height_impl(right) + 1) {
+        Node *node = left;
+        while (height_impl(node->right) > height_impl(right) + 1) {
+          node = node->right;
+        }
+        link_children_impl(pivot, node->right, right);
+        node->right = pivot;
+        pivot->parent = node;
+        return rebalance_up_impl(pivot);
+      }
+      if (height_impl(right) > height_impl(left) + 1) {
+        Node *node = right;
+        while (height_impl(node->left) > height_impl(left) + 1) {
+          node = node->left;
+        }
+        link_children_impl(pivot, left, node->left);
+        node->left = pivot;
+        pivot->parent = node;
+        return rebalance_up_impl(pivot);
+      }
+    }
+    link_children_impl(pivot, left, right);
+    pivot->parent = nullptr;
+    return pivot;
+  }
+
+  // MODIFIES: 'node', 'left', 'right'
+  // EFFECTS : Makes 'left' and 'right' the children of 'node' and
+  //           refreshes its cached height and size.
+  static void link_children_impl(Node *node, Node *left, Node *right) {
+    node->left = left;
+    node->right = right;
+    if (left) { left->parent = node; }
+    if (right) { right->parent = node; }
+    update_impl(node);
+  }
+
+  // REQUIRES: 'top' is the root of a non-empty tree
+  // MODIFIES: the tree rooted at 'top', 'top'
+  // EFFECTS : Unlinks the node holding the maximum element, rebalancing
+  //           the path above it, and returns it. 'top' becomes the root of
+  //           the remaining tree.
+  static Node * unlink_max_impl(Node *&top) {
+    Node *node = max_element_impl(top);
+    Node *parent = node->parent;
+    if (node->left) { node->left->parent = parent; }
+    if (!parent) {
+      top = node->left;
+    }
+    else {
+      parent->right = node->left;
+      top = rebalance_up_impl(parent);
+    }
+    node->left = node->parent = nullptr;
+    return node;
+  }
+
+  // MODIFIES: the tree rooted at 'node'
+  // EFFECTS : Splits the tree rooted at 'node' into the elements less than
+  //           'key', whose root is returned in 'low', and the rest, in
+  //           'high'. Both are valid under the Balance policy and have no
+  //           parent. No node is created, destroyed or copied.
+  // NOTE:     This function uses constant stack: it goes down to the
+  //           bottom of the lower_bound path for 'key' and climbs back up
+  //           it, joining each node on it with its other subtree onto the
+  //           part that node belongs to (see join_impl). Under AVLBalanced
+  //           the joins' costs add up to O(log n).
+  template <typename K>
+  static void split_impl(Node *node, const K &key, Less_ref less,
+                         Node *&low, Node *&high) {
+    low = high = nullptr;
+    if (empty_impl(node)) { return; }
+    node = search_path_end_impl(node, key, less);
+    bool is_low = less(node->datum, key);
+    while (node) {
+      Node *parent = node->parent;
+      bool parent_is_low = parent && parent->right == node;
+      if (is_low) {
+        low = join_impl(node->left, node, low);
+      }
+      else {
+        high = join_impl(high, node, node->right);
+      }
+      node = parent;
+      is_low = parent_is_low;
+    }
+  }
+
+  // EFFECTS : Returns the last node on the path that lower_bound takes
+  //           down from 'node', which is not null: the path goes right
+  //           past elements less than 'key' and left past the others, so
+  //           every node off it lies wholly on one side of 'key'.
+  // NOTE: This function must be tail recursive.
+  template <typename K>
+  static Node * search_path_end_impl(Node *node, const K &key,
+                                     Less_ref less) {
+    Node *next = less(node->datum, key) ? node->right : node->left;
+    return next ? search_path_end_impl(next, key, less) : node;
+  }
+
   // EFFECTS : Returns a pointer to the Node containing the minimum element
   //           in the tree rooted at 'node' or a null pointer if the tree is empty.
-  // NOTE: This function must be tail recursive.
   // NOTE: This function is used in the implementation of the ++ operator for
-  //       the iterator code that is provided for you.
+  //       the iterator code that is provided for you. It is a loop rather
+  //       than a tail call, so that begin() uses constant stack on a chain
+  //       even where the compiler does not eliminate tail calls.
   // HINT: You don't need to compare any elements! Think about the
   //       structure, and where the smallest element lives.
   static Node * min_element_impl(Node *node) {
     if (empty_impl(node)) {return nullptr;}
-    return !node->left ? node : min_element_impl(node->left);
+    while (node->left) {
+      node = node->left;
+    }
+    return node;
+  }
+
+  // EFFECTS : Returns a pointer to the Node containing the k-th smallest
+  //           element (counting from 0) in the tree rooted at 'node', or
+  //           a null pointer if the tree has k or fewer elements.
+  // NOTE: This function must be tail recursive.
+  static Node * select_impl(Node *node, size_t k) {
+    if (empty_impl(node)) { return nullptr; }
+    size_t size_left = size_impl(node->left);
+    if (k < size_left) { return select_impl(node->left, k); }
+    if (k == size_left) { return node; }
+    return select_impl(node->right, k - size_left - 1);
+  }
+
+  // EFFECTS : Returns 'smaller' plus the number of elements in the tree
+  //           rooted at 'node' that are less than 'query'.
+  // NOTE: This function must be tail recursive.
+  template <typename K>
+  static size_t rank_impl(const Node *node, const K &query, Less_ref less,
+                          size_t smaller) {
+    if (empty_impl(node)) { return smaller; }
+    if (less(node->datum, query)) {
+      return rank_impl(node->right, query, less,
+                       smaller + size_impl(node->left) + 1);
+    }
+    return rank_impl(node->left, query, less, smaller);
+  }
+
+  // EFFECTS : Returns the closest ancestor of 'node' that has 'node' in its
+  //           left subtree, which holds the next element after the
+  //           maximum of the subtree rooted at 'node'. Returns a null
+  //           pointer if there is no such ancestor.
+  // NOTE: This function is used in the implementation of the ++ operator for
+  //       the iterator code. It never compares elements, and a full
+  //       in-order walk climbs each parent link at most once.
+  static Node * next_ancestor_impl(Node *node) {
+    while (node->parent && node->parent->right == node) {
+      node = node->parent;
+    }
+    return node->parent;
+  }
+
+  // EFFECTS : Returns the closest ancestor of 'node' that has 'node' in its
+  //           right subtree, which holds the element before the minimum
+  //           of the subtree rooted at 'node'. Returns a null pointer if
+  //           there is no such ancestor. The mirror of next_ancestor_impl.
+  static Node * prev_ancestor_impl(Node *node) {
+    while (node->parent && node->parent->left == node) {
+      node = node->parent;
+    }
+    return node->parent;
+  }
+
+  // EFFECTS : Looks for the empty child link next to 'hint' (a node of the
+  //           tree rooted at 'root', or null for the end) where an element
+  //           equivalent to 'key' belongs: the gap just before the element
+  //           at 'hint', or else the gap just after it. Checking a gap
+  //           compares 'key' with the elements on either side, so this
+  //           makes at most three comparisons. If 'key' falls in neither
+  //           gap, or is equivalent to one of those elements, returns
+  //           false. Otherwise returns true and reports the link as
+  //           descend_impl does: under 'parent' (left if 'go_left').
+  // NOTE:     A gap before a node is its own left link if that is empty,
+  //           and otherwise the right link of the maximum of its left
+  //           subtree, which is the element before it; and symmetrically.
+  template <typename K>
+  static bool hint_position_impl(Node *root, Node *hint, const K &key,
+                                 Less_ref less, Node *&parent,
+                                 bool &go_left) {
+    if (hint && !less(key, hint->datum)) {
+      if (!less(hint->datum, key)) { return false; }
+      Node *after = hint->right ? min_element_impl(hint->right)
+                                : next_ancestor_impl(hint);
+      if (after && !less(key, after->datum)) { return false; }
+      parent = hint->right ? after : hint;
+      go_left = hint->right != nullptr;
+      return true;
+    }
+    Node *before = !hint ? max_element_impl(root)
+                   : hint->left ? max_element_impl(hint->left)
+                   : prev_ancestor_impl(hint);
+    if (before && !less(before->datum, key)) { return false; }
+    parent = hint && !hint->left ? hint : before;
+    go_left = hint && !hint->left;
+    return true;
   }
 
   // EFFECTS : Returns a pointer to the Node containing the maximum element
   //           in the tree rooted at 'node' or a null pointer if the tree is empty.
-  // NOTE: This function must be tail recursive.
+  // NOTE: A loop, like min_element_impl.
   // HINT: You don't need to compare any elements! Think about the
   //       structure, and where the largest element lives.
   static Node * max_element_impl(Node *node) {
     if (empty_impl(node)) {return nullptr;}
-    return !node->right ? node : max_element_impl(node->right);
+    while (node->right) {
+      node = node->right;
+    }
+    return node;
   }
 
   // EFFECTS: Returns whether the sorting invariant holds on the tree
   //          rooted at 'node'.
-  // NOTE:    This function must be tree recursive.
-  static bool check_sorting_invariant_impl(const Node *node, Compare less) { 
+  // NOTE:    This function walks the tree in order, like
+  //          traverse_inorder_impl, comparing each element with the one
+  //          before it: the invariant holds exactly when they come out
+  //          strictly increasing. That is the same as checking every
+  //          element against the bounds its ancestors set, since the
+  //          element before it in order is the tightest such bound, but
+  //          needs one comparison per node and no stack.
+  static bool check_sorting_invariant_impl(const Node *node, Less_ref less) {
     if (empty_impl(node)) { return true; }
-    if (find_impl(node->left, node->datum, less) || 
-        find_impl(node->right, node->datum, less)) {
-      return false;
-    }
-    bool not_failed = true;
-    if (node->left) {
-      if (less(max_element_impl(node->left)->datum, node->datum)) { 
-        not_failed = check_sorting_invariant_impl(node->left, less);
+    const Node *stop = node->parent;
+    const Node *previous = nullptr;
+    for (; node->left; node = node->left) { }
+    while (node != stop) {
+      if (previous && !less(previous->datum, node->datum)) {
+        return false;
       }
-      else {
-        return false; 
-      } 
-    }
-    if (!not_failed) {
-      return false;
-    }
-    if (node->right) {
-      if (less(node->datum, min_element_impl(node->right)->datum)) { 
-       not_failed = check_sorting_invariant_impl(node->right, less);
-       return not_failed;
+      previous = node;
+      if (node->right) {
+        for (node = node->right; node->left; node = node->left) { }
       }
       else {
-        return false;
+        for (; node->parent != stop && node->parent->right == node;
+             node = node->parent) { }
+        node = node->parent;
       }
     }
     return true;
   }
 
+  // REQUIRES: 'histogram' has more entries than the height of the tree
+  //           rooted at 'node'
+  // MODIFIES: 'histogram'
+  // EFFECTS : Adds one to histogram[d] for every node of that tree at
+  //           depth d, counting 'node' as depth 1.
+  // NOTE:     This function follows the child and parent links like
+  //           traverse_preorder_impl, tracking the depth as it goes.
+  static void depth_histogram_impl(const Node *node,
+                                   std::vector<size_t> &histogram) {
+    const Node *stop = empty_impl(node) ? nullptr : node->parent;
+    size_t depth = 1;
+    while (node != stop) {
+      ++histogram[depth];
+      if (node->left || node->right) {
+        node = node->left ? node->left : node->right;
+        ++depth;
+        continue;
+      }
+      // Climb to the nearest ancestor with a right subtree not yet visited.
+      const Node *child = node;
+      for (node = node->parent, --depth;
+           node != stop && (node->right == child || !node->right);
+           child = node, node = node->parent, --depth) { }
+      if (node != stop) {
+        node = node->right;
+        ++depth;
+      }
+    }
+  }
+
   // EFFECTS : Traverses the tree rooted at 'node' using an in-order traversal,
   //           printing each element to os in turn. Each element is followed
   //           by a space (there will be an "extra" space at the end).
   //           If the tree is empty, nothing is printed.
-  // NOTE: This function must be tree recursive.
+  // NOTE: This function follows the child and parent links, using
+  //       constant stack.
   //       See https://en.wikipedia.org/wiki/Tree_traversal#In-order
   //       for the definition of a in-order traversal.
   static void traverse_inorder_impl(const Node *node, std::ostream &os) {
     if (empty_impl(node)) { return; }
-    if (!node->left && !node->right) { os << node->datum << " "; return; }
-    if (node->left) { 
-      traverse_inorder_impl(node->left, os);
-    }
-    os << node->datum << " ";
-    if (node->right) {
-      traverse_inorder_impl(node->right, os);
+    const Node *stop = node->parent;
+    for (; node->left; node = node->left) { }
+    while (node != stop) {
+      os << node->datum << " ";
+      if (node->right) {
+        for (node = node->right; node->left; node = node->left) { }
+      }
+      else {
+        for (; node->parent != stop && node->parent->right == node;
+             node = node->parent) { }
+        node = node->parent;
+      }
     }
   }
 
@@ -516,49 +2720,55 @@ private:
   //           printing each element to os in turn. Each element is followed
   //           by a space (there will be an "extra" space at the end).
   //           If the tree is empty, nothing is printed.
-  // NOTE: This function must be tree recursive.
+  // NOTE: This function follows the child and parent links, using
+  //       constant stack.
   //       See https://en.wikipedia.org/wiki/Tree_traversal#Pre-order
   //       for the definition of a pre-order traversal.
   static void traverse_preorder_impl(const Node *node, std::ostream &os) {
-    if (empty_impl(node)) { return; }
-    if (!node->left && !node->right) { os << node->datum << " "; return; }
-    os << node->datum << " ";
-    if (node->left) { 
-      traverse_preorder_impl(node->left, os);
-    }
-    if (node->right) {
-      traverse_preorder_impl(node->right, os);
+    const Node *stop = empty_impl(node) ? nullptr : node->parent;
+    while (node != stop) {
+      os << node->datum << " ";
+      if (node->left || node->right) {
+        node = node->left ? node->left : node->right;
+        continue;
+      }
+      // Climb to the nearest ancestor with a right subtree not yet visited.
+      const Node *child = node;
+      for (node = node->parent;
+           node != stop && (node->right == child || !node->right);
+           child = node, node = node->parent) { }
+      if (node != stop) { node = node->right; }
     }
   }
 
   // EFFECTS : Returns a pointer to the Node containing the smallest element
-  //           in the tree rooted at 'node' that is greater than 'val'.
-  //           Returns a null pointer if the tree is empty or if it does not
-  //           contain any elements that are greater than 'val'.
-  //
-  // NOTE: This function must be linear recursive.
-  // NOTE: This function is used in the implementation of the ++ operator for
-  //       the iterator code that is provided for you.
-  // HINT: At each step, compare 'val' the the current node (using the
-  //       'less' parameter). Based on the result, you gain some information
-  //       about where the element you're looking for could be.
-  static Node * min_greater_than_impl(Node *node, const T &val, Compare less) {
-    Node * ptr = nullptr;
-    if (empty_impl(node)) { return ptr; }
-    if (less(val, node->datum)) { // current node greater than val
-      if (node->left) {
-        ptr = min_greater_than_impl(node->left, val, less);
-      }
-      if (!ptr) {
-        ptr = node;
-      }
+  //           in the tree rooted at 'node' that is not less than 'query'.
+  //           If there is none, returns 'bound' (the best candidate found
+  //           above 'node', or a null pointer).
+  // NOTE: This function must be tail recursive.
+  template <typename K>
+  static Node * lower_bound_impl(Node *node, const K &query, Less_ref less,
+                                 Node *bound) {
+    if (empty_impl(node)) { return bound; }
+    if (less(node->datum, query)) {
+      return lower_bound_impl(node->right, query, less, bound);
     }
-    else { // current node less than or equal to val
-      if (node->right) {
-        ptr = min_greater_than_impl(node->right, val, less);
-      }
+    return lower_bound_impl(node->left, query, less, node);
+  }
+
+  // EFFECTS : Returns a pointer to the Node containing the smallest element
+  //           in the tree rooted at 'node' that is greater than 'query'.
+  //           If there is none, returns 'bound' (the best candidate found
+  //           above 'node', or a null pointer).
+  // NOTE: This function must be tail recursive.
+  template <typename K>
+  static Node * upper_bound_impl(Node *node, const K &query, Less_ref less,
+                                 Node *bound) {
+    if (empty_impl(node)) { return bound; }
+    if (less(query, node->datum)) {
+      return upper_bound_impl(node->left, query, less, node);
     }
-    return ptr;
+    return upper_bound_impl(node->right, query, less, bound);
   }
 
 
@@ -579,9 +2789,10 @@ private:
 //           BinarySearchTree Iterator, which in turn depends on some
 //           of the functions you must write.
 
-template <typename T, typename Compare>
+template <typename T, typename Compare, typename Balance, typename Allocator>
 std::ostream &operator<<(std::ostream &os,
-                         const BinarySearchTree<T, Compare> &tree) {
+                         const BinarySearchTree<T, Compare, Balance,
+                                                Allocator> &tree) {
 // DO NOT CHANGE THE IMPLEMENTATION OF THIS FUNCTION
   os << "[ ";
   for (T& elt : tree) {
@@ -0,0 +1,161 @@
+/* BinarySearchTree_bench.cpp
+ *
+ * Times building a BinarySearchTree<int> from sorted and from shuffled
+ * keys under each balancing policy, and reports the resulting height,
+ * then times copying and traversing the result. Also times appending
+ * sorted keys through the end() hint, the same AVL builds with
+ * CompactNodes, rebalance() and compact() on a randomly built
+ * Unbalanced tree, and summing an AVL tree with an Iterator loop,
+ * for_each() and parallel_reduce().
+ *
+ * Usage: BinarySearchTree_bench.exe [NUM_KEYS]   (default 1000000)
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "BinarySearchTree.hpp"
+
+using namespace std;
+
+// Sorted input turns an Unbalanced tree into a chain, so building it is
+// quadratic and its recursion is as deep as the input. That one case is
+// capped at this many keys.
+static const size_t c_max_chain_keys = 20000;
+
+// EFFECTS: Returns the milliseconds elapsed since start.
+static double elapsed_ms(chrono::steady_clock::time_point start) {
+  chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+// A stream buffer that discards everything, to time traversals alone.
+class NullBuffer : public streambuf {
+protected:
+  int overflow(int c) override { return c; }
+};
+
+// EFFECTS: Inserts keys into an empty tree in the given order and prints
+//          the elapsed time and the height of the result, followed by the
+//          time to copy it and to traverse it in order.
+template <typename Balance>
+void time_inserts(const string &label, const vector<int> &keys) {
+  auto start = chrono::steady_clock::now();
+  BinarySearchTree<int, less<int>, Balance> tree;
+  for (int key : keys) {
+    tree.insert(key);
+  }
+  cout << "  " << label << ": " << keys.size() << " keys, "
+       << elapsed_ms(start) << " ms, height " << tree.height();
+
+  start = chrono::steady_clock::now();
+  BinarySearchTree<int, less<int>, Balance> copy(tree);
+  cout << ", copy " << elapsed_ms(start) << " ms";
+
+  NullBuffer null_buffer;
+  ostream null_stream(&null_buffer);
+  start = chrono::steady_clock::now();
+  copy.traverse_inorder(null_stream);
+  cout << ", traverse " << elapsed_ms(start) << " ms" << endl;
+}
+
+// EFFECTS: Inserts keys, which are sorted, into an empty tree through
+//          insert(end(), key) and prints the elapsed time.
+template <typename Balance>
+void time_hinted_inserts(const string &label, const vector<int> &keys) {
+  auto start = chrono::steady_clock::now();
+  BinarySearchTree<int, less<int>, Balance> tree;
+  for (int key : keys) {
+    tree.insert(tree.end(), key);
+  }
+  cout << "  " << label << ": " << keys.size() << " keys, "
+       << elapsed_ms(start) << " ms, height " << tree.height() << endl;
+}
+
+// EFFECTS: Inserts keys into an empty Unbalanced tree, then prints the
+//          time to traverse it, to rebalance() and compact() it, and to
+//          traverse it again.
+void time_maintenance(const vector<int> &keys) {
+  BinarySearchTree<int> tree;
+  for (int key : keys) {
+    tree.insert(key);
+  }
+  NullBuffer null_buffer;
+  ostream null_stream(&null_buffer);
+  auto start = chrono::steady_clock::now();
+  tree.traverse_inorder(null_stream);
+  cout << "  random: traverse " << elapsed_ms(start) << " ms";
+
+  start = chrono::steady_clock::now();
+  tree.rebalance();
+  cout << ", rebalance " << elapsed_ms(start) << " ms (height "
+       << tree.height() << ")";
+  start = chrono::steady_clock::now();
+  tree.compact();
+  cout << ", compact " << elapsed_ms(start) << " ms";
+
+  start = chrono::steady_clock::now();
+  tree.traverse_inorder(null_stream);
+  cout << ", traverse " << elapsed_ms(start) << " ms" << endl;
+}
+
+// EFFECTS: Inserts keys into an empty AVL tree, then prints the time to
+//          add them up with a loop over Iterators, with for_each() and with
+//          parallel_reduce() on every core.
+void time_sums(const vector<int> &keys) {
+  BinarySearchTree<int, less<int>, AVLBalanced> tree;
+  for (int key : keys) {
+    tree.insert(key);
+  }
+  auto start = chrono::steady_clock::now();
+  long long loop_sum = 0;
+  for (int elt : tree) {
+    loop_sum += elt;
+  }
+  cout << "  sum: Iterator loop " << elapsed_ms(start) << " ms";
+
+  start = chrono::steady_clock::now();
+  long long visit_sum = 0;
+  tree.for_each([&](int elt) { visit_sum += elt; });
+  cout << ", for_each " << elapsed_ms(start) << " ms";
+
+  start = chrono::steady_clock::now();
+  long long reduce_sum = tree.parallel_reduce(
+    0LL, [](int elt) { return static_cast<long long>(elt); },
+    [](long long a, long long b) { return a + b; });
+  cout << ", parallel_reduce " << elapsed_ms(start) << " ms ("
+       << thread::hardware_concurrency() << " cores, difference "
+       << loop_sum - visit_sum + loop_sum - reduce_sum << ")" << endl;
+}
+
+int main(int argc, char *argv[]) {
+  size_t num_keys = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+
+  vector<int> sorted(num_keys);
+  iota(sorted.begin(), sorted.end(), 0);
+  vector<int> shuffled(sorted);
+  shuffle(shuffled.begin(), shuffled.end(), mt19937(280));
+  vector<int> chain(sorted.begin(),
+                    sorted.begin() + min(num_keys, c_max_chain_keys));
+
+  cout << "Unbalanced" << endl;
+  time_inserts<Unbalanced>("sorted (capped)", chain);
+  time_inserts<Unbalanced>("random", shuffled);
+  time_maintenance(shuffled);
+
+  cout << "AVLBalanced" << endl;
+  time_inserts<AVLBalanced>("sorted", sorted);
+  time_hinted_inserts<AVLBalanced>("sorted, end() hint", sorted);
+  time_inserts<AVLBalanced>("random", shuffled);
+  time_sums(shuffled);
+
+  cout << "CompactNodes<AVLBalanced>" << endl;
+  time_inserts<CompactNodes<AVLBalanced>>("sorted", sorted);
+  time_inserts<CompactNodes<AVLBalanced>>("random", shuffled);
+}
@@ -1,4 +1,14 @@
+#include <atomic>
+#include <cstdio>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <pthread.h>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <vector>
 #include "BinarySearchTree.hpp"
 #include "unit_test_framework.hpp"
 
@@ -473,4 +483,1360 @@ TEST(test_check_sorting_invariant_2) {
    *iter = 7; // 5 L(1 L0 R7)) R10
    ASSERT_FALSE(tree.check_sorting_invariant());
 }
+using AVL = BinarySearchTree<int, less<int>, AVLBalanced>;
+
+TEST(test_avl_sorted_inserts) {
+   BST plain;
+   AVL tree;
+   for (int i = 0; i < 1000; ++i) {
+      plain.insert(i);
+      tree.insert(i);
+   }
+   // the unbalanced tree degenerates into a chain, the AVL tree does not
+   ASSERT_EQUAL(plain.height(), 1000);
+   ASSERT_EQUAL(tree.height(), 10);
+   ASSERT_EQUAL(tree.size(), 1000);
+   ASSERT_TRUE(tree.check_sorting_invariant());
+
+   int expected = 0;
+   for (int elt : tree) {
+      ASSERT_EQUAL(elt, expected);
+      ++expected;
+   }
+   ASSERT_EQUAL(expected, 1000);
+}
+
+TEST(test_avl_rotations) {
+   AVL tree;
+   tree.insert(3); // 3
+   tree.insert(2); // 3 L2
+   tree.insert(1); // right rotation: 2 L1 R3
+   ostringstream oss;
+   tree.traverse_preorder(oss);
+   ASSERT_EQUAL(oss.str(), "2 1 3 ");
+
+   tree.insert(5); // 2 L1 R(3 R5)
+   tree.insert(4); // right-left rotation: 2 L1 R(4 L3 R5)
+   oss.str("");
+   tree.traverse_preorder(oss);
+   ASSERT_EQUAL(oss.str(), "2 1 4 3 5 ");
+   ASSERT_EQUAL(tree.height(), 3);
+
+   tree.insert(0); // 2 L(1 L0) R(4 L3 R5)
+   tree.insert(-2); // right rotation: 2 L(0 L-2 R1) R(4 L3 R5)
+   tree.insert(-1); // 2 L(0 L(-2 R-1) R1) R(4 L3 R5)
+   oss.str("");
+   tree.traverse_preorder(oss);
+   ASSERT_EQUAL(oss.str(), "2 0 -2 -1 1 4 3 5 ");
+   ASSERT_EQUAL(tree.height(), 4);
+
+   // an insertion returns an iterator to the new element even when
+   // rotations moved it
+   AVL::Iterator it = tree.insert(6);
+   ASSERT_EQUAL(*it, 6);
+   ASSERT_EQUAL(it, tree.max_element());
+   ASSERT_TRUE(tree.check_sorting_invariant());
+
+   AVL copy(tree);
+   ASSERT_EQUAL(copy.height(), tree.height());
+   ASSERT_EQUAL(copy.to_string(), tree.to_string());
+}
+
+// counts every comparison made through it
+class CountingLess {
+ public:
+    static int count;
+    bool operator() (int a, int b) const {
+        ++count;
+        return a < b;
+    }
+};
+int CountingLess::count = 0;
+
+TEST(test_find_follows_ordering) {
+   BinarySearchTree<int, CountingLess, AVLBalanced> tree;
+   for (int i = 0; i < 1024; ++i) {
+      tree.insert(i);
+   }
+   // a search only walks one root-to-leaf path: at most two
+   // comparisons per level
+   CountingLess::count = 0;
+   ASSERT_EQUAL(*tree.find(777), 777);
+   ASSERT_TRUE(CountingLess::count <= 2 * static_cast<int>(tree.height()));
+
+   CountingLess::count = 0;
+   ASSERT_EQUAL(tree.find(5000), tree.end());
+   ASSERT_TRUE(CountingLess::count <= 2 * static_cast<int>(tree.height()));
+}
+
+TEST(test_find_heterogeneous) {
+   BinarySearchTree<string, less<>> tree;
+   tree.insert("data");
+   tree.insert("base");
+   tree.insert("zoo");
+
+   // looked up without building a std::string
+   ASSERT_EQUAL(*tree.find("base"), "base");
+   ASSERT_EQUAL(*tree.find(string_view("zoo")), "zoo");
+   ASSERT_EQUAL(tree.find(string_view("dat")), tree.end());
+}
+
+TEST(test_iteration_without_comparisons) {
+   BinarySearchTree<int, CountingLess> tree;
+   BinarySearchTree<int, CountingLess, AVLBalanced> avl;
+   for (int i = 0; i < 500; ++i) {
+      tree.insert((i * 37) % 500); // 37 and 500 are coprime
+      avl.insert((i * 37) % 500);
+   }
+   BinarySearchTree<int, CountingLess, AVLBalanced> copy(avl);
+
+   CountingLess::count = 0;
+   int expected = 0;
+   for (int elt : tree) {
+      ASSERT_EQUAL(elt, expected);
+      ++expected;
+   }
+   ASSERT_EQUAL(expected, 500);
+   expected = 0;
+   for (int elt : copy) {
+      ASSERT_EQUAL(elt, expected);
+      ++expected;
+   }
+   ASSERT_EQUAL(expected, 500);
+   ASSERT_EQUAL(CountingLess::count, 0);
+}
+
+TEST(test_select_and_rank) {
+   BST tree;
+   tree.insert(50); // 50
+   tree.insert(60); // 50 R60
+   tree.insert(70); // 50 R(60 R70)
+   tree.insert(40); // 50 L40 R(60 R70);
+   tree.insert(30); // 50 L(40 L30) R(60 R70)
+
+   ASSERT_EQUAL(*tree.select(0), 30);
+   ASSERT_EQUAL(*tree.select(2), 50);
+   ASSERT_EQUAL(*tree.select(4), 70);
+   ASSERT_EQUAL(tree.select(5), tree.end());
+
+   ASSERT_EQUAL(tree.rank(30), 0);
+   ASSERT_EQUAL(tree.rank(60), 3);
+   ASSERT_EQUAL(tree.rank(55), 3); // not in the tree
+   ASSERT_EQUAL(tree.rank(0), 0);
+   ASSERT_EQUAL(tree.rank(100), 5);
+
+   BST empty;
+   ASSERT_EQUAL(empty.select(0), empty.end());
+   ASSERT_EQUAL(empty.rank(3), 0);
+}
+
+TEST(test_select_and_rank_balanced) {
+   AVL tree;
+   for (int i = 0; i < 1000; ++i) {
+      tree.insert(2 * i); // even numbers only, rotating as we go
+   }
+   ASSERT_EQUAL(tree.size(), 1000);
+   for (int i = 0; i < 1000; ++i) {
+      ASSERT_EQUAL(*tree.select(i), 2 * i);
+      ASSERT_EQUAL(tree.rank(2 * i), i);
+      ASSERT_EQUAL(tree.rank(2 * i + 1), i + 1);
+   }
+   AVL copy(tree);
+   ASSERT_EQUAL(copy.size(), 1000);
+   ASSERT_EQUAL(*copy.select(500), 1000);
+}
+
+TEST(test_reserve_contiguous) {
+   BST tree;
+   tree.reserve(100);
+   for (int i = 0; i < 100; ++i) {
+      tree.insert((i * 37) % 100);
+   }
+   // nodes sit side by side in insertion order
+   const char *first = reinterpret_cast<const char *>(&*tree.find(0));
+   const char *second = reinterpret_cast<const char *>(&*tree.find(37));
+   ptrdiff_t stride = second - first;
+   for (int i = 0; i < 100; ++i) {
+      const char *node = reinterpret_cast<const char *>(&*tree.find((i * 37) % 100));
+      ASSERT_EQUAL(node - first, i * stride);
+   }
+}
+
+// counts the blocks allocated through it, and the bytes still in use
+class CountingResource : public pmr::memory_resource {
+ public:
+    int allocations = 0;
+    size_t live_bytes = 0;
+ private:
+    void *do_allocate(size_t bytes, size_t alignment) override {
+        ++allocations;
+        live_bytes += bytes;
+        return pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override {
+        live_bytes -= bytes;
+        pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+    bool do_is_equal(const pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+};
+
+TEST(test_pmr_allocator) {
+   using PmrTree = BinarySearchTree<string, less<string>, AVLBalanced,
+                                    pmr::polymorphic_allocator<string>>;
+   CountingResource resource;
+   {
+      PmrTree tree(&resource);
+      for (int i = 0; i < 1000; ++i) {
+         tree.insert(to_string(i));
+      }
+      ASSERT_EQUAL(tree.size(), 1000);
+      ASSERT_EQUAL(*tree.find("500"), "500");
+      ASSERT_TRUE(tree.get_allocator().resource() == &resource);
+      // a handful of slabs (and the list of slabs) rather than one
+      // block per node
+      ASSERT_TRUE(resource.allocations < 20);
+   }
+
+   PmrTree tree(&resource);
+   tree.insert("a");
+   PmrTree copy(tree);
+   copy = tree;
+   ASSERT_EQUAL(*copy.begin(), "a");
+}
+
+TEST(test_find_batch) {
+   BinarySearchTree<int, CountingLess, AVLBalanced> tree;
+   for (int i = 0; i < 1000; ++i) {
+      tree.insert(3 * i);
+   }
+   // misses, hits, repeats and a group that is not in order
+   vector<int> queries;
+   for (int i = -5; i < 3100; i += 7) {
+      queries.push_back(i);
+   }
+   queries.push_back(30);
+   queries.push_back(30);
+   queries.push_back(-1);
+   queries.push_back(2997);
+   vector<BinarySearchTree<int, CountingLess, AVLBalanced>::Iterator> found;
+   tree.find_batch(queries.begin(), queries.end(), back_inserter(found));
+   ASSERT_EQUAL(found.size(), queries.size());
+   for (size_t i = 0; i < queries.size(); ++i) {
+      ASSERT_TRUE(found[i] == tree.find(queries[i]));
+   }
+
+   // ascending queries share the top of their paths
+   vector<int> sorted;
+   for (int i = 1500; i < 1532; ++i) {
+      sorted.push_back(i);
+   }
+   CountingLess::count = 0;
+   for (int query : sorted) {
+      tree.find(query);
+   }
+   int one_by_one = CountingLess::count;
+   CountingLess::count = 0;
+   found.clear();
+   tree.find_batch(sorted.begin(), sorted.end(), back_inserter(found));
+   ASSERT_TRUE(CountingLess::count < one_by_one);
+   ASSERT_EQUAL(*found[3], 1503);
+   ASSERT_TRUE(found[4] == tree.end());
+
+   BST empty;
+   vector<BST::Iterator> none(2);
+   ASSERT_TRUE(empty.find_batch(sorted.begin(), sorted.begin() + 2,
+                                none.begin()) == none.end());
+   ASSERT_TRUE(none[0] == empty.end());
+}
+
+TEST(test_insert_single_descent) {
+   BinarySearchTree<int, CountingLess, AVLBalanced> tree;
+   for (int i = 0; i < 1024; ++i) {
+      tree.insert(2 * i);
+   }
+   CountingLess::count = 0;
+   ASSERT_EQUAL(*tree.insert(777), 777);
+   ASSERT_TRUE(CountingLess::count <= 2 * static_cast<int>(tree.height()));
+}
+
+TEST(test_insert_hint) {
+   // ascending input at end(), and each element after the previous one
+   BinarySearchTree<int, CountingLess, AVLBalanced> tree;
+   BinarySearchTree<int, CountingLess, AVLBalanced> chained;
+   CountingLess::count = 0;
+   auto hint = chained.end();
+   for (int i = 0; i < 1000; ++i) {
+      ASSERT_EQUAL(*tree.insert(tree.end(), 2 * i), 2 * i);
+      hint = chained.insert(hint, 2 * i);
+   }
+   ASSERT_TRUE(CountingLess::count <= 2 * 3 * 1000);
+   ASSERT_TRUE(tree.check_sorting_invariant());
+   ASSERT_TRUE(chained.check_sorting_invariant());
+   ASSERT_EQUAL(tree.height(), chained.height());
+   ASSERT_TRUE(tree.height() <= 14);
+
+   // just before and just after a hint, wherever it is in the tree
+   for (int i = 1; i < 2000; i += 200) {
+      auto next = tree.find(i + 1);
+      CountingLess::count = 0;
+      ASSERT_EQUAL(*tree.insert(next, i), i);
+      ASSERT_TRUE(CountingLess::count <= 3);
+      auto previous = tree.find(i + 99);
+      CountingLess::count = 0;
+      ASSERT_EQUAL(*tree.insert(previous, i + 100), i + 100);
+      ASSERT_TRUE(CountingLess::count <= 3);
+   }
+   ASSERT_EQUAL(tree.size(), 1020);
+   ASSERT_TRUE(tree.check_sorting_invariant());
+
+   // a wrong hint still inserts, and an existing element is returned
+   ASSERT_EQUAL(*tree.insert(tree.begin(), 1999), 1999);
+   ASSERT_EQUAL(*tree.insert(tree.find(4), 4), 4);
+   ASSERT_EQUAL(*tree.insert(tree.find(4), 5), 5);
+   ASSERT_EQUAL(*tree.insert(tree.find(6), 5), 5);
+   ASSERT_EQUAL(tree.size(), 1022);
+   ASSERT_TRUE(tree.check_sorting_invariant());
+   size_t position = 0;
+   for (int elt : tree) {
+      ASSERT_EQUAL(tree.rank(elt), position++);
+   }
+
+   BST empty;
+   ASSERT_EQUAL(*empty.insert(empty.end(), 3), 3);
+   ASSERT_EQUAL(*empty.insert(empty.begin(), 1), 1);
+   ASSERT_EQUAL(*empty.insert(empty.end(), 2), 2);
+   ASSERT_EQUAL(empty.size(), 3);
+   ASSERT_TRUE(empty.check_sorting_invariant());
+}
+
+class DerefLess {
+ public:
+    bool operator() (const unique_ptr<int> &a, const unique_ptr<int> &b) const {
+        return *a < *b;
+    }
+};
+
+TEST(test_insert_move_only) {
+   BinarySearchTree<unique_ptr<int>, DerefLess> tree;
+   unique_ptr<int> five(new int(5));
+   ASSERT_EQUAL(**tree.insert(move(five)), 5);
+   ASSERT_TRUE(five == nullptr);
+   ASSERT_EQUAL(**tree.emplace(new int(3)), 3);
+   ASSERT_EQUAL(**tree.emplace(new int(8)), 8);
+   ASSERT_EQUAL(**tree.begin(), 3);
+
+   // already present: the argument is not consumed
+   unique_ptr<int> other(new int(8));
+   auto result = tree.try_emplace(other, move(other));
+   ASSERT_FALSE(result.second);
+   ASSERT_EQUAL(**result.first, 8);
+   ASSERT_TRUE(other != nullptr);
+   ASSERT_EQUAL(tree.size(), 3);
+}
+
+TEST(test_move_and_swap) {
+   BSTring tree;
+   tree.insert("b");
+   tree.insert("a");
+   tree.insert("c");
+   Striterator it = tree.find("c");
+
+   BSTring moved(move(tree));
+   ASSERT_TRUE(tree.empty());
+   ASSERT_EQUAL(moved.size(), 3);
+   ASSERT_EQUAL(moved.max_element(), it); // iterators follow their nodes
+   tree.insert("z"); // a moved-from tree is usable
+   ASSERT_EQUAL(*tree.begin(), "z");
+
+   BSTring other;
+   other.insert("x");
+   other = move(moved);
+   ASSERT_TRUE(moved.empty());
+   ASSERT_EQUAL(other.size(), 3);
+   ASSERT_EQUAL(*other.begin(), "a");
+
+   other.swap(tree);
+   ASSERT_EQUAL(other.size(), 1);
+   ASSERT_EQUAL(tree.size(), 3);
+   ASSERT_EQUAL(*other.begin(), "z");
+   ASSERT_EQUAL(*tree.begin(), "a");
+   ASSERT_TRUE(tree.check_sorting_invariant());
+}
+
+TEST(test_assign_sorted_range) {
+   vector<int> sorted;
+   for (int i = 0; i < 1000; ++i) {
+      sorted.push_back(i);
+      if (i % 10 == 0) {
+         sorted.push_back(i); // duplicates are dropped
+      }
+   }
+   BST tree(sorted.begin(), sorted.end());
+   ASSERT_EQUAL(tree.size(), 1000);
+   ASSERT_EQUAL(tree.height(), 10); // perfectly balanced
+   ASSERT_TRUE(tree.check_sorting_invariant());
+   int expected = 0;
+   for (int elt : tree) {
+      ASSERT_EQUAL(elt, expected);
+      ++expected;
+   }
+   ASSERT_EQUAL(expected, 1000);
+   ASSERT_EQUAL(*tree.select(500), 500);
+
+   // replaces the old contents; the tree stays usable afterwards
+   int small[] = { 1, 2, 2, 3 };
+   tree.assign(small, small + 4);
+   ASSERT_EQUAL(tree.size(), 3);
+   ostringstream oss;
+   tree.traverse_preorder(oss);
+   ASSERT_EQUAL(oss.str(), "2 1 3 ");
+   tree.insert(4);
+   ASSERT_EQUAL(*tree.max_element(), 4);
+
+   tree.assign(small, small);
+   ASSERT_TRUE(tree.empty());
+
+   // a balanced tree built in bulk is a valid AVL tree
+   AVL avl(sorted.begin(), sorted.end());
+   for (int i = 1000; i < 2000; ++i) {
+      avl.insert(i);
+   }
+   ASSERT_EQUAL(avl.height(), 11);
+}
+
+TEST(test_erase_cases) {
+   BST tree;
+   int keys[] = { 50, 30, 70, 20, 40, 60, 80, 35, 45, 65 };
+   for (int key : keys) {
+      tree.insert(key);
+   }
+   // 50 L(30 L20 R(40 L35 R45)) R(70 L(60 R65) R80)
+
+   ASSERT_EQUAL(*tree.erase(tree.find(60)), 65); // one child
+   Iterator sixty_five = tree.find(65);
+   ASSERT_EQUAL(*tree.erase(tree.find(30)), 35); // successor deeper down
+   // 50 L(35 L20 R(40 R45)) R(70 L65 R80)
+   ASSERT_EQUAL(*tree.erase(tree.find(20)), 35); // leaf
+   ASSERT_EQUAL(*tree.erase(tree.find(70)), 80); // successor is the child
+   ASSERT_EQUAL(*tree.erase(tree.find(50)), 65); // root
+   ASSERT_EQUAL(tree.erase(tree.find(80)), tree.end()); // last element
+
+   ostringstream oss;
+   tree.traverse_preorder(oss);
+   ASSERT_EQUAL(oss.str(), "65 35 40 45 ");
+   ASSERT_EQUAL(tree.size(), 4);
+   ASSERT_EQUAL(tree.height(), 4);
+   ASSERT_EQUAL(*sixty_five, 65); // iterators to other elements survive
+   ASSERT_TRUE(tree.check_sorting_invariant());
+
+   ASSERT_EQUAL(tree.erase(40), 1);
+   ASSERT_EQUAL(tree.erase(40), 0);
+   tree.erase(tree.begin(), tree.find(65));
+   ASSERT_EQUAL(tree.size(), 1);
+   ASSERT_EQUAL(tree.erase(tree.begin(), tree.end()), tree.end());
+   ASSERT_TRUE(tree.empty());
+   tree.insert(1);
+   ASSERT_EQUAL(*tree.begin(), 1);
+}
+
+TEST(test_erase_balanced) {
+   AVL tree;
+   for (int i = 0; i < 2000; ++i) {
+      tree.insert(i);
+   }
+   for (int i = 0; i < 2000; i += 3) {
+      ASSERT_EQUAL(tree.erase(i), 1);
+   }
+   for (int i = 1000; i < 2000; ++i) {
+      tree.erase(i);
+   }
+   // 666 of the first 1000 remain, and the height stays logarithmic
+   ASSERT_EQUAL(tree.size(), 666);
+   ASSERT_TRUE(tree.height() <= 13);
+   ASSERT_TRUE(tree.check_sorting_invariant());
+   size_t position = 0;
+   for (int elt : tree) {
+      ASSERT_TRUE(elt % 3 != 0);
+      ASSERT_EQUAL(tree.rank(elt), position);
+      ASSERT_EQUAL(*tree.select(position), elt);
+      ++position;
+   }
+   ASSERT_EQUAL(position, 666);
+}
+
+TEST(test_erase_recycles_nodes) {
+   BSTring tree;
+   tree.insert("a");
+   tree.insert("b");
+   const string *slot = &*tree.find("a");
+   tree.erase("a");
+   // the freed node is the next one handed out
+   ASSERT_EQUAL(&*tree.insert("c"), slot);
+   ASSERT_EQUAL(*tree.begin(), "b");
+}
+
+TEST(test_bounds) {
+   BST tree;
+   for (int i = 10; i <= 100; i += 10) {
+      tree.insert(i);
+   }
+   ASSERT_EQUAL(*tree.lower_bound(30), 30);
+   ASSERT_EQUAL(*tree.lower_bound(31), 40);
+   ASSERT_EQUAL(*tree.lower_bound(0), 10);
+   ASSERT_EQUAL(tree.lower_bound(101), tree.end());
+   ASSERT_EQUAL(*tree.upper_bound(30), 40);
+   ASSERT_EQUAL(*tree.upper_bound(29), 30);
+   ASSERT_EQUAL(tree.upper_bound(100), tree.end());
+
+   auto range = tree.equal_range(50);
+   ASSERT_EQUAL(*range.first, 50);
+   ASSERT_EQUAL(*range.second, 60);
+   range = tree.equal_range(55);
+   ASSERT_EQUAL(range.first, range.second);
+
+   // the elements in [25, 75)
+   ostringstream oss;
+   for (auto it = tree.lower_bound(25); it != tree.lower_bound(75); ++it) {
+      oss << *it << " ";
+   }
+   ASSERT_EQUAL(oss.str(), "30 40 50 60 70 ");
+
+   BST empty;
+   ASSERT_EQUAL(empty.lower_bound(1), empty.end());
+   ASSERT_EQUAL(empty.upper_bound(1), empty.end());
+}
+
+// An element that counts how many instances are alive
+class Tracked {
+ public:
+    static int live;
+    Tracked(int value_in) : value(value_in) { ++live; }
+    Tracked(const Tracked &other) : value(other.value) { ++live; }
+    ~Tracked() { --live; }
+    bool operator<(const Tracked &rhs) const { return value < rhs.value; }
+    int value;
+};
+int Tracked::live = 0;
+
+// Stack given to run_on_small_stack: a walk that recursed once per level
+// of a chain of c_chain_length nodes would need more than twice as much.
+static const size_t c_small_stack = 64 * 1024;
+static const int c_chain_length = 5000;
+
+// EFFECTS: Runs body on a thread with a stack of c_small_stack bytes and
+//          waits for it to finish.
+template <typename Body>
+void run_on_small_stack(Body body) {
+   pthread_attr_t attr;
+   pthread_attr_init(&attr);
+   pthread_attr_setstacksize(&attr, c_small_stack);
+   pthread_t thread;
+   auto run = [](void *arg) -> void * {
+      (*static_cast<Body *>(arg))();
+      return nullptr;
+   };
+   pthread_create(&thread, &attr, run, &body);
+   pthread_join(thread, nullptr);
+   pthread_attr_destroy(&attr);
+}
+
+// Whole-tree walks must not recurse once per level: on a small stack,
+// build chains of both shapes (appending and prepending through hints,
+// so in linear comparisons), then copy, assign, traverse and destroy them.
+TEST(test_long_chain) {
+   const int n = c_chain_length;
+   size_t heights[2] = {0, 0};
+   size_t copy_height = 0;
+   size_t copy_size = 0;
+   int live_after_copy = 0;
+   int live_after_clear = 0;
+   int first_after_assign = -1;
+   bool in_order = true;
+   size_t printed = 0;
+   run_on_small_stack([&]() {
+      BinarySearchTree<Tracked> ascending;
+      BinarySearchTree<Tracked> descending;
+      auto last = ascending.end();
+      for (int i = 0; i < n; ++i) {
+         last = ascending.insert(last, Tracked(i));
+         descending.insert(descending.begin(), Tracked(n - 1 - i));
+      }
+      heights[0] = ascending.height();
+      heights[1] = descending.height();
+
+      BinarySearchTree<Tracked> copy(descending);
+      copy_height = copy.height();
+      copy_size = copy.size();
+      live_after_copy = Tracked::live;
+      int expected = 0;
+      for (const Tracked &elt : copy) {
+         in_order = in_order && elt.value == expected++;
+      }
+      in_order = in_order && expected == n;
+
+      copy = ascending;
+      first_after_assign = copy.begin()->value;
+      copy.clear();
+      live_after_clear = Tracked::live;
+
+      BinarySearchTree<int> ints;
+      auto hint = ints.end();
+      for (int i = 0; i < n; ++i) {
+         hint = ints.insert(hint, i);
+      }
+      ostringstream in, pre;
+      ints.traverse_inorder(in);
+      ints.traverse_preorder(pre);
+      printed = in.str().size() + pre.str().size();
+   });
+   ASSERT_EQUAL(heights[0], static_cast<size_t>(n));
+   ASSERT_EQUAL(heights[1], static_cast<size_t>(n));
+   ASSERT_EQUAL(copy_height, static_cast<size_t>(n));
+   ASSERT_EQUAL(copy_size, static_cast<size_t>(n));
+   ASSERT_EQUAL(live_after_copy, 3 * n);
+   ASSERT_TRUE(in_order);
+   ASSERT_EQUAL(first_after_assign, 0);
+   ASSERT_EQUAL(live_after_clear, 2 * n);
+   ASSERT_TRUE(printed > static_cast<size_t>(4 * n));
+   ASSERT_EQUAL(Tracked::live, 0);
+}
+
+TEST(test_traversals_iterative) {
+   BST tree;
+   for (int i : {50, 20, 80, 10, 30, 70, 90, 25, 35, 75}) {
+      tree.insert(i);
+   }
+   ostringstream in, pre;
+   tree.traverse_inorder(in);
+   tree.traverse_preorder(pre);
+   ASSERT_EQUAL(in.str(), "10 20 25 30 35 50 70 75 80 90 ");
+   ASSERT_EQUAL(pre.str(), "50 20 10 30 25 35 80 70 75 90 ");
+
+   BST copy(tree);
+   ostringstream copy_pre;
+   copy.traverse_preorder(copy_pre);
+   ASSERT_EQUAL(copy_pre.str(), pre.str());
+   ASSERT_EQUAL(copy.height(), tree.height());
+}
+
+// EFFECTS: Returns whether tree holds exactly first, first + 1, ...,
+//          last - 1, with cached sizes that agree with select and rank.
+template <typename Tree>
+bool holds_range(const Tree &tree, int first, int last) {
+   if (tree.size() != static_cast<size_t>(last - first) ||
+       !tree.check_sorting_invariant()) {
+      return false;
+   }
+   int expected = first;
+   for (int elt : tree) {
+      if (elt != expected || *tree.select(expected - first) != elt ||
+          tree.rank(elt) != static_cast<size_t>(expected - first)) {
+         return false;
+      }
+      ++expected;
+   }
+   return expected == last;
+}
+
+TEST(test_split_join_balanced) {
+   AVL tree;
+   for (int i = 0; i < 1000; ++i) {
+      tree.insert(i);
+   }
+   auto kept = tree.find(10);
+   AVL upper = tree.split(600);
+   ASSERT_TRUE(holds_range(tree, 0, 600));
+   ASSERT_TRUE(holds_range(upper, 600, 1000));
+   ASSERT_EQUAL(*kept, 10); // the larger part keeps its nodes
+   ASSERT_TRUE(tree.height() <= 13);
+   ASSERT_TRUE(upper.height() <= 12);
+
+   // every key, including those of inner nodes, splits cleanly
+   for (int key = 0; key <= 600; key += 37) {
+      AVL low(tree);
+      AVL high = low.split(key);
+      ASSERT_TRUE(holds_range(low, 0, key));
+      ASSERT_TRUE(holds_range(high, key, 600));
+      low.join(high);
+      ASSERT_TRUE(holds_range(low, 0, 600));
+      ASSERT_TRUE(low.height() <= 13);
+   }
+
+   // the larger part is above the key this time
+   AVL top = upper.split(650);
+   ASSERT_TRUE(holds_range(upper, 600, 650));
+   ASSERT_TRUE(holds_range(top, 650, 1000));
+
+   // keys outside the range, and one that is absent
+   ASSERT_TRUE(top.split(5000).empty());
+   AVL all = top.split(-1);
+   ASSERT_TRUE(top.empty());
+   ASSERT_TRUE(holds_range(all, 650, 1000));
+   upper.erase(620);
+   AVL from_620 = upper.split(620);
+   ASSERT_EQUAL(*from_620.begin(), 621);
+   upper.join(from_620);
+   upper.insert(620);
+
+   // join trees of very different heights in both orders
+   AVL small;
+   small.insert(-1);
+   small.join(tree);
+   ASSERT_TRUE(tree.empty());
+   small.join(upper);
+   small.join(all);
+   ASSERT_TRUE(small.erase(-1));
+   ASSERT_TRUE(holds_range(small, 0, 1000));
+   ASSERT_TRUE(small.height() <= 14);
+   ASSERT_EQUAL(*small.insert(1000), 1000);
+   ASSERT_TRUE(holds_range(small, 0, 1001));
+}
+
+TEST(test_split_join_unbalanced) {
+   {
+      BinarySearchTree<Tracked> tree;
+      for (int i : {50, 20, 80, 10, 30, 70, 90, 25, 35, 75}) {
+         tree.insert(Tracked(i));
+      }
+      BinarySearchTree<Tracked> upper = tree.split(Tracked(30));
+      ASSERT_EQUAL(tree.size(), 3);
+      ASSERT_EQUAL(upper.size(), 7);
+      ASSERT_EQUAL(Tracked::live, 10);
+      ASSERT_EQUAL(upper.begin()->value, 30);
+      ASSERT_TRUE(tree.check_sorting_invariant());
+      ASSERT_TRUE(upper.check_sorting_invariant());
+      tree.join(upper);
+      ASSERT_TRUE(upper.empty());
+      ASSERT_EQUAL(tree.size(), 10);
+      ASSERT_EQUAL(tree.rank(Tracked(70)), 6);
+      ASSERT_EQUAL(Tracked::live, 10);
+   }
+   ASSERT_EQUAL(Tracked::live, 0);
+
+   // trees that allocate from different resources copy on join
+   using PmrTree = BinarySearchTree<int, less<int>, Unbalanced,
+                                    pmr::polymorphic_allocator<int>>;
+   pmr::monotonic_buffer_resource first_resource, second_resource;
+   PmrTree left(&first_resource);
+   PmrTree right(&second_resource);
+   left.insert(1);
+   right.insert(3);
+   right.insert(2);
+   left.join(right);
+   ASSERT_TRUE(right.empty());
+   ASSERT_TRUE(holds_range(left, 1, 4));
+}
+
+TEST(test_set_algebra) {
+   AVL evens;
+   AVL threes;
+   for (int i = 0; i < 30; ++i) {
+      evens.insert(2 * i);
+      threes.insert(3 * i);
+   }
+   ostringstream oss;
+   oss << evens.set_intersection(threes);
+   ASSERT_EQUAL(oss.str(), "[ 0 6 12 18 24 30 36 42 48 54 ]");
+   oss.str("");
+   oss << threes.set_difference(evens).set_intersection(evens);
+   ASSERT_EQUAL(oss.str(), "[ ]");
+   AVL both = evens.set_union(threes);
+   ASSERT_EQUAL(both.size(), 30 + 30 - 10);
+   ASSERT_TRUE(both.check_sorting_invariant());
+   ASSERT_TRUE(both.height() <= 6);
+   ASSERT_EQUAL(threes.set_difference(evens).size(), 20);
+   ASSERT_EQUAL(evens.set_union(AVL()).size(), 30);
+
+   // merge moves the new elements over and leaves the duplicates
+   BinarySearchTree<string> words;
+   BinarySearchTree<string> more;
+   for (const char *word : {"fig", "kiwi", "apple"}) {
+      words.insert(word);
+   }
+   for (const char *word : {"lime", "fig", "date", "kiwi"}) {
+      more.insert(word);
+   }
+   words.merge(more);
+   oss.str("");
+   oss << words << more;
+   ASSERT_EQUAL(oss.str(), "[ apple date fig kiwi lime ][ fig kiwi ]");
+   ASSERT_TRUE(words.check_sorting_invariant());
+   words.merge(words);
+   ASSERT_EQUAL(words.size(), 5);
+}
+
+TEST(test_health) {
+   BST empty;
+   BST::Health health = empty.health();
+   ASSERT_EQUAL(health.size, 0);
+   ASSERT_EQUAL(health.optimal_height, 0);
+   ASSERT_EQUAL(health.average_depth, 0.0);
+
+   BST tree;
+   for (int i : {50, 20, 80, 10, 30, 70}) {
+      tree.insert(i);
+   }
+   tree.insert(75);
+   health = tree.health();
+   ASSERT_EQUAL(health.size, 7);
+   ASSERT_EQUAL(health.height, 4);
+   ASSERT_EQUAL(health.optimal_height, 3);
+   ASSERT_EQUAL(health.average_depth, 18.0 / 7);
+   ostringstream oss;
+   oss << health;
+   ASSERT_EQUAL(oss.str(), "size 7 height 4 (1.33333x optimal 3) "
+                           "average depth 2.57143 depths [ 1 2 3 1 ]");
+
+   // the example in the documentation, and an empty tree
+   BST documented;
+   for (int i : {50, 20, 80, 10, 30, 5}) {
+      documented.insert(i);
+   }
+   oss.str("");
+   oss << documented.health();
+   ASSERT_EQUAL(oss.str(), "size 6 height 4 (1.33333x optimal 3) "
+                           "average depth 2.5 depths [ 1 2 2 1 ]");
+   oss.str("");
+   oss << empty.health();
+   ASSERT_EQUAL(oss.str(), "size 0 height 0 (1x optimal 0) "
+                           "average depth 0 depths [ ]");
+
+   // sorted input degenerates an Unbalanced tree, but not an AVL tree
+   BST chain;
+   AVL balanced;
+   for (int i = 0; i < 1000; ++i) {
+      chain.insert(i);
+      balanced.insert(i);
+   }
+   health = chain.health();
+   ASSERT_EQUAL(health.height, 1000);
+   ASSERT_EQUAL(health.optimal_height, 10);
+   ASSERT_EQUAL(health.height_ratio, 100.0);
+   ASSERT_EQUAL(health.average_depth, 500.5);
+   ASSERT_EQUAL(health.depth_histogram[1000], 1);
+   ASSERT_TRUE(chain.check_sorting_invariant());
+   AVL::Health balanced_health = balanced.health();
+   ASSERT_TRUE(balanced_health.height_ratio < 1.44);
+   ASSERT_TRUE(balanced_health.average_depth < 10);
+   size_t total = 0;
+   for (size_t count : balanced_health.depth_histogram) {
+      total += count;
+   }
+   ASSERT_EQUAL(total, 1000);
+}
+
+TEST(test_compact_nodes) {
+   using Compact = BinarySearchTree<int, less<int>, CompactNodes<AVLBalanced>>;
+   Compact tree;
+   tree.reserve(100);
+   for (int i = 0; i < 100; ++i) {
+      tree.insert((i * 37) % 100);
+   }
+   // 20 bytes of links and counts next to each int
+   const char *first = reinterpret_cast<const char *>(&*tree.find(0));
+   const char *second = reinterpret_cast<const char *>(&*tree.find(37));
+   ASSERT_EQUAL(second - first, 24);
+   ASSERT_TRUE(tree.height() <= 8);
+
+   // within the reserved room, insertions keep iterators valid
+   Compact reserved;
+   reserved.reserve(1000);
+   auto zero = reserved.insert(0);
+   for (int i = 999; i > 0; --i) {
+      reserved.insert(i);
+   }
+   ASSERT_EQUAL(*zero, 0);
+   ASSERT_TRUE(zero == reserved.begin());
+   ASSERT_EQUAL(*++zero, 1);
+
+   // emplace into a full array builds the element before growing
+   Compact full;
+   for (int i = 0; i < 16; ++i) {
+      full.emplace(i);
+   }
+   ASSERT_EQUAL(*full.emplace(16), 16);
+   ASSERT_TRUE(holds_range(full, 0, 17));
+
+   // growing the array past its capacity moves every node
+   for (int i = 4999; i >= 100; --i) {
+      tree.insert(i);
+   }
+   ASSERT_TRUE(holds_range(tree, 0, 5000));
+   ASSERT_TRUE(tree.height() <= 16);
+   for (int i = 0; i < 5000; i += 2) {
+      tree.erase(i);
+   }
+   for (int i = 0; i < 5000; i += 2) {
+      tree.insert(tree.find(i + 1), i);
+   }
+   ASSERT_TRUE(holds_range(tree, 0, 5000));
+
+   // copies, splits and joins between arrays
+   Compact copy(tree);
+   ASSERT_EQUAL(copy.to_string(), tree.to_string());
+   Compact upper = copy.split(1000);
+   ASSERT_TRUE(holds_range(copy, 0, 1000));
+   ASSERT_TRUE(holds_range(upper, 1000, 5000));
+   Compact top = upper.split(4900);
+   copy.join(upper);
+   copy.join(top);
+   ASSERT_TRUE(upper.empty());
+   ASSERT_TRUE(holds_range(copy, 0, 5000));
+   tree = std::move(copy);
+   ASSERT_TRUE(holds_range(tree, 0, 5000));
+
+   // a long chain, and strings, which cannot be moved bytewise
+   {
+      BinarySearchTree<Tracked, less<Tracked>, CompactNodes<Unbalanced>> chain;
+      for (int i = 0; i < 5000; ++i) {
+         chain.insert(Tracked(i));
+      }
+      ASSERT_EQUAL(chain.height(), 5000u);
+      auto chain_copy(chain);
+      ASSERT_EQUAL(chain_copy.height(), 5000u);
+      ASSERT_EQUAL(Tracked::live, 10000);
+   }
+   ASSERT_EQUAL(Tracked::live, 0);
+   BinarySearchTree<string, less<>, CompactNodes<Unbalanced>> words;
+   for (int i = 0; i < 1000; ++i) {
+      words.insert(string(30, 'a') + to_string(i));
+   }
+   ASSERT_TRUE(words.check_sorting_invariant());
+   ASSERT_EQUAL(*words.find(string(30, 'a') + "500"), string(30, 'a') + "500");
+   ASSERT_EQUAL(words.size(), 1000u);
+}
+
+TEST(test_rebalance_compact) {
+   BST empty;
+   empty.rebalance();
+   empty.compact();
+   ASSERT_TRUE(empty.empty());
+
+   // every size from a chain, in both directions
+   for (int n = 1; n <= 70; ++n) {
+      BST ascending;
+      BST descending;
+      for (int i = 0; i < n; ++i) {
+         ascending.insert(i);
+         descending.insert(n - 1 - i);
+      }
+      auto kept = ascending.find(n / 2);
+      ascending.rebalance();
+      descending.rebalance();
+      size_t optimal = 0;
+      while ((size_t(1) << optimal) <= static_cast<size_t>(n)) {
+         ++optimal;
+      }
+      ASSERT_EQUAL(ascending.height(), optimal);
+      ASSERT_EQUAL(descending.height(), optimal);
+      ASSERT_TRUE(holds_range(ascending, 0, n));
+      ASSERT_TRUE(holds_range(descending, 0, n));
+      ASSERT_EQUAL(*kept, n / 2); // nodes stay where they are
+      ASSERT_TRUE(kept == ascending.find(n / 2));
+   }
+
+   // a long chain, then a scattered tree laid out in order
+   BST chain;
+   for (int i = 0; i < 5000; ++i) {
+      chain.insert(i);
+   }
+   chain.rebalance();
+   ASSERT_EQUAL(chain.height(), 13u);
+   for (int i = 0; i < 5000; i += 3) {
+      chain.erase(i);
+   }
+   string shape = chain.to_string();
+   chain.compact();
+   ASSERT_EQUAL(chain.to_string(), shape);
+   ASSERT_TRUE(chain.check_sorting_invariant());
+   const char *first = reinterpret_cast<const char *>(&*chain.begin());
+   const char *second = reinterpret_cast<const char *>(&*chain.select(1));
+   ptrdiff_t stride = second - first;
+   int index = 0;
+   for (const int &elt : chain) {
+      ASSERT_EQUAL(reinterpret_cast<const char *>(&elt) - first,
+                   index++ * stride);
+   }
+   chain.insert(0);
+   ASSERT_EQUAL(chain.size(), 3334u);
+
+   // AVL trees, strings and compact nodes
+   BinarySearchTree<string, less<>, CompactNodes<AVLBalanced>> words;
+   for (int i = 0; i < 1000; ++i) {
+      words.insert(to_string(i * 7919 % 1000));
+   }
+   words.rebalance();
+   ASSERT_EQUAL(words.height(), 10u);
+   words.compact();
+   ASSERT_EQUAL(words.size(), 1000u);
+   ASSERT_TRUE(words.check_sorting_invariant());
+   ASSERT_EQUAL(*words.find("999"), "999");
+   words.erase("500");
+   ASSERT_EQUAL(*words.insert("500"), "500");
+   ASSERT_EQUAL(words.size(), 1000u);
+}
+
+TEST(test_for_each_parallel) {
+   AVL tree;
+   for (int i = 0; i < 100000; ++i) {
+      tree.insert(i);
+   }
+   int expected = 0;
+   bool in_order = true;
+   tree.for_each([&](int elt) { in_order = in_order && elt == expected++; });
+   ASSERT_TRUE(in_order);
+   ASSERT_EQUAL(expected, 100000);
+
+   for (size_t threads : {0, 1, 3, 8}) {
+      atomic<long long> total(0);
+      atomic<int> visits(0);
+      tree.parallel_for_each([&](int elt) {
+         total += elt;
+         ++visits;
+      }, threads);
+      ASSERT_EQUAL(total.load(), 4999950000LL);
+      ASSERT_EQUAL(visits.load(), 100000);
+      long long sum = tree.parallel_reduce(
+         0LL, [](int elt) { return static_cast<long long>(elt); },
+         [](long long a, long long b) { return a + b; }, threads);
+      ASSERT_EQUAL(sum, 4999950000LL);
+   }
+   bool all_even = tree.parallel_reduce(
+      true, [](int elt) { return elt % 2 == 0; },
+      [](bool a, bool b) { return a && b; }, 4);
+   ASSERT_FALSE(all_even);
+
+   // chains and tiny trees
+   BST chain;
+   for (int i = 0; i < 3000; ++i) {
+      chain.insert(i);
+   }
+   int largest = chain.parallel_reduce(
+      -1, [](int elt) { return elt; },
+      [](int a, int b) { return a > b ? a : b; }, 4);
+   ASSERT_EQUAL(largest, 2999);
+   BST empty;
+   ASSERT_EQUAL(empty.parallel_reduce(7, [](int elt) { return elt; },
+                                      [](int a, int b) { return a + b; }, 4),
+                7);
+   BST one;
+   one.insert(5);
+   ASSERT_EQUAL(one.parallel_reduce(0, [](int elt) { return elt; },
+                                    [](int a, int b) { return a + b; }, 4),
+                5);
+
+   // exceptions reach the caller
+   bool caught = false;
+   try {
+      tree.parallel_for_each([](int elt) {
+         if (elt == 777) { throw runtime_error("777"); }
+      }, 4);
+   }
+   catch (const runtime_error &error) {
+      caught = string(error.what()) == "777";
+   }
+   ASSERT_TRUE(caught);
+}
+
+TEST(test_instrumented) {
+   BinarySearchTree<int, less<int>, Instrumented<Unbalanced>> tree;
+   for (int i : {2, 1, 3}) {
+      tree.insert(i);
+   }
+   ASSERT_EQUAL(*tree.find(3), 3);
+   ASSERT_TRUE(tree.find(0) == tree.end());
+   const auto &stats = tree.stats();
+   // the inserts reach depths 0, 1 and 1, find(3) 2, and find(0) misses
+   // after 2 and 1
+   ASSERT_EQUAL(stats.searches, 5u);
+   ASSERT_EQUAL(stats.nodes_visited, 6u);
+   ASSERT_TRUE(stats.depth_histogram == vector<size_t>({1, 2, 2}));
+   ASSERT_EQUAL(stats.allocations, 3u);
+   ASSERT_EQUAL(stats.redescents, 0u);
+   ASSERT_EQUAL(stats.comparisons, 1u + 2u + 4u + 2u);
+
+   // a good hint skips the search, a bad one falls back on it
+   tree.insert(tree.end(), 4);
+   ASSERT_EQUAL(stats.searches, 5u);
+   tree.insert(tree.begin(), 10);
+   ASSERT_EQUAL(stats.searches, 6u);
+   ASSERT_EQUAL(stats.redescents, 1u);
+   ASSERT_EQUAL(stats.allocations, 5u);
+
+   // a copy counts its own work; a move takes the counts along
+   auto copy(tree);
+   ASSERT_EQUAL(copy.stats().allocations, 5u);
+   ASSERT_EQUAL(copy.stats().searches, 0u);
+   auto moved(std::move(tree));
+   ASSERT_EQUAL(moved.stats().redescents, 1u);
+   moved.reset_stats();
+   ASSERT_EQUAL(moved.stats().comparisons, 0u);
+   ASSERT_TRUE(moved.stats().depth_histogram.empty());
+   ASSERT_TRUE(moved.check_sorting_invariant());
+   ASSERT_EQUAL(moved.stats().searches, 0u);
+
+   ostringstream oss;
+   oss << copy.stats();
+   ASSERT_EQUAL(oss.str(), "comparisons 0 searches 0 nodes visited 0 "
+                "(0 per search) allocations 5 redescents 0 depths [ ]");
+
+   // either order of wrappers; growing the node array counts as moving
+   // every node into a new one
+   BinarySearchTree<int, less<int>, CompactNodes<Instrumented<AVLBalanced>>>
+      compact;
+   BinarySearchTree<int, less<int>, Instrumented<CompactNodes<AVLBalanced>>>
+      same;
+   for (int i = 0; i < 17; ++i) {
+      compact.insert(i);
+      same.insert(i);
+   }
+   ASSERT_EQUAL(compact.stats().allocations, 33u);
+   ASSERT_EQUAL(same.stats().allocations, 33u);
+   ASSERT_EQUAL(compact.stats().searches, 17u);
+}
+
+TEST(test_to_string_depth_and_dot) {
+   BST tree;
+   for (int i : {2, 1, 3}) {
+      tree.insert(i);
+   }
+   ASSERT_EQUAL(tree.to_string(2), tree.to_string());
+   ASSERT_EQUAL(tree.to_string(1),
+                "\n              2            "
+                "\n           /   \\           "
+                "\n         ...   ...         "
+                "\n                           "
+                "\n                           ");
+   ASSERT_EQUAL(BST().to_string(0), "( )");
+
+   ostringstream dot;
+   tree.insert(4);
+   tree.to_dot(dot);
+   ASSERT_EQUAL(dot.str(), "digraph BinarySearchTree {\n"
+                           "  node [shape=box];\n"
+                           "  n0 [label=\"2\"];\n"
+                           "  n0:sw -> n1;\n"
+                           "  n0:se -> n2;\n"
+                           "  n1 [label=\"1\"];\n"
+                           "  n2 [label=\"3\"];\n"
+                           "  n2:se -> n3;\n"
+                           "  n3 [label=\"4\"];\n"
+                           "}\n");
+   BinarySearchTree<string> quoted;
+   quoted.insert("say \"hi\\\"");
+   ostringstream quoted_dot;
+   quoted.to_dot(quoted_dot);
+   ASSERT_TRUE(quoted_dot.str().find("[label=\"say \\\"hi\\\\\\\"\"]") !=
+               string::npos);
+
+   // a chain far too tall to draw whole
+   BST chain;
+   for (int i = 0; i < 5000; ++i) {
+      chain.insert(i);
+   }
+   string top = chain.to_string(3);
+   ASSERT_TRUE(top.find("...") != string::npos);
+   ASSERT_TRUE(top.find("3") == string::npos);
+   ASSERT_TRUE(top.size() < 1000u);
+   ostringstream chain_dot;
+   chain.to_dot(chain_dot);
+   ASSERT_TRUE(chain_dot.str().find("n4998:se -> n4999;") != string::npos);
+
+   // a chain taller than 32 levels, drawn whole or to any depth, is cut
+   // off below 16 levels
+   BST tall;
+   for (int i = 0; i < 40; ++i) {
+      tall.insert(i);
+   }
+   string drawn = tall.to_string();
+   ASSERT_EQUAL(tall.to_string(1000), drawn);
+   ASSERT_EQUAL(tall.to_string(16), drawn);
+   ASSERT_TRUE(drawn.find("15") != string::npos);
+   ASSERT_TRUE(drawn.find("16") == string::npos);
+   ASSERT_TRUE(drawn.find("...") != string::npos);
+}
+
+// An empty comparator that cannot be a base class.
+struct Final_less final {
+   bool operator()(int a, int b) const {
+      return a > b;
+   }
+};
+
+TEST(test_lightweight_iterators) {
+   ASSERT_EQUAL(sizeof(BST::Iterator), sizeof(void *));
+   ASSERT_TRUE(is_trivially_copyable<BST::Iterator>::value);
+   ASSERT_EQUAL(sizeof(BinarySearchTree<Duck, DuckWealthLess>::Iterator),
+                sizeof(void *));
+   // an empty comparator takes no room in the tree
+   ASSERT_EQUAL(sizeof(BST), sizeof(BinarySearchTree<int, Final_less>) -
+                             sizeof(void *));
+
+   BinarySearchTree<int, Final_less> descending;
+   for (int i = 0; i < 10; ++i) {
+      descending.insert(i);
+   }
+   ASSERT_EQUAL(*descending.begin(), 9);
+   ASSERT_EQUAL(*descending.find(4), 4);
+   ASSERT_TRUE(descending.check_sorting_invariant());
+
+   // iterators outlive moves and swaps of the tree they point into
+   AVL tree;
+   for (int i = 0; i < 100; ++i) {
+      tree.insert(i);
+   }
+   vector<AVL::Iterator> found;
+   for (int i = 0; i < 100; i += 10) {
+      found.push_back(tree.find(i));
+   }
+   AVL moved(std::move(tree));
+   AVL other;
+   other.swap(moved);
+   auto it = found[3];
+   ASSERT_EQUAL(*it++, 30);
+   ASSERT_EQUAL(*it, 31);
+   ASSERT_TRUE(found[0] == other.begin());
+   ASSERT_TRUE(other.find(-1) == other.end());
+}
+
+TEST(test_reverse_iteration) {
+   AVL tree;
+   ASSERT_TRUE(tree.rbegin() == tree.rend());
+   for (int i = 0; i < 1000; ++i) {
+      tree.insert(i * 7919 % 1000);
+   }
+   auto last = tree.end();
+   --last;
+   ASSERT_TRUE(last == tree.max_element());
+   auto past = last;
+   ++past;
+   ASSERT_TRUE(past == tree.end());
+   ASSERT_EQUAL(*--past, 999);
+
+   int expected = 999;
+   for (auto it = tree.rbegin(); it != tree.rend(); ++it) {
+      ASSERT_EQUAL(*it, expected--);
+   }
+   ASSERT_EQUAL(expected, -1);
+   auto it = tree.find(500);
+   ASSERT_EQUAL(*it--, 500);
+   ASSERT_EQUAL(*it, 499);
+   ASSERT_EQUAL(*--tree.lower_bound(2000), 999);
+   ASSERT_EQUAL(*--tree.find(-5), 999);
+
+   // end() still works after the root changes, and after a move
+   auto end = tree.end();
+   for (int i = 1000; i < 1100; ++i) {
+      tree.insert(i);
+   }
+   tree.erase(tree.find(0));
+   ASSERT_EQUAL(*--tree.end(), 1099);
+   AVL moved(std::move(tree));
+   ASSERT_TRUE(end == moved.end());
+   ASSERT_EQUAL(*--moved.end(), 1099);
+
+   // the last few elements of a chain, and the first from the end
+   BST chain;
+   for (int i = 0; i < 3000; ++i) {
+      chain.insert(i);
+   }
+   vector<int> top;
+   for (auto top_it = chain.rbegin(); top.size() < 3; ++top_it) {
+      top.push_back(*top_it);
+   }
+   ASSERT_TRUE(top == vector<int>({2999, 2998, 2997}));
+   ASSERT_EQUAL(*prev(chain.end(), 3000), 0);
+}
+
+TEST(test_save_load) {
+   AVL tree;
+   for (int i = 0; i < 1000; ++i) {
+      tree.insert(i * 7919 % 1000);
+   }
+   tree.save("BinarySearchTree_tests.snap");
+
+   // loading replaces the contents with a balanced tree of the same keys
+   AVL loaded;
+   loaded.insert(-1);
+   loaded.load("BinarySearchTree_tests.snap");
+   ASSERT_EQUAL(loaded.size(), 1000u);
+   ASSERT_EQUAL(loaded.height(), 10u);
+   ASSERT_TRUE(loaded.check_sorting_invariant());
+   int expected = 0;
+   for (int elt : loaded) {
+      ASSERT_EQUAL(elt, expected++);
+   }
+   loaded.insert(1000);
+   ASSERT_EQUAL(*--loaded.end(), 1000);
+
+   // a failed load leaves the tree alone
+   BSTring words;
+   words.insert("kiwi");
+   bool threw = false;
+   try {
+      words.load("BinarySearchTree_tests.snap");
+   }
+   catch (const snapshot_exception &) {
+      threw = true;
+   }
+   ASSERT_TRUE(threw);
+   ASSERT_EQUAL(words.size(), 1u);
+
+   BSTring().save("BinarySearchTree_tests.snap");
+   words.load("BinarySearchTree_tests.snap");
+   ASSERT_TRUE(words.empty());
+
+   // doubles do not load as longs, though they take as many bytes
+   BinarySearchTree<double> doubles;
+   doubles.insert(1.5);
+   doubles.save("BinarySearchTree_tests.snap");
+   BinarySearchTree<long> longs;
+   threw = false;
+   try {
+      longs.load("BinarySearchTree_tests.snap");
+   }
+   catch (const snapshot_exception &) {
+      threw = true;
+   }
+   ASSERT_TRUE(threw);
+   ASSERT_TRUE(longs.empty());
+
+   // nor do elements saved under another order
+   tree.save("BinarySearchTree_tests.snap");
+   BinarySearchTree<int, greater<int>> reversed;
+   threw = false;
+   try {
+      reversed.load("BinarySearchTree_tests.snap");
+   }
+   catch (const snapshot_exception &) {
+      threw = true;
+   }
+   ASSERT_TRUE(threw);
+   ASSERT_TRUE(reversed.empty());
+   remove("BinarySearchTree_tests.snap");
+}
+
+TEST(test_split_join_reuses_slots) {
+   using PmrTree = BinarySearchTree<int, less<int>, AVLBalanced,
+                                    pmr::polymorphic_allocator<int>>;
+   CountingResource resource;
+   PmrTree tree(&resource);
+   for (int i = 0; i < 1000; ++i) {
+      tree.insert(i);
+   }
+   size_t steady_bytes = 0;
+   for (int round = 0; round < 200; ++round) {
+      PmrTree upper = tree.split(500 + round % 3);
+      tree.join(upper);
+      if (round == 0) {
+         steady_bytes = resource.live_bytes;
+      }
+      ASSERT_EQUAL(resource.live_bytes, steady_bytes);
+   }
+   ASSERT_TRUE(holds_range(tree, 0, 1000));
+   ASSERT_TRUE(tree.check_sorting_invariant());
+}
+
 TEST_MAIN()
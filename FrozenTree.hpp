@@ -0,0 +1,382 @@
+#ifndef FROZEN_TREE_HPP
+#define FROZEN_TREE_HPP
+/* FrozenTree.hpp
+ *
+ * Immutable snapshot of a BinarySearchTree or Map laid out in one array
+ * in Eytzinger (breadth-first) order for fast lookups
+ */
+
+#include <algorithm> //min
+#include <cstddef>  //size_t, max_align_t
+#include <functional> //less
+#include <iostream> //ostream
+#include <memory>   //shared_ptr
+#include <string>
+#include <utility>  //move, pair
+#include <vector>
+#include "Snapshot.hpp"
+
+template <typename T,
+          typename Compare=std::less<T> // default if argument isn't provided
+         >
+class FrozenTree {
+
+  // OVERVIEW: A FrozenTree is a read-only copy of a sorted set of
+  // elements, such as the one BinarySearchTree::freeze() or Map::freeze()
+  // returns. It offers the lookups and iteration of BinarySearchTree, but
+  // cannot be modified.
+  //
+  // The elements form a perfectly balanced binary search tree with no
+  // pointers: the root is element 1, and the children of element k are
+  // elements 2k and 2k + 1 (the Eytzinger, or breadth-first, layout), all
+  // in one array. A search walks down it computing the next index from
+  // each comparison instead of branching on it, so it never mispredicts,
+  // and the top levels, which every search visits, share a few cache
+  // lines. The nodes the search may reach a few levels further down are
+  // contiguous in the array too, so each step prefetches them while the
+  // current comparison is under way, hiding most of the memory latency
+  // of a large tree.
+  //
+  // That array is also the body of a snapshot file (see Snapshot.hpp), so
+  // a FrozenTree is saved by writing it out, and a FrozenTree of elements
+  // stored as raw bytes is loaded by mapping the file into memory and
+  // searching the mapped pages directly. Copies of a FrozenTree share its
+  // array.
+
+public:
+
+  // Bytes fetched from memory at a time.
+  static constexpr size_t c_cache_line_bytes = 64;
+
+  // Default constructor: an empty snapshot.
+  FrozenTree() { }
+
+  // REQUIRES: [first, last) is a forward range of elements in strictly
+  //           increasing order according to Compare
+  // EFFECTS:  Creates a snapshot holding copies of the elements.
+  template <typename Iter>
+  FrozenTree(Iter first, Iter last) {
+    std::vector<const T *> by_index = by_index_impl(first, last);
+    auto elements = std::make_shared<std::vector<T>>();
+    elements->reserve(by_index.size() - 1);
+    for (size_t k = 1; k < by_index.size(); ++k) {
+      elements->push_back(*by_index[k]);
+    }
+    own_impl(std::move(elements));
+  }
+
+  // REQUIRES: [first, last) is a forward range of elements in strictly
+  //           increasing order according to Compare
+  // EFFECTS:  Writes a snapshot of the elements to the file at path, the
+  //           same file save() writes for a FrozenTree of them, without
+  //           copying them. Throws snapshot_exception on failure.
+  template <typename Iter>
+  static void save_sorted(const std::string &path, Iter first, Iter last) {
+    std::vector<const T *> by_index = by_index_impl(first, last);
+    write_snapshot<T>(path, by_index.size() - 1,
+                      [&](size_t k) -> const T & { return *by_index[k]; });
+  }
+
+  // EFFECTS: Writes a snapshot of this tree to the file at path, replacing
+  //          it (see Snapshot.hpp for the format). Throws
+  //          snapshot_exception on failure.
+  void save(const std::string &path) const {
+    write_snapshot<T>(path, n,
+                      [&](size_t k) -> const T & { return data[k - 1]; });
+  }
+
+  // EFFECTS: Returns the FrozenTree saved in the file at path. If T is
+  //          stored as raw bytes (see Snapshot.hpp), the file is mapped
+  //          into memory and searched in place rather than copied;
+  //          otherwise the elements are decoded into memory. Either way
+  //          it takes linear time to check that the elements are in
+  //          strictly increasing order according to Compare. Throws
+  //          snapshot_exception if the file is missing, of another format
+  //          version or element type, truncated, or out of order (e.g.
+  //          saved under another Compare).
+  static FrozenTree load(const std::string &path) {
+    std::shared_ptr<const Snapshot_file> file =
+      Snapshot_file::open<T>(path);
+    const size_t count = size_t(file->header().count);
+    FrozenTree frozen;
+    if constexpr (Snapshot_codec<T>::c_raw) {
+      static_assert(alignof(T) <= alignof(std::max_align_t),
+                    "mapped elements are aligned like std::max_align_t");
+      frozen.data = reinterpret_cast<const T *>(file->payload());
+      frozen.n = count;
+      frozen.storage = std::move(file);
+    }
+    else {
+      const char *p = file->payload();
+      const char *end = p + file->header().payload_bytes;
+      auto elements = std::make_shared<std::vector<T>>();
+      // A corrupt count cannot make this reserve more than the file holds
+      elements->reserve(std::min(count, size_t(end - p)));
+      for (size_t k = 0; k < count; ++k) {
+        elements->push_back(Snapshot_codec<T>::read(p, end));
+      }
+      frozen.own_impl(std::move(elements));
+    }
+    frozen.check_order_impl();
+    return frozen;
+  }
+
+  // EFFECTS: Returns whether this snapshot is empty.
+  bool empty() const {
+    return n == 0;
+  }
+
+  // EFFECTS: Returns the number of elements in this snapshot.
+  size_t size() const {
+    return n;
+  }
+
+  class Iterator {
+    // OVERVIEW: Iterator interface for FrozenTree. Iterates over the
+    //           elements in ascending order, which is the in-order walk of
+    //           the implicit tree, in amortized constant time per step.
+
+  public:
+    Iterator()
+      : data(nullptr), n(0), index(0) { }
+
+    const T &operator*() const {
+      return data[index - 1];
+    }
+
+    const T *operator->() const {
+      return &data[index - 1];
+    }
+
+    // Prefix ++
+    Iterator &operator++() {
+      index = next_index_impl(index, n);
+      return *this;
+    }
+
+    // Postfix ++ (implemented in terms of prefix ++)
+    Iterator operator++(int) {
+      Iterator result(*this);
+      ++(*this);
+      return result;
+    }
+
+    bool operator==(const Iterator &rhs) const {
+      return index == rhs.index;
+    }
+
+    bool operator!=(const Iterator &rhs) const {
+      return index != rhs.index;
+    }
+
+  private:
+    friend class FrozenTree;
+
+    const T *data;
+    size_t n;
+    size_t index; // 1-based; 0 past the end
+
+    Iterator(const T *data_in, size_t n_in, size_t index_in)
+      : data(data_in), n(n_in), index(index_in) { }
+  }; // FrozenTree::Iterator
+  ////////////////////////////////////////
+
+  // EFFECTS : Returns an iterator to the first element in this snapshot.
+  Iterator begin() const {
+    return iterator_at(first_index_impl(size()));
+  }
+
+  // EFFECTS: Returns an iterator to past-the-end.
+  Iterator end() const {
+    return Iterator();
+  }
+
+  // EFFECTS: Returns an Iterator to the element equivalent to query, or an
+  //          end Iterator if there is none.
+  Iterator find(const T &query) const {
+    return find_impl(query);
+  }
+
+  // EFFECTS: Same as find(const T &), for any query type K the Compare
+  //          functor compares against T directly. Only available when
+  //          Compare is transparent (declares is_transparent).
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Iterator find(const K &query) const {
+    return find_impl(query);
+  }
+
+  // EFFECTS: Returns an Iterator to the first element that is not less
+  //          than query, or an end Iterator if there is none.
+  Iterator lower_bound(const T &query) const {
+    return iterator_at(bound_impl<false>(query));
+  }
+
+  // EFFECTS: Same as lower_bound(const T &), for any query type K the
+  //          Compare functor compares against T directly. Only available
+  //          when Compare is transparent (see find).
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Iterator lower_bound(const K &query) const {
+    return iterator_at(bound_impl<false>(query));
+  }
+
+  // EFFECTS: Returns an Iterator to the first element that is greater
+  //          than query, or an end Iterator if there is none.
+  Iterator upper_bound(const T &query) const {
+    return iterator_at(bound_impl<true>(query));
+  }
+
+  // EFFECTS: Same as upper_bound(const T &), for any query type K the
+  //          Compare functor compares against T directly. Only available
+  //          when Compare is transparent (see find).
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Iterator upper_bound(const K &query) const {
+    return iterator_at(bound_impl<true>(query));
+  }
+
+private:
+
+  // DATA REPRESENTATION
+  // Element k (1-based) of the implicit tree is data[k - 1], for k from 1
+  // to n. The array belongs to 'storage': a std::vector of the elements,
+  // or a mapped Snapshot_file.
+  std::shared_ptr<const void> storage;
+  const T *data = nullptr;
+  size_t n = 0;
+
+  // An instance of the Compare type. Use this to compare elements.
+  Compare less;
+
+  // Elements per cache line, and that rounded down to a power of two (at
+  // most 16): the descendants of k this many times further down start at
+  // index k * c_prefetch_stride and fill about one cache line.
+  static constexpr size_t c_per_line =
+    sizeof(T) >= c_cache_line_bytes ? 1 : c_cache_line_bytes / sizeof(T);
+  static constexpr size_t c_prefetch_stride =
+    c_per_line >= 16 ? 16 : c_per_line >= 8 ? 8
+    : c_per_line >= 4 ? 4 : c_per_line >= 2 ? 2 : 1;
+
+  Iterator iterator_at(size_t index) const {
+    return Iterator(data, n, index);
+  }
+
+  // MODIFIES: this FrozenTree
+  // EFFECTS:  Makes elements the array of this FrozenTree.
+  void own_impl(std::shared_ptr<std::vector<T>> elements) {
+    data = elements->data();
+    n = elements->size();
+    storage = std::move(elements);
+  }
+
+  // EFFECTS: Throws snapshot_exception unless each element, in order, is
+  //          less than the next.
+  void check_order_impl() const {
+    const T *prev = nullptr;
+    for (size_t k = first_index_impl(n); k != 0; k = next_index_impl(k, n)) {
+      if (prev && !less(*prev, data[k - 1])) {
+        throw snapshot_exception("snapshot out of order");
+      }
+      prev = &data[k - 1];
+    }
+  }
+
+  // EFFECTS: Returns pointers to the elements of the sorted range
+  //          [first, last) in the order of the array: the element for
+  //          index k (1 to the number of elements) is at k, found by
+  //          walking the indices in order.
+  template <typename Iter>
+  static std::vector<const T *> by_index_impl(Iter first, Iter last) {
+    size_t count = 0;
+    for (Iter it = first; it != last; ++it) {
+      ++count;
+    }
+    std::vector<const T *> by_index(count + 1);
+    for (size_t k = first_index_impl(count); k != 0;
+         k = next_index_impl(k, count)) {
+      by_index[k] = &*first;
+      ++first;
+    }
+    return by_index;
+  }
+
+  template <typename K>
+  Iterator find_impl(const K &query) const {
+    size_t index = bound_impl<false>(query);
+    if (index == 0 || less(query, data[index - 1])) {
+      return end();
+    }
+    return iterator_at(index);
+  }
+
+  // EFFECTS: Returns the index of the first element not less than query
+  //          (or, if 'upper', greater than it), or 0 if there is none.
+  // NOTE:    The loop goes down one level per comparison, to the right
+  //          child if the element is before the bound and to the left
+  //          otherwise, computing the index rather than branching. Where
+  //          it falls off the bottom, the bits after the last 0 of the
+  //          index record the final run of right turns; dropping them and
+  //          that 0 leads back to the last node where it turned left,
+  //          which is the answer.
+  template <bool upper, typename K>
+  size_t bound_impl(const K &query) const {
+    size_t k = 1;
+    while (k <= n) {
+      prefetch_impl(data, k * c_prefetch_stride, n);
+      bool before = upper ? !less(query, data[k - 1])
+                          : less(data[k - 1], query);
+      k = 2 * k + before;
+    }
+    for (; k & 1; k >>= 1) { }
+    return k >> 1;
+  }
+
+  // EFFECTS: Hints to the processor that the element at 'index' will be
+  //          read soon, if there is one.
+  static void prefetch_impl(const T *data, size_t index, size_t n) {
+#if defined(__GNUC__)
+    __builtin_prefetch(data + (index <= n ? index - 1 : 0));
+#else
+    (void)data; (void)index; (void)n;
+#endif
+  }
+
+  // EFFECTS: Returns the index of the first element in order in a tree
+  //          of n elements, or 0 if it is empty.
+  static size_t first_index_impl(size_t n) {
+    if (n == 0) { return 0; }
+    size_t k = 1;
+    for (; 2 * k <= n; k *= 2) { }
+    return k;
+  }
+
+  // EFFECTS: Returns the index of the element after the one at index k in
+  //          a tree of n elements, or 0 if it is the last: the leftmost
+  //          element of its right subtree, or else the nearest ancestor
+  //          that has it in its left subtree.
+  static size_t next_index_impl(size_t k, size_t n) {
+    if (2 * k + 1 <= n) {
+      for (k = 2 * k + 1; 2 * k <= n; k *= 2) { }
+      return k;
+    }
+    for (; k & 1; k >>= 1) { }
+    return k >> 1;
+  }
+
+}; // END of FrozenTree class
+
+// MODIFIES: os
+// EFFECTS : Prints the elements of the snapshot to the given ostream, like
+//           operator<< for BinarySearchTree: [ 3 5 7 ]
+template <typename T, typename Compare>
+std::ostream &operator<<(std::ostream &os,
+                         const FrozenTree<T, Compare> &tree) {
+  os << "[ ";
+  for (const T& elt : tree) {
+    os << elt << " ";
+  }
+  return os << "]";
+}
+
+#endif // FROZEN_TREE_HPP
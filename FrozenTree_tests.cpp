@@ -0,0 +1,294 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "BinarySearchTree.hpp"
+#include "FrozenTree.hpp"
+#include "unit_test_framework.hpp"
+
+using namespace std;
+
+
+TEST(test_empty) {
+   FrozenTree<int> frozen;
+   ASSERT_TRUE(frozen.empty());
+   ASSERT_EQUAL(frozen.size(), 0u);
+   ASSERT_TRUE(frozen.begin() == frozen.end());
+   ASSERT_TRUE(frozen.find(1) == frozen.end());
+   ASSERT_TRUE(frozen.lower_bound(1) == frozen.end());
+
+   BinarySearchTree<int> tree;
+   ASSERT_TRUE(tree.freeze().empty());
+}
+
+TEST(test_every_size) {
+   // every shape of the last level, from empty to full, and a bit beyond
+   for (int n = 0; n <= 70; ++n) {
+      vector<int> odds;
+      for (int i = 0; i < n; ++i) {
+         odds.push_back(2 * i + 1);
+      }
+      FrozenTree<int> frozen(odds.begin(), odds.end());
+      ASSERT_EQUAL(frozen.size(), static_cast<size_t>(n));
+
+      int expected = 1;
+      for (int elt : frozen) {
+         ASSERT_EQUAL(elt, expected);
+         expected += 2;
+      }
+      ASSERT_EQUAL(expected, 2 * n + 1);
+
+      for (int query = 0; query <= 2 * n + 1; ++query) {
+         auto found = frozen.find(query);
+         auto lower = frozen.lower_bound(query);
+         auto upper = frozen.upper_bound(query);
+         int next_odd = query % 2 ? query : query + 1;
+         int after = query % 2 ? query + 2 : query + 1;
+         if (query % 2 && query < 2 * n) {
+            ASSERT_EQUAL(*found, query);
+         }
+         else {
+            ASSERT_TRUE(found == frozen.end());
+         }
+         if (next_odd < 2 * n) {
+            ASSERT_EQUAL(*lower, next_odd);
+         }
+         else {
+            ASSERT_TRUE(lower == frozen.end());
+         }
+         if (after < 2 * n) {
+            ASSERT_EQUAL(*upper, after);
+         }
+         else {
+            ASSERT_TRUE(upper == frozen.end());
+         }
+      }
+   }
+}
+
+TEST(test_freeze_tree) {
+   BinarySearchTree<string, less<>> tree;
+   for (const char *word : {"kiwi", "apple", "fig", "date", "lime"}) {
+      tree.insert(word);
+   }
+   FrozenTree<string, less<>> frozen = tree.freeze();
+   tree.insert("zucchini");
+   tree.erase("fig");
+
+   ostringstream oss;
+   oss << frozen;
+   ASSERT_EQUAL(oss.str(), "[ apple date fig kiwi lime ]");
+   ASSERT_EQUAL(*frozen.find(string_view("fig")), "fig");
+   ASSERT_TRUE(frozen.find("zucchini") == frozen.end());
+   ASSERT_EQUAL(*frozen.upper_bound("date"), "fig");
+}
+
+TEST(test_save_load_snapshot) {
+   const int n = 1000;
+   vector<int> odds;
+   for (int i = 0; i < n; ++i) {
+      odds.push_back(2 * i + 1);
+   }
+   FrozenTree<int> frozen(odds.begin(), odds.end());
+   frozen.save("FrozenTree_tests.snap");
+
+   // ints are mapped and searched in place
+   FrozenTree<int> loaded = FrozenTree<int>::load("FrozenTree_tests.snap");
+   ASSERT_EQUAL(loaded.size(), size_t(n));
+   auto expected = odds.begin();
+   for (int elt : loaded) {
+      ASSERT_EQUAL(elt, *expected++);
+   }
+   for (int query = 0; query <= 2 * n; ++query) {
+      if (query < 2 * n) {
+         ASSERT_EQUAL(*loaded.lower_bound(query), query | 1);
+      }
+      else {
+         ASSERT_TRUE(loaded.lower_bound(query) == loaded.end());
+      }
+   }
+   FrozenTree<int> copy = loaded;
+   loaded = FrozenTree<int>();
+   ASSERT_EQUAL(*copy.find(777), 777);
+
+   // save_sorted writes the same file from a sorted range
+   FrozenTree<int>::save_sorted("FrozenTree_tests.snap", odds.begin(),
+                                odds.begin() + 10);
+   copy = FrozenTree<int>::load("FrozenTree_tests.snap");
+   ostringstream oss;
+   oss << copy;
+   ASSERT_EQUAL(oss.str(), "[ 1 3 5 7 9 11 13 15 17 19 ]");
+
+   // strings are decoded
+   BinarySearchTree<string> words;
+   for (const char *word : {"kiwi", "", "fig", "date", "lime"}) {
+      words.insert(word);
+   }
+   words.freeze().save("FrozenTree_tests.snap");
+   FrozenTree<string> strings =
+      FrozenTree<string>::load("FrozenTree_tests.snap");
+   oss.str("");
+   oss << strings;
+   ASSERT_EQUAL(oss.str(), "[  date fig kiwi lime ]");
+   ASSERT_EQUAL(*strings.find("fig"), "fig");
+   ASSERT_TRUE(strings.find("") == strings.begin());
+
+   // the file of strings does not load as ints
+   bool threw = false;
+   try {
+      FrozenTree<int>::load("FrozenTree_tests.snap");
+   }
+   catch (const snapshot_exception &) {
+      threw = true;
+   }
+   ASSERT_TRUE(threw);
+
+   // nor does a truncated file, or a missing one
+   string bytes;
+   {
+      ifstream fin("FrozenTree_tests.snap", ios::binary);
+      bytes.assign(istreambuf_iterator<char>(fin),
+                   istreambuf_iterator<char>());
+   }
+   {
+      ofstream fout("FrozenTree_tests.snap", ios::binary | ios::trunc);
+      fout.write(bytes.data(), bytes.size() - 3);
+   }
+   threw = false;
+   try {
+      FrozenTree<string>::load("FrozenTree_tests.snap");
+   }
+   catch (const snapshot_exception &) {
+      threw = true;
+   }
+   ASSERT_TRUE(threw);
+   remove("FrozenTree_tests.snap");
+   threw = false;
+   try {
+      FrozenTree<string>::load("FrozenTree_tests.snap");
+   }
+   catch (const snapshot_exception &) {
+      threw = true;
+   }
+   ASSERT_TRUE(threw);
+}
+
+// EFFECTS: Returns whether loading the snapshot at path as a
+//          FrozenTree<T> throws snapshot_exception.
+template <typename T>
+bool load_throws(const string &path) {
+   try {
+      FrozenTree<T>::load(path);
+   }
+   catch (const snapshot_exception &) {
+      return true;
+   }
+   return false;
+}
+
+TEST(test_snapshot_element_types) {
+   // types of the same size and alignment are still told apart
+   vector<double> doubles = {0.5, 1.5, 2.5};
+   FrozenTree<double>::save_sorted("FrozenTree_tests.snap", doubles.begin(),
+                                   doubles.end());
+   ASSERT_TRUE(load_throws<long long>("FrozenTree_tests.snap"));
+   ASSERT_TRUE(load_throws<unsigned long long>("FrozenTree_tests.snap"));
+   ASSERT_TRUE((load_throws<pair<int, int>>("FrozenTree_tests.snap")));
+   ASSERT_FALSE(load_throws<double>("FrozenTree_tests.snap"));
+
+   vector<int> ints = {1, 2, 3};
+   FrozenTree<int>::save_sorted("FrozenTree_tests.snap", ints.begin(),
+                                ints.end());
+   ASSERT_TRUE(load_throws<float>("FrozenTree_tests.snap"));
+   ASSERT_TRUE(load_throws<unsigned>("FrozenTree_tests.snap"));
+   ASSERT_FALSE(load_throws<int>("FrozenTree_tests.snap"));
+
+   vector<pair<int, float>> pairs = {{1, 0.5f}, {2, 0.5f}};
+   FrozenTree<pair<int, float>>::save_sorted("FrozenTree_tests.snap",
+                                             pairs.begin(), pairs.end());
+   ASSERT_TRUE((load_throws<pair<int, int>>("FrozenTree_tests.snap")));
+   ASSERT_TRUE((load_throws<pair<float, int>>("FrozenTree_tests.snap")));
+   ASSERT_TRUE(load_throws<long long>("FrozenTree_tests.snap"));
+   FrozenTree<pair<int, float>> loaded =
+      FrozenTree<pair<int, float>>::load("FrozenTree_tests.snap");
+   ASSERT_EQUAL(loaded.begin()->second, 0.5f);
+   remove("FrozenTree_tests.snap");
+}
+
+TEST(test_snapshot_order) {
+   vector<int> ints;
+   for (int i = 0; i < 100; ++i) {
+      ints.push_back(i);
+   }
+   FrozenTree<int>::save_sorted("FrozenTree_tests.snap", ints.begin(),
+                                ints.end());
+   bool threw = false;
+   try {
+      FrozenTree<int, greater<int>>::load("FrozenTree_tests.snap");
+   }
+   catch (const snapshot_exception &) {
+      threw = true;
+   }
+   ASSERT_TRUE(threw);
+
+   // two elements swapped by hand
+   string bytes;
+   {
+      ifstream fin("FrozenTree_tests.snap", ios::binary);
+      bytes.assign(istreambuf_iterator<char>(fin),
+                   istreambuf_iterator<char>());
+   }
+   const size_t header_bytes = 64;
+   swap_ranges(bytes.begin() + header_bytes,
+               bytes.begin() + header_bytes + sizeof(int),
+               bytes.end() - sizeof(int));
+   {
+      ofstream fout("FrozenTree_tests.snap", ios::binary | ios::trunc);
+      fout.write(bytes.data(), bytes.size());
+   }
+   ASSERT_TRUE(load_throws<int>("FrozenTree_tests.snap"));
+
+   // repeated elements
+   vector<string> words = {"fig", "kiwi", "kiwi", "lime"};
+   FrozenTree<string>::save_sorted("FrozenTree_tests.snap", words.begin(),
+                                   words.end());
+   ASSERT_TRUE(load_throws<string>("FrozenTree_tests.snap"));
+   remove("FrozenTree_tests.snap");
+}
+
+TEST(test_save_over_mapped_snapshot) {
+   // saving over a file that a FrozenTree still maps leaves it intact
+   const int n = 100000;
+   vector<int> ints;
+   for (int i = 0; i < n; ++i) {
+      ints.push_back(i);
+   }
+   FrozenTree<int>::save_sorted("FrozenTree_tests.snap", ints.begin(),
+                                ints.end());
+   FrozenTree<int> old = FrozenTree<int>::load("FrozenTree_tests.snap");
+   FrozenTree<int>::save_sorted("FrozenTree_tests.snap", ints.begin(),
+                                ints.begin() + 1);
+   ASSERT_EQUAL(*old.find(n - 1), n - 1);
+   ASSERT_EQUAL(old.size(), size_t(n));
+   FrozenTree<int> now = FrozenTree<int>::load("FrozenTree_tests.snap");
+   ASSERT_EQUAL(now.size(), 1u);
+   ASSERT_TRUE(now.find(n - 1) == now.end());
+
+   // a save that cannot create its file throws
+   bool threw = false;
+   try {
+      FrozenTree<int>::save_sorted("no_such_directory/FrozenTree_tests.snap",
+                                   ints.begin(), ints.end());
+   }
+   catch (const snapshot_exception &) {
+      threw = true;
+   }
+   ASSERT_TRUE(threw);
+   remove("FrozenTree_tests.snap");
+}
+
+TEST_MAIN()
@@ -18,11 +18,38 @@
  */
 
 #include "BinarySearchTree.hpp"
+#include "BTree.hpp"
+#include "PersistentBinarySearchTree.hpp"
 #include <cassert>  //assert
-#include <utility>  //pair
+#include <iterator> //reverse_iterator
+#include <tuple>    //forward_as_tuple
+#include <utility>  //move, pair
+#include <vector>
+
+// The tree that stores a Map's pairs under each Balance policy: a
+// BinarySearchTree, except a BTree for BTreeBalanced and a
+// PersistentBinarySearchTree for Persistent.
+template <typename Pair, typename Compare, typename Balance,
+          typename Allocator>
+struct Map_tree {
+  using type = BinarySearchTree<Pair, Compare, Balance, Allocator>;
+};
+
+template <typename Pair, typename Compare, typename Allocator>
+struct Map_tree<Pair, Compare, BTreeBalanced, Allocator> {
+  using type = BTree<Pair, Compare, Allocator>;
+};
+
+// Nodes of a persistent tree come from std::make_shared, not Allocator.
+template <typename Pair, typename Compare, typename Allocator>
+struct Map_tree<Pair, Compare, Persistent, Allocator> {
+  using type = PersistentBinarySearchTree<Pair, Compare>;
+};
 
 template <typename Key_type, typename Value_type,
-          typename Key_compare=std::less<Key_type> // default argument
+          typename Key_compare=std::less<Key_type>, // default argument
+          typename Balance=Unbalanced, // see BinarySearchTree.hpp, BTree.hpp
+          typename Allocator=std::allocator<std::pair<Key_type, Value_type>>
          >
 class Map {
 
@@ -32,14 +59,37 @@ private:
   // See http://www.cplusplus.com/reference/utility/pair/
   using Pair_type = std::pair<Key_type, Value_type>;
 
-  // A custom comparator
+  // A custom comparator. Besides ordering two pairs by key, it compares
+  // a pair directly against a bare key, which lets the tree be searched
+  // by key without building a Pair_type for every lookup. It also names
+  // the key and its ordering, so that a BTree can keep the keys of a
+  // node apart from the pairs and search them with vector compares (see
+  // BTree_key_of).
   class PairComp {
     public:
+      using is_transparent = void;
+      using key_type = Key_type;
+      using key_compare = Key_compare;
+
+      static const Key_type &key(const Pair_type &pair) {
+        return pair.first;
+      }
+
       PairComp() {}
       bool operator() (const Pair_type &LHS, const Pair_type &RHS) const {
         Key_compare less;
         return less(LHS.first, RHS.first);
       }
+      template <typename K>
+      bool operator() (const Pair_type &LHS, const K &RHS) const {
+        Key_compare less;
+        return less(LHS.first, RHS);
+      }
+      template <typename K>
+      bool operator() (const K &LHS, const Pair_type &RHS) const {
+        Key_compare less;
+        return less(LHS, RHS.first);
+      }
   };
 
 public:
@@ -57,9 +107,22 @@ public:
   //       both the key and the value stored in first/second of the pair.
 
   // Type alias for iterator type. It is sufficient to use the Iterator
-  // from BinarySearchTree<Pair_type> since it will yield elements of Pair_type
-  // in the appropriate order for the Map.
-  using Iterator = typename BinarySearchTree<Pair_type, PairComp>::Iterator;
+  // from BinarySearchTree<Pair_type> (or BTree<Pair_type>) since it will
+  // yield elements of Pair_type in the appropriate order for the Map.
+  // With BTreeBalanced, inserting or erasing invalidates all Iterators,
+  // and with CompactNodes, an insertion that grows the node array does.
+  // With Persistent, Iterators give const access to the pairs, and stay
+  // valid as long as some snapshot holding their pair does.
+  using Iterator = typename Map_tree<Pair_type, PairComp, Balance,
+                                     Allocator>::type::Iterator;
+
+  // Type alias for an iterator over the key-value pairs in descending order
+  // of keys (see rbegin()).
+  using Reverse_iterator = std::reverse_iterator<Iterator>;
+
+  // Type alias for a read-only snapshot of a Map (see freeze()). It has
+  // the same find() and iteration as a Map.
+  using Frozen = FrozenTree<Pair_type, PairComp>;
 
   // You should add in a default constructor, destructor, copy
   // constructor, and overloaded assignment operator, if appropriate.
@@ -67,6 +130,21 @@ public:
   // you should omit them. A user of the class must be able to create,
   // copy, assign, and destroy Maps.
 
+  Map() { }
+
+  // Creates an empty Map whose elements are allocated through alloc
+  // (see BinarySearchTree.hpp).
+  explicit Map(const Allocator &alloc)
+    : tree(alloc) { }
+
+  // REQUIRES: [first, last) is a forward range of key-value pairs sorted
+  //           by key (keys may repeat)
+  // EFFECTS : Creates a Map holding the first pair for each key in the
+  //           range, in linear time. See assign().
+  template <typename Iter>
+  Map(Iter first, Iter last)
+    : tree(first, last) { }
+
 
   // EFFECTS : Returns whether this Map is empty.
   bool empty() const {
@@ -79,21 +157,122 @@ public:
     return tree.size();
   }
 
+  // MODIFIES: this
+  // EFFECTS : Removes all elements from this Map.
+  void clear() {
+    tree.clear();
+  }
+
+  // REQUIRES: [first, last) is a forward range of key-value pairs sorted
+  //           by key (keys may repeat)
+  // MODIFIES: this
+  // EFFECTS : Replaces the contents of this Map with the first pair for
+  //           each key in the range, in linear time. Use this to reload a
+  //           Map from a sorted dump instead of inserting pair by pair.
+  template <typename Iter>
+  void assign(Iter first, Iter last) {
+    tree.assign(first, last);
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Sets aside room so that this Map can grow to n elements
+  //           without further allocation. Under CompactNodes, inserting
+  //           up to n elements then keeps all iterators valid.
+  void reserve(size_t n) {
+    tree.reserve(n);
+  }
+
   // EFFECTS : Searches this Map for an element with a key equivalent
   //           to k and returns an Iterator to the associated value if found,
   //           otherwise returns an end Iterator.
-  //
-  // HINT: Since Map is implemented using a BinarySearchTree that stores
-  //       (key, value) pairs, you'll need to construct a dummy value
-  //       using "Value_type()".
   Iterator find(const Key_type& k) const {
-    Iterator i(tree.find({k, Value_type()}));
-    if (i != end()) {
-      return i;
-    }
-    else {
-      return end();
-    }
+    return tree.find(k);
+  }
+
+  // EFFECTS : Same as find(const Key_type&), but k may be of any type
+  //           that Key_compare compares against Key_type directly, e.g.
+  //           a std::string_view or const char* for a
+  //           Map<std::string, V, std::less<>>. Only available when
+  //           Key_compare is transparent (declares is_transparent).
+  template <typename K, typename C = Key_compare,
+            typename = typename C::is_transparent>
+  Iterator find(const K& k) const {
+    return tree.find(k);
+  }
+
+  // EFFECTS : Returns an Iterator to the first element whose key is not
+  //           less than k, or an end Iterator if there is none. Together
+  //           with upper_bound(), this reads a key interval, e.g. every
+  //           key starting with "data" lies in
+  //           [lower_bound("data"), lower_bound("datb")), in
+  //           O(log n + k) time for k elements when the tree is balanced.
+  Iterator lower_bound(const Key_type& k) const {
+    return tree.lower_bound(k);
+  }
+
+  // EFFECTS : Same as lower_bound(const Key_type&), for any key type K
+  //           that Key_compare compares against Key_type directly. Only
+  //           available when Key_compare is transparent (see find).
+  template <typename K, typename C = Key_compare,
+            typename = typename C::is_transparent>
+  Iterator lower_bound(const K& k) const {
+    return tree.lower_bound(k);
+  }
+
+  // EFFECTS : Returns an Iterator to the first element whose key is
+  //           greater than k, or an end Iterator if there is none.
+  Iterator upper_bound(const Key_type& k) const {
+    return tree.upper_bound(k);
+  }
+
+  // EFFECTS : Same as upper_bound(const Key_type&), for any key type K
+  //           that Key_compare compares against Key_type directly. Only
+  //           available when Key_compare is transparent (see find).
+  template <typename K, typename C = Key_compare,
+            typename = typename C::is_transparent>
+  Iterator upper_bound(const K& k) const {
+    return tree.upper_bound(k);
+  }
+
+  // EFFECTS : Returns the range of elements with a key equivalent to k,
+  //           as the pair (lower_bound(k), upper_bound(k)).
+  std::pair<Iterator, Iterator> equal_range(const Key_type& k) const {
+    return tree.equal_range(k);
+  }
+
+  // EFFECTS : Same as equal_range(const Key_type&), for any key type K
+  //           that Key_compare compares against Key_type directly. Only
+  //           available when Key_compare is transparent (see find).
+  template <typename K, typename C = Key_compare,
+            typename = typename C::is_transparent>
+  std::pair<Iterator, Iterator> equal_range(const K& k) const {
+    return tree.equal_range(k);
+  }
+
+  // REQUIRES: [first, last) is a forward range of keys (or, with a
+  //           transparent Key_compare, of types it compares against keys)
+  // MODIFIES: out
+  // EFFECTS : Writes to the output iterator out, in order, what find()
+  //           returns for each key, and returns out advanced past them.
+  //           The searches go down the tree in lockstep, so the cache
+  //           misses of one overlap with the work of the others, which is
+  //           faster than calling find() on each key in turn; keys given
+  //           in ascending order also share the top of their paths.
+  template <typename Iter, typename Out>
+  Out find_batch(Iter first, Iter last, Out out) const {
+    return tree.find_batch(first, last, out);
+  }
+
+  // EFFECTS : Returns an Iterator to the element whose key has exactly
+  //           k smaller keys in this Map (the k-th smallest key, counting
+  //           from 0), or an end Iterator if k >= size().
+  Iterator select(size_t k) const {
+    return tree.select(k);
+  }
+
+  // EFFECTS : Returns the number of keys in this Map that are less than k.
+  size_t rank(const Key_type& k) const {
+    return tree.rank(k);
   }
 
   // MODIFIES: this
@@ -106,21 +285,13 @@ public:
   //           value and returns a reference to the mapped value.
   //           Note: value-initialization for numeric types guarantees the
   //           value will be 0 (rather than memory junk).
-  //
-  // HINT:     In the case the key was not found, and you must insert a
-  //           new element, use the expression {k, Value_type()} to create
-  //           that element. This ensures the proper value-initialization is done.
+  //           Inserting invalidates iterators as insert() does.
+  //           Not available under Persistent, whose pairs are
+  //           immutable: use insert() or try_emplace().
   //
   // HINT: http://www.cplusplus.com/reference/map/map/operator[]/
   Value_type& operator[](const Key_type& k) {
-    Iterator iter = find(k);
-    if (iter != end()) {
-        return iter->second;
-    }
-    Pair_type new_element = {k, Value_type()};
-    auto insertion_result = insert(new_element);
-
-    return insertion_result.first->second;
+    return try_emplace(k).first->second;
   }
 
   // MODIFIES: this
@@ -130,19 +301,244 @@ public:
   //           corresponding existing element, along with the value
   //           false. Otherwise, inserts the given element and returns
   //           an iterator to the newly inserted element, along with
-  //           the value true.
+  //           the value true. Iterators to other elements stay valid,
+  //           except under BTreeBalanced, and under CompactNodes when
+  //           the insertion has to grow the node array: then all
+  //           iterators are invalidated (see reserve()). The same holds
+  //           for every other way of inserting.
   std::pair<Iterator, bool> insert(const Pair_type &val) {
-    Iterator found(find(val.first));
-    if (found != end()) {
-      std::pair<Iterator, bool> pair{found, false};
-      return pair;
-    } 
-    else {
-      std::pair<Iterator, bool> pair{tree.insert(val), true};
-      return pair;
+    return tree.try_emplace(val.first, val);
+  }
+
+  // MODIFIES: this, val
+  // EFFECTS : Same as insert(const Pair_type &), but moves val into the
+  //           Map if it is inserted. Otherwise val is left untouched.
+  std::pair<Iterator, bool> insert(Pair_type &&val) {
+    return tree.try_emplace(val.first, std::move(val));
+  }
+
+  // MODIFIES: this
+  // EFFECTS : If k is not already contained in the Map, inserts an element
+  //           with key k and a mapped value constructed in place from
+  //           args. Returns an iterator to the element with key k, along
+  //           with whether it was inserted. Searches the Map only once.
+  // HINT: http://www.cplusplus.com/reference/map/map/try_emplace/
+  template <typename... Args>
+  std::pair<Iterator, bool> try_emplace(const Key_type &k, Args&&... args) {
+    return tree.try_emplace(k, std::piecewise_construct,
+                            std::forward_as_tuple(k),
+                            std::forward_as_tuple(std::forward<Args>(args)...));
+  }
+
+
+  // REQUIRES: hint is a valid Iterator into this Map, possibly end()
+  // MODIFIES: this
+  // EFFECTS : Same as insert(const Pair_type &), but when the key belongs
+  //           right next to hint the pair is linked in there after a
+  //           constant number of comparisons, rather than by a search
+  //           from the root. Returns an iterator to the element with
+  //           val's key. Feed sorted pairs as insert(end(), val), or as
+  //           hint = insert(hint, val). Outside BTreeBalanced this still
+  //           takes O(depth) time (see BinarySearchTree::insert(Iterator,
+  //           const T &)).
+  Iterator insert(Iterator hint, const Pair_type &val) {
+    return tree.try_emplace_hint(hint, val.first, val);
+  }
+
+  // REQUIRES: hint is a valid Iterator into this Map, possibly end()
+  // MODIFIES: this, val
+  // EFFECTS : Same as insert(Iterator, const Pair_type &), but moves val
+  //           into the Map if it is inserted.
+  Iterator insert(Iterator hint, Pair_type &&val) {
+    return tree.try_emplace_hint(hint, val.first, std::move(val));
+  }
+
+  // REQUIRES: hint is a valid Iterator into this Map, possibly end()
+  // MODIFIES: this
+  // EFFECTS : Same as try_emplace(k, args...), trying hint first (see
+  //           insert(Iterator, const Pair_type &)). Returns an iterator to
+  //           the element with key k.
+  template <typename... Args>
+  Iterator try_emplace(Iterator hint, const Key_type &k, Args&&... args) {
+    return tree.try_emplace_hint(hint, k, std::piecewise_construct,
+                                 std::forward_as_tuple(k),
+                                 std::forward_as_tuple(
+                                   std::forward<Args>(args)...));
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Adds to this Map a copy of every pair of other whose key is
+  //           not here yet. Where both Maps have a key, its value becomes
+  //           combine(value here, value in other), e.g. std::plus<>() to
+  //           add up per-shard counts. Walks both Maps in order once and
+  //           builds the result in a new tree (see assign), so it takes
+  //           O(n + m) time rather than the O(m log(n + m)) of inserting
+  //           pair by pair. Iterators into this Map are invalidated.
+  //           Merging a Map into itself sets each value v to
+  //           combine(v, v). If combine or a copy throws, this Map is
+  //           left unchanged.
+  template <typename Combine>
+  void merge(const Map &other, Combine combine) {
+    // Copies, not moves, so that nothing here changes before the swap
+    std::vector<Pair_type> merged;
+    merged.reserve(size() + other.size());
+    Iterator a = begin();
+    Iterator b = other.begin();
+    PairComp less;
+    while (a != end() || b != other.end()) {
+      if (b == other.end() || (a != end() && less(*a, *b))) {
+        merged.push_back(*a++);
+      }
+      else if (a == end() || less(*b, *a)) {
+        merged.push_back(*b++);
+      }
+      else {
+        merged.emplace_back(a->first, combine(a->second, b->second));
+        ++a;
+        ++b;
+      }
     }
-}
+    decltype(tree) result(tree.get_allocator());
+    result.assign(std::make_move_iterator(merged.begin()),
+                  std::make_move_iterator(merged.end()));
+    tree.swap(result);
+  }
+
+  // REQUIRES: position is a valid, dereferenceable Iterator into this Map
+  // MODIFIES: this
+  // EFFECTS : Removes the element at position and returns an iterator to
+  //           the element after it. Iterators to other elements remain
+  //           valid, and the freed node is reused by later insertions.
+  Iterator erase(Iterator position) {
+    return tree.erase(position);
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Removes the elements in [first, last), which must be a valid
+  //           range of iterators into this Map, and returns last.
+  Iterator erase(Iterator first, Iterator last) {
+    return tree.erase(first, last);
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Removes the element with key k, if there is one. Returns the
+  //           number of elements removed (0 or 1).
+  size_t erase(const Key_type& k) {
+    return tree.erase(k);
+  }
 
+  // EFFECTS : Returns a report on the shape of the tree holding this Map
+  //           (see BinarySearchTree::Health), in linear time, e.g. to
+  //           watch an Unbalanced Map for degeneration. Not available
+  //           under BTreeBalanced.
+  auto health() const {
+    return tree.health();
+  }
+
+  // REQUIRES: the Balance policy is Instrumented, e.g.
+  //           Instrumented<AVLBalanced>
+  // EFFECTS : Returns the counts of comparisons, searches and allocations
+  //           made by the tree holding this Map (see
+  //           BinarySearchTree::Stats), e.g. to check that classifying a
+  //           post costs as many comparisons as expected.
+  const auto &stats() const {
+    return tree.stats();
+  }
+
+  // REQUIRES: the Balance policy is Instrumented
+  // MODIFIES: this
+  // EFFECTS : Sets the counts returned by stats() back to zero.
+  void reset_stats() {
+    tree.reset_stats();
+  }
+
+  // EFFECTS : Calls f(pair) for each key-value pair in order (see
+  //           BinarySearchTree::for_each). Not available under
+  //           BTreeBalanced, like the two functions below.
+  template <typename F>
+  void for_each(F &&f) const {
+    tree.for_each(std::forward<F>(f));
+  }
+
+  // REQUIRES: f may be called concurrently on different pairs
+  // EFFECTS : Calls f(pair) for each key-value pair, in no particular
+  //           order, on up to 'threads' threads (0 means one per core).
+  template <typename F>
+  void parallel_for_each(F f, size_t threads = 0) const {
+    tree.parallel_for_each(f, threads);
+  }
+
+  // REQUIRES: combine is associative and commutative, with identity
+  //           element 'identity'
+  // EFFECTS : Returns the combination of transform(pair) over all the
+  //           key-value pairs, computed on up to 'threads' threads, e.g.
+  //           the total of the counts in a Map<string, int>.
+  template <typename R, typename Transform, typename Combine>
+  R parallel_reduce(R identity, Transform transform, Combine combine,
+                    size_t threads = 0) const {
+    return tree.parallel_reduce(std::move(identity), transform, combine,
+                                threads);
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Reshapes the tree holding this Map to the least possible
+  //           height, in place, in linear time (see
+  //           BinarySearchTree::rebalance). Iterators stay valid. Not
+  //           available under BTreeBalanced.
+  void rebalance() {
+    tree.rebalance();
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Moves the key-value pairs into new nodes laid out in order in
+  //           one block of memory (see BinarySearchTree::compact), e.g.
+  //           after rebalance() once training is done. Invalidates all
+  //           iterators. Not available under BTreeBalanced.
+  void compact() {
+    tree.compact();
+  }
+
+  // EFFECTS : Returns a copy of this Map that later changes to this Map do
+  //           not affect. Under Persistent this takes constant time and
+  //           memory, as copying does: the copy shares every node, and a
+  //           later insertion copies only the nodes on its path. So a
+  //           writer thread can keep inserting into its Map while reader
+  //           threads look keys up in snapshots of it: taking a snapshot
+  //           reads the writer's Map, so it must be synchronized with the
+  //           insertions, but reading and destroying snapshots needs no
+  //           locks (see PersistentBinarySearchTree.hpp). Under the other
+  //           policies it copies every pair.
+  Map snapshot() const {
+    return *this;
+  }
+
+  // EFFECTS : Returns an immutable copy of this Map laid out in one array
+  //           for faster lookups (see FrozenTree.hpp). Freeze a Map once it
+  //           is done being built, e.g. after training, and look keys up
+  //           in the snapshot. Later changes to this Map do not affect it.
+  Frozen freeze() const {
+    return Frozen(begin(), end());
+  }
+
+  // EFFECTS : Writes the key-value pairs of this Map to the file at path
+  //           (see Snapshot.hpp), in linear time. Throws snapshot_exception
+  //           on failure. Frozen::load() reads the file back as a snapshot,
+  //           serving lookups straight from the file when Key_type and
+  //           Value_type are trivially copyable (e.g. Map<int, double>).
+  void save(const std::string &path) const {
+    Frozen::save_sorted(path, begin(), end());
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Replaces the contents of this Map with the key-value pairs
+  //           saved in the file at path, in linear time (see assign()).
+  //           Throws snapshot_exception, leaving this Map unchanged, if
+  //           the file cannot be loaded or its keys are not in strictly
+  //           increasing order by the key comparison.
+  void load(const std::string &path) {
+    Frozen frozen = Frozen::load(path);
+    assign(frozen.begin(), frozen.end());
+  }
 
   // EFFECTS : Returns an iterator to the first key-value pair in this Map.
   Iterator begin() const {
@@ -154,8 +550,20 @@ public:
     return tree.end();
   }
 
+  // EFFECTS : Returns a reverse iterator to the key-value pair with the
+  //           largest key, e.g. to read the k largest keys in O(log n + k)
+  //           time. Not available under BTreeBalanced, like rend().
+  Reverse_iterator rbegin() const {
+    return Reverse_iterator(end());
+  }
+
+  // EFFECTS : Returns a reverse iterator to before the first key-value pair.
+  Reverse_iterator rend() const {
+    return Reverse_iterator(begin());
+  }
+
 private:
-  BinarySearchTree<Pair_type, PairComp> tree;
+  typename Map_tree<Pair_type, PairComp, Balance, Allocator>::type tree;
 };
 
 
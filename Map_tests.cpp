@@ -1,6 +1,13 @@
 #include "BinarySearchTree.hpp"
 #include "Map.hpp"
 #include "unit_test_framework.hpp"
+#include <cstdio>
+#include <iterator>
+#include <set>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <vector>
 
 using namespace std;
 
@@ -93,4 +100,525 @@ TEST(test_string_map) {
     ASSERT_EQUAL((*map.begin()).second, 0);
 }
 
+TEST(test_balanced_map) {
+    Map<int, int, less<int>, AVLBalanced> map;
+    for (int i = 0; i < 1000; ++i) {
+        map[i] = i * i;
+    }
+    ASSERT_EQUAL(map.size(), 1000);
+    ASSERT_EQUAL(map.find(31)->second, 961);
+    ASSERT_EQUAL(map.find(1000), map.end());
+
+    int i = 0;
+    for (auto pair : map) {
+        ASSERT_EQUAL(pair.first, i);
+        ASSERT_EQUAL(pair.second, i * i);
+        i++;
+    }
+    ASSERT_EQUAL(i, 1000);
+}
+
+TEST(test_find_heterogeneous) {
+    Map<string, int, less<>> map;
+    map["data"] = 1;
+    map["base"] = 2;
+
+    ASSERT_EQUAL(map.find(string_view("data"))->second, 1);
+    ASSERT_EQUAL(map.find("base")->second, 2);
+    ASSERT_EQUAL(map.find(string_view("zoo")), map.end());
+    ASSERT_EQUAL(map.size(), 2);
+}
+
+TEST(test_select_and_rank) {
+    Map<string, int> map;
+    map["the"] = 40;
+    map["a"] = 25;
+    map["of"] = 18;
+    map["zebra"] = 1;
+
+    ASSERT_EQUAL(map.select(0)->first, "a");
+    ASSERT_EQUAL(map.select(3)->first, "zebra");
+    ASSERT_EQUAL(map.select(4), map.end());
+    ASSERT_EQUAL(map.rank("of"), 1);
+    ASSERT_EQUAL(map.rank("q"), 2); // not in the map
+}
+
+TEST(test_insert_and_try_emplace) {
+    Map<string, string> map;
+    pair<string, string> entry("key", "value");
+    ASSERT_TRUE(map.insert(move(entry)).second);
+    ASSERT_EQUAL(map.find("key")->second, "value");
+
+    // existing key: nothing is consumed or overwritten
+    pair<string, string> again("key", "other");
+    ASSERT_FALSE(map.insert(move(again)).second);
+    ASSERT_EQUAL(again.second, "other");
+    ASSERT_FALSE(map.try_emplace("key", "other").second);
+    ASSERT_EQUAL(map["key"], "value");
+
+    auto result = map.try_emplace("dashes", 3, '-');
+    ASSERT_TRUE(result.second);
+    ASSERT_EQUAL(result.first->second, "---");
+    ASSERT_EQUAL(map["new"], "");
+    ASSERT_EQUAL(map.size(), 3);
+
+    Map<string, string> moved(move(map));
+    ASSERT_EQUAL(moved.size(), 3);
+    ASSERT_TRUE(map.empty());
+}
+
+TEST(test_assign_sorted_range) {
+    vector<pair<string, int>> dump = {
+        {"apple", 1}, {"banana", 2}, {"banana", 20}, {"cherry", 3}
+    };
+    Map<string, int> map(dump.begin(), dump.end());
+    ASSERT_EQUAL(map.size(), 3);
+    ASSERT_EQUAL(map["banana"], 2);
+    ASSERT_EQUAL(map.begin()->first, "apple");
+
+    map.assign(dump.begin() + 3, dump.end());
+    ASSERT_EQUAL(map.size(), 1);
+    ASSERT_EQUAL(map.begin()->first, "cherry");
+
+    map.clear();
+    ASSERT_TRUE(map.empty());
+}
+
+TEST(test_erase) {
+    Map<string, int> map;
+    map["a"] = 1;
+    map["b"] = 2;
+    map["c"] = 3;
+    map["d"] = 4;
+
+    ASSERT_EQUAL(map.erase("b"), 1);
+    ASSERT_EQUAL(map.erase("b"), 0);
+    ASSERT_EQUAL(map.erase(map.find("a"))->first, "c");
+    ASSERT_EQUAL(map.size(), 2);
+    map.erase(map.begin(), map.end());
+    ASSERT_TRUE(map.empty());
+    map["e"] = 5;
+    ASSERT_EQUAL(map.size(), 1);
+}
+
+TEST(test_prefix_scan) {
+    Map<string, int, less<>> map;
+    const char *words[] = { "dab", "data", "database", "datum", "dataz", "date" };
+    for (const char *word : words) {
+        map[word] = 1;
+    }
+
+    // every key in ["data", "dataz"]
+    ostringstream oss;
+    auto last = map.upper_bound(string_view("dataz"));
+    for (auto it = map.lower_bound(string_view("data")); it != last; ++it) {
+        oss << it->first << " ";
+    }
+    ASSERT_EQUAL(oss.str(), "data database dataz ");
+
+    auto range = map.equal_range("datum");
+    ASSERT_EQUAL(range.first->first, "datum");
+    ASSERT_EQUAL(range.second, map.end());
+    range = map.equal_range("nope");
+    ASSERT_EQUAL(range.first, range.second);
+
+    Map<int, int> numbers;
+    numbers[1] = 1;
+    numbers[5] = 5;
+    ASSERT_EQUAL(numbers.lower_bound(2)->first, 5);
+    ASSERT_EQUAL(numbers.upper_bound(5), numbers.end());
+}
+
+TEST(test_btree_map) {
+    Map<string, int, less<>, BTreeBalanced> map;
+    for (int i = 0; i < 2000; ++i) {
+        map[to_string(i)] = i;
+    }
+    ASSERT_EQUAL(map.size(), 2000);
+    ASSERT_EQUAL(map.find(string_view("1234"))->second, 1234);
+    ASSERT_EQUAL(map.find("2000"), map.end());
+    ASSERT_FALSE(map.insert({"7", 0}).second);
+    ASSERT_EQUAL(map["7"], 7);
+    ASSERT_EQUAL(map.select(0)->first, "0");
+    ASSERT_EQUAL(map.rank("1"), 1);
+
+    // keys from "19" up to (not including) "2"
+    auto it = map.erase(map.lower_bound("19"), map.lower_bound("2"));
+    ASSERT_EQUAL(it->first, "2");
+    ASSERT_EQUAL(map.size(), 2000 - 111);
+    ASSERT_EQUAL(map.erase("5"), 1);
+    ASSERT_EQUAL(map.erase("5"), 0);
+
+    Map<string, int, less<>, BTreeBalanced> copy(map);
+    copy.clear();
+    ASSERT_TRUE(copy.empty());
+    ASSERT_EQUAL(map.size(), 2000 - 112);
+
+    string previous;
+    for (const auto &pair : map) {
+        ASSERT_TRUE(previous < pair.first);
+        ASSERT_EQUAL(to_string(pair.second), pair.first);
+        previous = pair.first;
+    }
+}
+
+TEST(test_freeze) {
+    Map<string, int> map;
+    map["the"] = 10;
+    map["a"] = 4;
+    map["cat"] = 1;
+    Map<string, int>::Frozen frozen = map.freeze();
+    map["dog"] = 2;
+    map["the"] = 11;
+
+    ASSERT_EQUAL(frozen.size(), 3);
+    ASSERT_EQUAL(frozen.find("the")->second, 10);
+    ASSERT_TRUE(frozen.find("dog") == frozen.end());
+    string keys;
+    for (const auto &pair : frozen) {
+        keys += pair.first + " ";
+    }
+    ASSERT_EQUAL(keys, "a cat the ");
+}
+
+TEST(test_merge_combine) {
+    Map<string, int> counts;
+    Map<string, int> shard;
+    counts["the"] = 10;
+    counts["cat"] = 1;
+    shard["the"] = 5;
+    shard["a"] = 4;
+    shard["zebra"] = 2;
+    counts.merge(shard, plus<>());
+    ASSERT_EQUAL(counts.size(), 4);
+    ASSERT_EQUAL(counts["the"], 15);
+    ASSERT_EQUAL(counts["a"], 4);
+    ASSERT_EQUAL(shard.size(), 3);
+    ASSERT_EQUAL(shard["the"], 5);
+
+    Map<string, int, less<>, BTreeBalanced> big;
+    Map<string, int, less<>, BTreeBalanced> other;
+    for (int i = 0; i < 1000; ++i) {
+        big[to_string(2 * i)] = 1;
+        other[to_string(3 * i)] = 2;
+    }
+    big.merge(other, [](int here, int there) { return here * 10 + there; });
+    ASSERT_EQUAL(big.size(), 1000 + 1000 - 334);
+    ASSERT_EQUAL(big["6"], 12);
+    ASSERT_EQUAL(big["3"], 2);
+    ASSERT_EQUAL(big["4"], 1);
+    string previous;
+    for (const auto &pair : big) {
+        ASSERT_TRUE(previous < pair.first);
+        previous = pair.first;
+    }
+
+    // a Map merged into itself combines each value with itself
+    Map<int, string> words;
+    words[1] = "ab";
+    words[2] = "c";
+    words.merge(words, plus<>());
+    ASSERT_EQUAL(words.size(), 2);
+    ASSERT_EQUAL(words[1], "abab");
+    ASSERT_EQUAL(words[2], "cc");
+    big.merge(big, plus<>());
+    ASSERT_EQUAL(big["6"], 24);
+    ASSERT_EQUAL(big.size(), 1000 + 1000 - 334);
+
+    // a combine that throws partway leaves the Map as it was
+    Map<string, string, less<>, AVLBalanced> names;
+    Map<string, string, less<>, AVLBalanced> more;
+    for (int i = 0; i < 100; ++i) {
+        names[string(20, 'k') + to_string(i)] = to_string(i);
+        more[string(20, 'k') + to_string(i)] = to_string(i);
+    }
+    bool threw = false;
+    try {
+        names.merge(more, [](const string &here, const string &there) {
+            if (here == "50") {
+                throw runtime_error("combine failed");
+            }
+            return here + there;
+        });
+    }
+    catch (const runtime_error &) {
+        threw = true;
+    }
+    ASSERT_TRUE(threw);
+    ASSERT_EQUAL(names.size(), 100);
+    for (int i = 0; i < 100; ++i) {
+        auto found = names.find(string(20, 'k') + to_string(i));
+        ASSERT_TRUE(found != names.end());
+        ASSERT_EQUAL(found->second, to_string(i));
+    }
+}
+
+TEST(test_health) {
+    Map<int, int> map;
+    for (int i = 0; i < 100; ++i) {
+        map[i] = i;
+    }
+    ASSERT_EQUAL(map.health().height, 100);
+    ASSERT_EQUAL(map.health().optimal_height, 7);
+    Map<int, int, less<int>, AVLBalanced> balanced(map.begin(), map.end());
+    ASSERT_EQUAL(balanced.health().height, 7);
+    ASSERT_EQUAL(balanced.health().height_ratio, 1.0);
+}
+
+TEST(test_insert_hint) {
+    Map<string, int, less<>, AVLBalanced> map;
+    auto hint = map.end();
+    for (const char *word : {"apple", "date", "fig", "kiwi", "lime"}) {
+        hint = map.insert(hint, {word, 1});
+    }
+    ASSERT_EQUAL(hint->first, "lime");
+    hint = map.insert(map.find("fig"), {"fig", 5});
+    ASSERT_EQUAL(hint->second, 1);
+    hint = map.try_emplace(map.find("fig"), "grape", 2);
+    ASSERT_EQUAL(hint->second, 2);
+    map.insert(map.end(), pair<string, int>("zucchini", 3));
+    ASSERT_EQUAL(map.size(), 7);
+    ASSERT_EQUAL(map.rank("kiwi"), 4);
+
+    Map<string, int, less<>, BTreeBalanced> btree;
+    auto last = btree.end();
+    for (int i = 0; i < 1000; ++i) {
+        last = btree.try_emplace(btree.end(), string(1, 'a' + i / 100) +
+                                 to_string(1000 + i), i);
+    }
+    ASSERT_EQUAL(last->second, 999);
+    ASSERT_EQUAL(btree.size(), 1000);
+    ASSERT_EQUAL(btree.select(500)->second, 500);
+}
+
+TEST(test_find_batch) {
+    Map<string, int> vocab;
+    vocab["the"] = 10;
+    vocab["cat"] = 1;
+    vocab["sat"] = 2;
+    set<string> post = {"cat", "dog", "sat", "the"};
+    vector<Map<string, int>::Iterator> found;
+    vocab.find_batch(post.begin(), post.end(), back_inserter(found));
+    ASSERT_EQUAL(found.size(), 4);
+    ASSERT_EQUAL(found[0]->second, 1);
+    ASSERT_EQUAL(found[1], vocab.end());
+    ASSERT_EQUAL(found[3]->second, 10);
+
+    Map<string, int, less<>, BTreeBalanced> btree;
+    btree["the"] = 10;
+    vector<string_view> words = {"the", "a"};
+    vector<Map<string, int, less<>, BTreeBalanced>::Iterator> results;
+    btree.find_batch(words.begin(), words.end(), back_inserter(results));
+    ASSERT_EQUAL(results[0]->second, 10);
+    ASSERT_EQUAL(results[1], btree.end());
+}
+
+TEST(test_persistent_snapshots) {
+    Map<string, int, less<>, Persistent> map;
+    for (int i = 0; i < 1000; ++i) {
+        ASSERT_TRUE(map.insert({"key" + to_string(i), i}).second);
+    }
+    ASSERT_FALSE(map.insert({"key7", 0}).second);
+    ASSERT_FALSE(map.try_emplace("key7", 0).second);
+    ASSERT_EQUAL(map.find("key7")->second, 7);
+    ASSERT_EQUAL(map.find(string_view("key999"))->second, 999);
+    ASSERT_EQUAL(map.size(), 1000);
+
+    // a reader looks keys up in a snapshot while the writer inserts
+    auto snapshot = map.snapshot();
+    long long reader_total = 0;
+    thread reader([&snapshot, &reader_total]() {
+        for (int round = 0; round < 20; ++round) {
+            for (int i = 0; i < 1000; ++i) {
+                reader_total += snapshot.find("key" + to_string(i))->second;
+            }
+        }
+    });
+    for (int i = 1000; i < 3000; ++i) {
+        map.try_emplace("key" + to_string(i), i);
+    }
+    reader.join();
+    ASSERT_EQUAL(reader_total, 20 * 999 * 1000 / 2);
+    ASSERT_EQUAL(snapshot.size(), 1000);
+    ASSERT_TRUE(snapshot.find("key1000") == snapshot.end());
+    ASSERT_EQUAL(map.size(), 3000);
+    ASSERT_EQUAL(map.find("key2999")->second, 2999);
+
+    int count = 0;
+    for (const auto &entry : snapshot) {
+        ASSERT_EQUAL(entry.first, "key" + to_string(entry.second));
+        ++count;
+    }
+    ASSERT_EQUAL(count, 1000);
+    map.clear();
+    ASSERT_TRUE(map.empty());
+    ASSERT_EQUAL(snapshot.size(), 1000);
+}
+
+TEST(test_compact_nodes) {
+    Map<string, int, less<>, CompactNodes<AVLBalanced>> counts;
+    for (int i = 0; i < 3000; ++i) {
+        ++counts["word" + to_string(i % 1000)];
+    }
+    ASSERT_EQUAL(counts.size(), 1000);
+    ASSERT_EQUAL(counts["word7"], 3);
+    ASSERT_EQUAL(counts.find(string_view("word999"))->second, 3);
+    ASSERT_TRUE(counts.find("word1000") == counts.end());
+
+    auto copy = counts;
+    copy["extra"] = 1;
+    ASSERT_EQUAL(copy.size(), 1001);
+    ASSERT_EQUAL(counts.size(), 1000);
+    int total = 0;
+    for (const auto &entry : copy) {
+        total += entry.second;
+    }
+    ASSERT_EQUAL(total, 3001);
+}
+
+TEST(test_compact_nodes_lookup_keeps_iterators) {
+    // 16 elements fill the first node array
+    Map<int, int, less<int>, CompactNodes<AVLBalanced>> map;
+    for (int i = 0; i < 16; ++i) {
+        map[i] = i;
+    }
+    auto zero = map.find(0);
+    const auto *address = &*zero;
+    map[0] += 1;
+    ASSERT_FALSE(map.insert({15, 0}).second);
+    ASSERT_FALSE(map.try_emplace(7, 0).second);
+    ASSERT_EQUAL(map.insert(map.find(3), {3, 0})->second, 3);
+    ASSERT_EQUAL(&*map.find(0), address);
+    ASSERT_EQUAL(zero->second, 1);
+    ASSERT_EQUAL((++zero)->first, 1);
+
+    // only a new key grows the array
+    map[16] = 16;
+    ASSERT_NOT_EQUAL(&*map.find(0), address);
+    ASSERT_EQUAL(map.size(), 17);
+    ASSERT_EQUAL(map[0], 1);
+    ASSERT_EQUAL(map[16], 16);
+}
+
+TEST(test_rebalance_compact) {
+    Map<string, int> map;
+    for (int i = 0; i < 100; ++i) {
+        map[to_string(1000 + i)] = i;
+    }
+    ASSERT_EQUAL(map.health().height, 100);
+    auto kept = map.find("1050");
+    map.rebalance();
+    ASSERT_EQUAL(map.health().height, 7);
+    ASSERT_EQUAL(kept->second, 50);
+    map.compact();
+    ASSERT_EQUAL(map.size(), 100);
+    ASSERT_EQUAL(map["1099"], 99);
+    ASSERT_EQUAL(map.rank("1050"), 50);
+}
+
+TEST(test_parallel_reduce) {
+    Map<string, int, less<>, AVLBalanced> counts;
+    for (int i = 0; i < 10000; ++i) {
+        counts[to_string(i)] = i % 10;
+    }
+    int total = counts.parallel_reduce(
+        0, [](const pair<string, int> &entry) { return entry.second; },
+        [](int a, int b) { return a + b; }, 4);
+    ASSERT_EQUAL(total, 45000);
+
+    counts.parallel_for_each([](pair<string, int> &entry) {
+        entry.second *= 2;
+    }, 4);
+    int doubled = 0;
+    counts.for_each([&](const pair<string, int> &entry) {
+        doubled += entry.second;
+    });
+    ASSERT_EQUAL(doubled, 90000);
+}
+
+TEST(test_instrumented) {
+    Map<string, int, less<>, Instrumented<AVLBalanced>> counts;
+    for (const char *word : {"the", "cat", "the", "hat", "the"}) {
+        ++counts[word];
+    }
+    ASSERT_EQUAL(counts["the"], 3);
+    ASSERT_EQUAL(counts.stats().allocations, 3u);
+    ASSERT_EQUAL(counts.stats().searches, 6u);
+    counts.reset_stats();
+    ASSERT_TRUE(counts.find("dog") == counts.end());
+    ASSERT_EQUAL(counts.stats().searches, 1u);
+    ASSERT_EQUAL(counts.stats().nodes_visited, 2u);
+    ASSERT_EQUAL(counts.stats().allocations, 0u);
+}
+
+TEST(test_reverse_iteration) {
+    // a map keyed by score, read from the highest
+    Map<int, string> by_score;
+    for (int i = 0; i < 500; ++i) {
+        by_score[i * 37 % 500] = "w" + to_string(i);
+    }
+    vector<int> top;
+    for (auto it = by_score.rbegin(); top.size() < 5; ++it) {
+        top.push_back(it->first);
+    }
+    ASSERT_TRUE(top == vector<int>({499, 498, 497, 496, 495}));
+    auto last = by_score.end();
+    --last;
+    ASSERT_EQUAL(last->first, 499);
+    --last;
+    ASSERT_EQUAL(last->first, 498);
+
+    size_t count = 0;
+    for (auto it = by_score.rbegin(); it != by_score.rend(); ++it) {
+        ++count;
+    }
+    ASSERT_EQUAL(count, 500u);
+    Map<int, int> empty;
+    ASSERT_TRUE(empty.rbegin() == empty.rend());
+}
+
+TEST(test_save_load) {
+    Map<string, int> counts;
+    for (int i = 0; i < 300; ++i) {
+        counts["w" + to_string(i % 100)] += i;
+    }
+    counts.save("Map_tests.snap");
+    Map<string, int> loaded;
+    loaded["extra"] = 1;
+    loaded.load("Map_tests.snap");
+    ASSERT_EQUAL(loaded.size(), 100u);
+    ASSERT_EQUAL(loaded["w7"], 7 + 107 + 207);
+    ASSERT_TRUE(loaded.find("extra") == loaded.end());
+
+    // BTreeBalanced maps save and load the same files
+    Map<string, int, less<>, BTreeBalanced> btree;
+    btree.load("Map_tests.snap");
+    ASSERT_EQUAL(btree.size(), 100u);
+    ASSERT_EQUAL(btree.find("w99")->second, 99 + 199 + 299);
+
+    // a Map of trivially copyable pairs is looked up in the mapped file
+    Map<int, double> weights;
+    for (int i = 0; i < 1000; ++i) {
+        weights[i * 3] = i / 4.0;
+    }
+    weights.save("Map_tests.snap");
+    Map<int, double>::Frozen frozen =
+        Map<int, double>::Frozen::load("Map_tests.snap");
+    ASSERT_EQUAL(frozen.size(), 1000u);
+    ASSERT_EQUAL(frozen.find(300)->second, 25.0);
+    ASSERT_TRUE(frozen.find(301) == frozen.end());
+
+    // but not as a Map of other types
+    bool threw = false;
+    try {
+        loaded.load("Map_tests.snap");
+    }
+    catch (const snapshot_exception &) {
+        threw = true;
+    }
+    ASSERT_TRUE(threw);
+    ASSERT_EQUAL(loaded.size(), 100u);
+    remove("Map_tests.snap");
+}
+
 TEST_MAIN()
@@ -0,0 +1,304 @@
+#ifndef NODE_ARRAY_HPP
+#define NODE_ARRAY_HPP
+/* NodeArray.hpp
+ *
+ * Contiguous node storage with 32-bit links, for the compact mode of a
+ * linked container such as BinarySearchTree.
+ */
+
+#include <cassert>  //assert
+#include <cstddef>  //ptrdiff_t, size_t
+#include <cstdint>  //int32_t, uint32_t
+#include <limits>   //numeric_limits
+#include <memory>   //allocator_traits
+#include <new>      //placement new
+#include <utility>  //forward, swap
+
+template <typename Node>
+class RelativeLink {
+
+  // OVERVIEW: A RelativeLink stands in for a Node * inside a Node: it
+  // converts to and from Node *, so code that follows and sets links
+  // reads the same either way. It stores the distance from itself to the
+  // Node it points to in 32 bits, counting in units of c_unit bytes (0
+  // means null, since a node never links to itself), so two nodes can be
+  // linked if they lie within 8 GiB of each other, as they do in a
+  // NodeArray.
+  //
+  // Copying or moving a link copies the distance, so a link copied along
+  // with the whole array of Nodes it lives in points to the copy of its
+  // target: the array needs no fixing up when it is copied, moved or
+  // written out and read back. Assigning a link, on the other hand,
+  // makes it point to the same Node as the right-hand side.
+
+public:
+
+  static constexpr size_t c_unit = alignof(std::int32_t);
+
+  RelativeLink(Node *target = nullptr) {
+    set(target);
+  }
+
+  RelativeLink(const RelativeLink &other) = default;
+
+  RelativeLink &operator=(const RelativeLink &rhs) {
+    set(rhs);
+    return *this;
+  }
+
+  RelativeLink &operator=(Node *target) {
+    set(target);
+    return *this;
+  }
+
+  operator Node *() const {
+    if (!offset) { return nullptr; }
+    const char *self = reinterpret_cast<const char *>(this);
+    return reinterpret_cast<Node *>(const_cast<char *>(self) +
+                                    std::ptrdiff_t(offset) * c_unit);
+  }
+
+  Node *operator->() const {
+    return *this;
+  }
+
+private:
+  std::int32_t offset;
+
+  void set(Node *target) {
+    if (!target) {
+      offset = 0;
+      return;
+    }
+    std::ptrdiff_t distance = reinterpret_cast<char *>(target) -
+                              reinterpret_cast<char *>(this);
+    assert(distance % std::ptrdiff_t(c_unit) == 0);
+    distance /= std::ptrdiff_t(c_unit);
+    assert(distance >= std::numeric_limits<std::int32_t>::min() &&
+           distance <= std::numeric_limits<std::int32_t>::max());
+    offset = static_cast<std::int32_t>(distance);
+  }
+};
+
+template <typename Node, typename Allocator>
+class NodeArray {
+
+  // OVERVIEW: A NodeArray constructs Nodes in a single array obtained from
+  // Allocator, handing out slots in order and reusing the slots of
+  // destroyed Nodes first, like a NodePool with only one slab. Nodes link
+  // to each other with RelativeLinks, which only reach within one array,
+  // so the array cannot add a second slab when it fills up: the owner
+  // grows it by moving every Node to a larger array at the same index
+  // (see mirror() and counterpart()), which keeps all the links valid.
+  //
+  // Memory is returned to Allocator only by release() or the destructor.
+  // Neither runs the destructors of Nodes that are still alive; the owner
+  // is responsible for destroy()ing them first (unless Node is trivially
+  // destructible).
+
+  using Node_traits = typename std::allocator_traits<Allocator>::
+    template rebind_traits<Node>;
+  using Node_allocator = typename Node_traits::allocator_type;
+
+  // What a slot on the free list holds instead of a Node: the index of
+  // the next free slot plus one, or 0 at the end of the list. Indices,
+  // unlike pointers, stay valid in a mirrored array.
+  struct Free_slot {
+    std::uint32_t next;
+  };
+  static_assert(sizeof(Free_slot) <= sizeof(Node),
+                "a free slot must fit in the memory of a Node");
+
+public:
+
+  // Fewest Nodes an owner should grow a full array by.
+  static const size_t c_min_nodes = 16;
+
+  // Most Nodes an array can hold: slot indices fit in 32 bits, and every
+  // RelativeLink must reach across the whole array.
+  static constexpr size_t c_max_nodes =
+    (size_t(1) << 31) * RelativeLink<Node>::c_unit / sizeof(Node);
+
+  explicit NodeArray(const Allocator &alloc = Allocator())
+    : node_alloc(alloc), nodes(nullptr), used(0), capacity(0),
+      free_head(0), free_count(0) { }
+
+  NodeArray(const NodeArray &other) = delete;
+  NodeArray &operator=(const NodeArray &rhs) = delete;
+
+  // Move constructor
+  // (Takes over the array of other, leaving it empty.)
+  NodeArray(NodeArray &&other)
+    : node_alloc(other.node_alloc), nodes(other.nodes), used(other.used),
+      capacity(other.capacity), free_head(other.free_head),
+      free_count(other.free_count) {
+    other.nodes = nullptr;
+    other.used = other.capacity = other.free_head = other.free_count = 0;
+  }
+
+  ~NodeArray() {
+    release();
+  }
+
+  // EFFECTS: Returns a copy of the allocator the array comes from.
+  Allocator get_allocator() const {
+    return Allocator(node_alloc);
+  }
+
+  // EFFECTS: Returns the number of Nodes the array holds in total.
+  size_t slab_capacity() const {
+    return capacity;
+  }
+
+  // EFFECTS: Returns the number of slots on the free list.
+  size_t free_slot_count() const {
+    return free_count;
+  }
+
+  // EFFECTS: Returns the number of Nodes that can be created before the
+  //          array is full.
+  size_t available() const {
+    return capacity - used + free_count;
+  }
+
+  // REQUIRES: available() > 0
+  // EFFECTS:  Constructs a Node from args in the most recently freed slot,
+  //           or else in the next unused slot, and returns it.
+  template <typename... Args>
+  Node *create(Args&&... args) {
+    assert(available() > 0);
+    if (free_head) {
+      Node *node = nodes + (free_head - 1);
+      Free_slot *slot = reinterpret_cast<Free_slot *>(node);
+      free_head = slot->next;
+      --free_count;
+      slot->~Free_slot();
+      try {
+        Node_traits::construct(node_alloc, node, std::forward<Args>(args)...);
+      }
+      catch (...) {
+        push_free(node);
+        throw;
+      }
+      return node;
+    }
+    Node *node = nodes + used;
+    Node_traits::construct(node_alloc, node, std::forward<Args>(args)...);
+    ++used;
+    return node;
+  }
+
+  // REQUIRES: node was returned by create() on this array
+  // EFFECTS:  Runs the destructor of node and puts its slot on the free
+  //           list.
+  void destroy(Node *node) {
+    Node_traits::destroy(node_alloc, node);
+    push_free(node);
+  }
+
+  // REQUIRES: available() >= n, or the array holds no live Nodes
+  // EFFECTS:  Guarantees that the next n calls to create() have room.
+  //           Growing an array that holds Nodes is up to the owner (see
+  //           mirror()).
+  void reserve(size_t n) {
+    if (available() >= n) {
+      return;
+    }
+    assert(used == free_count);
+    release();
+    allocate(n);
+  }
+
+  // REQUIRES: this array holds no live Nodes
+  // EFFECTS:  Replaces this array with one of the same layout as 'from',
+  //           plus room for n more Nodes: the same slots are in use and
+  //           free, and each Node of 'from' is to be copied or moved to
+  //           its counterpart() here by the owner, which then has an
+  //           identical set of Nodes, links included.
+  void mirror(const NodeArray &from, size_t n) {
+    assert(used == free_count);
+    release();
+    allocate(from.used + n);
+    used = from.used;
+    free_head = from.free_head;
+    free_count = from.free_count;
+    for (std::uint32_t k = free_head; k; k = from.free_slot(k - 1)->next) {
+      ::new (static_cast<void *>(nodes + (k - 1)))
+        Free_slot{from.free_slot(k - 1)->next};
+    }
+  }
+
+  // REQUIRES: node is a Node of 'from'
+  // EFFECTS:  Returns the slot of this array at the index of node in
+  //           'from'.
+  Node *counterpart(const NodeArray &from, const Node *node) const {
+    return nodes + (node - from.nodes);
+  }
+
+  // REQUIRES: slot is an empty slot of this array set aside by mirror()
+  // EFFECTS:  Constructs a Node from args in slot.
+  template <typename... Args>
+  void construct_at(Node *slot, Args&&... args) {
+    Node_traits::construct(node_alloc, slot, std::forward<Args>(args)...);
+  }
+
+  // REQUIRES: the allocators of both arrays compare equal, unless the
+  //           allocator propagates on container swap
+  // EFFECTS:  Exchanges the arrays (and, if it propagates, the allocator)
+  //           of this NodeArray and other.
+  void swap(NodeArray &other) {
+    using std::swap;
+    if constexpr (Node_traits::propagate_on_container_swap::value) {
+      swap(node_alloc, other.node_alloc);
+    }
+    swap(nodes, other.nodes);
+    swap(used, other.used);
+    swap(capacity, other.capacity);
+    swap(free_head, other.free_head);
+    swap(free_count, other.free_count);
+  }
+
+  // EFFECTS: Frees the array. All Nodes obtained from it become invalid;
+  //          their destructors are not run.
+  void release() {
+    if (nodes) {
+      Node_traits::deallocate(node_alloc, nodes, capacity);
+    }
+    nodes = nullptr;
+    used = capacity = free_head = free_count = 0;
+  }
+
+private:
+  Node_allocator node_alloc;
+  Node *nodes;
+  // Slots handed out so far (live or freed), and slots in the array.
+  size_t used;
+  size_t capacity;
+  // Index plus one of the most recently freed slot (0 if none), and the
+  // length of the free list.
+  std::uint32_t free_head;
+  size_t free_count;
+
+  const Free_slot *free_slot(size_t index) const {
+    return reinterpret_cast<const Free_slot *>(nodes + index);
+  }
+
+  // EFFECTS: Pushes the (dead) slot of node onto the free list.
+  void push_free(Node *node) {
+    ::new (static_cast<void *>(node)) Free_slot{free_head};
+    free_head = static_cast<std::uint32_t>(node - nodes) + 1;
+    ++free_count;
+  }
+
+  // REQUIRES: the array is released
+  // EFFECTS:  Allocates an array of n Nodes.
+  void allocate(size_t n) {
+    assert(n <= c_max_nodes);
+    if (n > 0) {
+      nodes = Node_traits::allocate(node_alloc, n);
+    }
+    capacity = n;
+  }
+};
+
+#endif // NODE_ARRAY_HPP
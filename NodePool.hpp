@@ -0,0 +1,241 @@
+#ifndef NODE_POOL_HPP
+#define NODE_POOL_HPP
+/* NodePool.hpp
+ *
+ * Slab allocator for the nodes of a linked container such as
+ * BinarySearchTree.
+ */
+
+#include <cstddef>  //size_t
+#include <memory>   //allocator_traits
+#include <new>      //placement new
+#include <utility>  //forward, swap
+#include <vector>
+
+template <typename Node, typename Allocator>
+class NodePool {
+
+  // OVERVIEW: A NodePool constructs Nodes in large contiguous blocks
+  // ("slabs") obtained from Allocator, handing them out in order, so
+  // that a container built by successive insertions keeps its nodes
+  // side by side in memory and pays for one allocation per slab rather
+  // than one per node. Slabs grow geometrically up to c_max_slab_nodes
+  // nodes, and reserve() sizes the next slab exactly. Slots of destroyed
+  // Nodes go on a free list and are reused first, so a container whose
+  // insertions and removals balance out stops allocating.
+  //
+  // Allocator may be any standard allocator (it is rebound to Node),
+  // including std::pmr::polymorphic_allocator, in which case the slabs
+  // come from its memory_resource.
+  //
+  // Memory is returned to Allocator only by release() or the destructor,
+  // which free every slab at once. Neither runs the destructors of Nodes
+  // that are still alive; the owner is responsible for destroy()ing them
+  // first (unless Node is trivially destructible).
+
+  using Node_traits = typename std::allocator_traits<Allocator>::
+    template rebind_traits<Node>;
+  using Node_allocator = typename Node_traits::allocator_type;
+
+  // A slab is an array of 'capacity' Nodes.
+  struct Slab {
+    Node *nodes;
+    size_t capacity;
+  };
+
+  // What a slot on the free list holds instead of a Node.
+  struct Free_slot {
+    Free_slot *next;
+  };
+  static_assert(sizeof(Free_slot) <= sizeof(Node),
+                "a free slot must fit in the memory of a Node");
+
+public:
+
+  static const size_t c_min_slab_nodes = 16;
+  static const size_t c_max_slab_nodes = 65536;
+
+  explicit NodePool(const Allocator &alloc = Allocator())
+    : node_alloc(alloc), slabs(alloc), next(nullptr), last(nullptr),
+      free_slots(nullptr), free_count(0), capacity(0) { }
+
+  NodePool(const NodePool &other) = delete;
+  NodePool &operator=(const NodePool &rhs) = delete;
+
+  // Move constructor
+  // (Takes over the slabs of other, leaving it empty.)
+  NodePool(NodePool &&other)
+    : node_alloc(other.node_alloc), slabs(std::move(other.slabs)),
+      next(other.next), last(other.last), free_slots(other.free_slots),
+      free_count(other.free_count), capacity(other.capacity) {
+    other.slabs.clear();
+    other.next = other.last = nullptr;
+    other.free_slots = nullptr;
+    other.free_count = other.capacity = 0;
+  }
+
+  ~NodePool() {
+    release();
+  }
+
+  // EFFECTS: Returns a copy of the allocator the slabs come from.
+  Allocator get_allocator() const {
+    return Allocator(node_alloc);
+  }
+
+  // EFFECTS: Returns the number of Nodes the current slabs hold in total.
+  size_t slab_capacity() const {
+    return capacity;
+  }
+
+  // EFFECTS: Returns the number of slots on the free list.
+  size_t free_slot_count() const {
+    return free_count;
+  }
+
+  // EFFECTS: Constructs a Node from args in the most recently freed slot,
+  //          or else in the next unused slot of the current slab, starting
+  //          a new slab if that one is full, and returns it.
+  template <typename... Args>
+  Node *create(Args&&... args) {
+    if (free_slots) {
+      Free_slot *slot = free_slots;
+      free_slots = slot->next;
+      --free_count;
+      slot->~Free_slot();
+      Node *node = reinterpret_cast<Node *>(slot);
+      try {
+        Node_traits::construct(node_alloc, node, std::forward<Args>(args)...);
+      }
+      catch (...) {
+        push_free(node);
+        throw;
+      }
+      return node;
+    }
+    if (next == last) {
+      add_slab(capacity < c_min_slab_nodes ? c_min_slab_nodes
+               : capacity < c_max_slab_nodes ? capacity : c_max_slab_nodes);
+    }
+    Node *node = next;
+    Node_traits::construct(node_alloc, node, std::forward<Args>(args)...);
+    ++next;
+    return node;
+  }
+
+  // REQUIRES: node was returned by create() on this pool
+  // EFFECTS:  Runs the destructor of node and puts its slot on the free
+  //           list.
+  void destroy(Node *node) {
+    Node_traits::destroy(node_alloc, node);
+    push_free(node);
+  }
+
+  // EFFECTS: Guarantees that the next n calls to create() need no further
+  //          allocation. Those that do not reuse a freed slot take
+  //          consecutive slots of a single slab: if the current slab lacks
+  //          room, its remaining slots are abandoned and a slab of exactly
+  //          the missing size is allocated.
+  void reserve(size_t n) {
+    if (static_cast<size_t>(last - next) + free_count < n) {
+      add_slab(n - free_count);
+    }
+  }
+
+  // REQUIRES: the allocators of both pools compare equal, unless the
+  //           allocator propagates on container swap
+  // EFFECTS:  Exchanges the slabs (and, if it propagates, the allocator)
+  //           of this pool and other.
+  void swap(NodePool &other) {
+    using std::swap;
+    if constexpr (Node_traits::propagate_on_container_swap::value) {
+      swap(node_alloc, other.node_alloc);
+    }
+    slabs.swap(other.slabs);
+    swap(next, other.next);
+    swap(last, other.last);
+    swap(free_slots, other.free_slots);
+    swap(free_count, other.free_count);
+    swap(capacity, other.capacity);
+  }
+
+  // REQUIRES: the allocators of both pools compare equal
+  // EFFECTS:  Takes over the slabs of other, leaving it empty, so that the
+  //           Nodes other created now belong to this pool and are freed
+  //           with it. The free lists are joined, and whichever current
+  //           slab has more unused slots stays current; the unused slots
+  //           of the other one are abandoned, as by reserve().
+  void splice(NodePool &other) {
+    if (this == &other) {
+      return;
+    }
+    slabs.reserve(slabs.size() + other.slabs.size());
+    slabs.insert(slabs.end(), other.slabs.begin(), other.slabs.end());
+    if (other.last - other.next > last - next) {
+      next = other.next;
+      last = other.last;
+    }
+    // Walk the shorter free list to its end and hang the other one there
+    Free_slot *head = free_slots;
+    Free_slot *tail = other.free_slots;
+    if (free_count < other.free_count) {
+      std::swap(head, tail);
+    }
+    if (tail) {
+      free_slots = tail;
+      for (; tail->next; tail = tail->next) { }
+      tail->next = head;
+    }
+    else {
+      free_slots = head;
+    }
+    free_count += other.free_count;
+    capacity += other.capacity;
+    other.slabs.clear();
+    other.next = other.last = nullptr;
+    other.free_slots = nullptr;
+    other.free_count = other.capacity = 0;
+  }
+
+  // EFFECTS: Frees every slab. All Nodes obtained from this pool become
+  //          invalid; their destructors are not run.
+  void release() {
+    for (const Slab &slab : slabs) {
+      Node_traits::deallocate(node_alloc, slab.nodes, slab.capacity);
+    }
+    slabs.clear();
+    next = last = nullptr;
+    free_slots = nullptr;
+    free_count = capacity = 0;
+  }
+
+private:
+  Node_allocator node_alloc;
+  std::vector<Slab, typename Node_traits::template rebind_alloc<Slab>> slabs;
+  // The next unused slot and the end of the current slab.
+  Node *next;
+  Node *last;
+  // The most recently freed slot and the length of the free list.
+  Free_slot *free_slots;
+  size_t free_count;
+  // Total number of Nodes in all slabs.
+  size_t capacity;
+
+  // EFFECTS: Pushes the (dead) slot of node onto the free list.
+  void push_free(Node *node) {
+    free_slots = ::new (static_cast<void *>(node)) Free_slot{free_slots};
+    ++free_count;
+  }
+
+  // EFFECTS: Allocates a slab of n Nodes and makes it the current slab.
+  void add_slab(size_t n) {
+    slabs.reserve(slabs.size() + 1); // so push_back below cannot throw
+    Node *nodes = Node_traits::allocate(node_alloc, n);
+    slabs.push_back(Slab{nodes, n});
+    next = nodes;
+    last = nodes + n;
+    capacity += n;
+  }
+};
+
+#endif // NODE_POOL_HPP
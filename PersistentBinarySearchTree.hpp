@@ -0,0 +1,384 @@
+#ifndef PERSISTENT_BINARY_SEARCH_TREE_HPP
+#define PERSISTENT_BINARY_SEARCH_TREE_HPP
+/* PersistentBinarySearchTree.hpp
+ *
+ * Immutable, structurally shared variant of BinarySearchTree
+ */
+
+#include <cassert>  //assert
+#include <functional> //less
+#include <iostream> //ostream
+#include <memory>   //shared_ptr
+#include <utility>  //forward, move, pair
+#include <vector>
+
+// Balance policy for Map (see Map.hpp) that stores its pairs in a
+// PersistentBinarySearchTree, so that copying a Map (see Map::snapshot)
+// takes constant time. The tree is always AVL balanced.
+struct Persistent {
+  static constexpr bool rebalances = true;
+};
+
+template <typename T,
+          typename Compare=std::less<T> // default if argument isn't provided
+         >
+class PersistentBinarySearchTree {
+
+  // OVERVIEW: This class represents a persistent AVL-balanced binary
+  // search tree, storing elements of type T ordered by Compare, with the
+  // same invariants as BinarySearchTree (no duplicates, sorted).
+  //
+  // Nodes are never modified once built. They are reference counted and
+  // shared between every tree that contains them, so:
+  //   - copying or assigning a tree takes constant time and memory, and
+  //     the copy is a snapshot that later insertions into the original
+  //     (or into the copy) do not affect;
+  //   - an insertion copies only the nodes on the path from the root to
+  //     the new leaf (plus at most two for rotations), O(log n) in all.
+  //
+  // The reference counts are those of std::shared_ptr, so snapshots may
+  // be read and destroyed on other threads while a writer keeps inserting
+  // into its own tree. Handing a snapshot over (copying the tree object
+  // itself) must be synchronized like any other write.
+  //
+  // Elements are immutable: iterators only give const access to them.
+  //
+  // Map<K, V, Compare, Persistent> stores its pairs in this tree, so its
+  // snapshot() takes constant time (see Map.hpp).
+
+private:
+
+  struct Node;
+  using Node_ptr = std::shared_ptr<const Node>;
+
+  // A Node stores an element, its children, and the height and size of
+  // the subtree rooted at it. All of them are fixed at construction.
+  struct Node {
+    Node(T datum_in, Node_ptr left_in, Node_ptr right_in)
+      : datum(std::move(datum_in)), left(std::move(left_in)),
+        right(std::move(right_in)),
+        height(1 + (height_impl(left) > height_impl(right)
+                    ? height_impl(left) : height_impl(right))),
+        size(1 + size_impl(left) + size_impl(right)) { }
+
+    const T datum;
+    const Node_ptr left;
+    const Node_ptr right;
+    const int height;
+    const size_t size;
+  };
+
+public:
+
+  // Default constructor
+  PersistentBinarySearchTree() { }
+
+  // The copy constructor, assignment operator and destructor that the
+  // compiler generates share or release the root, which is exactly what
+  // is needed: copies are constant-time snapshots.
+
+  // EFFECTS: Returns whether this tree is empty.
+  bool empty() const {
+    return !root;
+  }
+
+  // EFFECTS: Returns the height of the tree.
+  size_t height() const {
+    return static_cast<size_t>(height_impl(root));
+  }
+
+  // EFFECTS: Returns the number of elements in this tree.
+  size_t size() const {
+    return size_impl(root);
+  }
+
+  // MODIFIES: this tree (but no copy of it)
+  // EFFECTS:  Removes all elements. Nodes that copies still share stay
+  //           alive with them.
+  void clear() {
+    root.reset();
+  }
+
+  class Iterator {
+    // OVERVIEW: Iterator interface for PersistentBinarySearchTree.
+    //           Iterates over the elements in ascending order. Since
+    //           nodes have no parent links, an Iterator keeps the
+    //           ancestors still to be visited on a stack, so ++ takes
+    //           amortized constant time.
+    //           An Iterator stays valid as long as some tree sharing its
+    //           nodes (the tree it came from or any copy) is alive.
+
+  public:
+    Iterator() { }
+
+    const T &operator*() const {
+      return pending.back()->datum;
+    }
+
+    const T *operator->() const {
+      return &pending.back()->datum;
+    }
+
+    // Prefix ++
+    Iterator &operator++() {
+      const Node *node = pending.back();
+      pending.pop_back();
+      push_left_spine(node->right.get());
+      return *this;
+    }
+
+    // Postfix ++ (implemented in terms of prefix ++)
+    Iterator operator++(int) {
+      Iterator result(*this);
+      ++(*this);
+      return result;
+    }
+
+    bool operator==(const Iterator &rhs) const {
+      return current() == rhs.current();
+    }
+
+    bool operator!=(const Iterator &rhs) const {
+      return current() != rhs.current();
+    }
+
+  private:
+    friend class PersistentBinarySearchTree;
+
+    // The current node on top, below it every ancestor whose left
+    // subtree holds the current node (the elements that come next).
+    std::vector<const Node *> pending;
+
+    const Node *current() const {
+      return pending.empty() ? nullptr : pending.back();
+    }
+
+    void push_left_spine(const Node *node) {
+      for (; node; node = node->left.get()) {
+        pending.push_back(node);
+      }
+    }
+  }; // PersistentBinarySearchTree::Iterator
+  ////////////////////////////////////////
+
+  // EFFECTS : Returns an iterator to the first element in this tree.
+  Iterator begin() const {
+    Iterator it;
+    it.push_left_spine(root.get());
+    return it;
+  }
+
+  // EFFECTS: Returns an iterator to past-the-end.
+  Iterator end() const {
+    return Iterator();
+  }
+
+  // EFFECTS: Returns an Iterator to the minimum element in this tree, or
+  //          an end Iterator if the tree is empty.
+  Iterator min_element() const {
+    return begin();
+  }
+
+  // EFFECTS: Searches this tree for an element equivalent to query.
+  //          Returns an iterator to it if found, and an end iterator
+  //          otherwise.
+  Iterator find(const T &query) const {
+    return find_impl(query);
+  }
+
+  // EFFECTS: Same as find(const T &), for any query type K the Compare
+  //          functor compares against T directly. Only available when
+  //          Compare is transparent (declares is_transparent), as in
+  //          BinarySearchTree.
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Iterator find(const K &query) const {
+    return find_impl(query);
+  }
+
+  // REQUIRES: The given item is not already contained in this tree
+  // MODIFIES: this tree (but no copy of it)
+  // EFFECTS : Inserts item, copying the O(log n) nodes on its path and
+  //           sharing the rest with the previous version of the tree.
+  //           Returns an iterator to the new element, found from its rank
+  //           in the same descent that placed it.
+  Iterator insert(const T &item) {
+    std::pair<Iterator, bool> result = try_emplace(item, item);
+    assert(result.second);
+    return result.first;
+  }
+
+  // REQUIRES: T(args...) is equivalent to key, and Compare can compare key
+  //           against T directly (key is usually a T itself, or the
+  //           Compare functor is transparent)
+  // MODIFIES: this tree (but no copy of it)
+  // EFFECTS : Searches for an element equivalent to key. If there is none,
+  //           inserts the element constructed from args, as insert()
+  //           does; otherwise the tree is left as it was, sharing every
+  //           node, and args are left untouched. Returns an Iterator to
+  //           the element equivalent to key, and whether it was inserted.
+  template <typename K, typename... Args>
+  std::pair<Iterator, bool> try_emplace(const K &key, Args&&... args) {
+    size_t rank = 0;
+    auto make_leaf = [&]() {
+      return make_node_impl(T(std::forward<Args>(args)...), nullptr, nullptr);
+    };
+    Node_ptr new_root = insert_impl(root, key, less, rank, make_leaf);
+    bool inserted = new_root != root;
+    root = std::move(new_root);
+    return {iterator_at_impl(rank), inserted};
+  }
+
+  // EFFECTS: Traverses the tree using an in-order traversal, printing
+  //          each element to os followed by a space.
+  void traverse_inorder(std::ostream &os) const {
+    for (const T &elt : *this) {
+      os << elt << " ";
+    }
+  }
+
+private:
+
+  // DATA REPRESENTATION
+  // The root node, shared with every copy made since it last changed.
+  Node_ptr root;
+
+  // An instance of the Compare type. Use this to compare elements.
+  Compare less;
+
+  static int height_impl(const Node_ptr &node) {
+    return node ? node->height : 0;
+  }
+
+  static size_t size_impl(const Node_ptr &node) {
+    return node ? node->size : 0;
+  }
+
+  static Node_ptr make_node_impl(T datum, Node_ptr left, Node_ptr right) {
+    return std::make_shared<const Node>(std::move(datum), std::move(left),
+                                        std::move(right));
+  }
+
+  // EFFECTS: Returns an Iterator to the element equivalent to query, or
+  //          an end Iterator if there is none.
+  template <typename K>
+  Iterator find_impl(const K &query) const {
+    Iterator it;
+    const Node *node = root.get();
+    while (node) {
+      if (less(query, node->datum)) {
+        it.pending.push_back(node);
+        node = node->left.get();
+      }
+      else if (less(node->datum, query)) {
+        node = node->right.get();
+      }
+      else {
+        it.pending.push_back(node);
+        return it;
+      }
+    }
+    return end();
+  }
+
+  // REQUIRES: the heights of left and right differ by at most two, and
+  //           each is AVL balanced
+  // EFFECTS : Returns a new AVL balanced tree holding datum between the
+  //           elements of left and right, built with a single or double
+  //           rotation if their heights differ by two.
+  static Node_ptr balance_impl(const T &datum, const Node_ptr &left,
+                               const Node_ptr &right) {
+    if (height_impl(left) > height_impl(right) + 1) {
+      if (height_impl(left->left) >= height_impl(left->right)) {
+        return make_node_impl(left->datum, left->left,
+                              make_node_impl(datum, left->right, right));
+      }
+      const Node &pivot = *left->right;
+      return make_node_impl(pivot.datum,
+                            make_node_impl(left->datum, left->left, pivot.left),
+                            make_node_impl(datum, pivot.right, right));
+    }
+    if (height_impl(right) > height_impl(left) + 1) {
+      if (height_impl(right->right) >= height_impl(right->left)) {
+        return make_node_impl(right->datum,
+                              make_node_impl(datum, left, right->left),
+                              right->right);
+      }
+      const Node &pivot = *right->left;
+      return make_node_impl(pivot.datum,
+                            make_node_impl(datum, left, pivot.left),
+                            make_node_impl(right->datum, pivot.right,
+                                           right->right));
+    }
+    return make_node_impl(datum, left, right);
+  }
+
+  // MODIFIES: rank
+  // EFFECTS : If the tree rooted at 'node' holds an element equivalent to
+  //           key, returns 'node' itself. Otherwise returns the root of a
+  //           new version of that tree with the leaf make_leaf() returns
+  //           inserted where key belongs, sharing every subtree off the
+  //           search path with the old version, which is unchanged.
+  //           Either way, adds to rank the number of elements of the tree
+  //           less than key.
+  // NOTE: This function is linear recursive; its depth is the height of
+  //       the tree, which stays logarithmic.
+  template <typename K, typename Make>
+  static Node_ptr insert_impl(const Node_ptr &node, const K &key,
+                              Compare less, size_t &rank, Make &make_leaf) {
+    if (!node) { return make_leaf(); }
+    if (less(key, node->datum)) {
+      Node_ptr left = insert_impl(node->left, key, less, rank, make_leaf);
+      if (left == node->left) { return node; }
+      return balance_impl(node->datum, left, node->right);
+    }
+    if (less(node->datum, key)) {
+      rank += size_impl(node->left) + 1;
+      Node_ptr right = insert_impl(node->right, key, less, rank, make_leaf);
+      if (right == node->right) { return node; }
+      return balance_impl(node->datum, node->left, right);
+    }
+    rank += size_impl(node->left);
+    return node;
+  }
+
+  // REQUIRES: rank < size()
+  // EFFECTS : Returns an Iterator to the element with exactly rank
+  //           smaller elements, found by the cached subtree sizes without
+  //           comparing any elements.
+  Iterator iterator_at_impl(size_t rank) const {
+    Iterator it;
+    const Node *node = root.get();
+    for (;;) {
+      size_t size_left = size_impl(node->left);
+      if (rank < size_left) {
+        it.pending.push_back(node);
+        node = node->left.get();
+      }
+      else if (rank > size_left) {
+        rank -= size_left + 1;
+        node = node->right.get();
+      }
+      else {
+        it.pending.push_back(node);
+        return it;
+      }
+    }
+  }
+
+}; // END of PersistentBinarySearchTree class
+
+// MODIFIES: os
+// EFFECTS : Prints the elements in the tree to the given ostream, like
+//           operator<< for BinarySearchTree: [ 3 5 7 ]
+template <typename T, typename Compare>
+std::ostream &operator<<(std::ostream &os,
+                         const PersistentBinarySearchTree<T, Compare> &tree) {
+  os << "[ ";
+  for (const T& elt : tree) {
+    os << elt << " ";
+  }
+  return os << "]";
+}
+
+#endif // PERSISTENT_BINARY_SEARCH_TREE_HPP
@@ -0,0 +1,152 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "PersistentBinarySearchTree.hpp"
+#include "unit_test_framework.hpp"
+
+using namespace std;
+
+using PBST = PersistentBinarySearchTree<int>;
+
+
+TEST(test_empty) {
+   PBST tree;
+   ASSERT_TRUE(tree.empty());
+   ASSERT_EQUAL(tree.size(), 0u);
+   ASSERT_EQUAL(tree.height(), 0u);
+   ASSERT_TRUE(tree.begin() == tree.end());
+   ASSERT_TRUE(tree.find(1) == tree.end());
+}
+
+TEST(test_insert_and_find) {
+   PBST tree;
+   for (int i : {50, 20, 80, 10, 30, 70, 90, 25}) {
+      ASSERT_EQUAL(*tree.insert(i), i);
+   }
+   ASSERT_EQUAL(tree.size(), 8u);
+   ASSERT_EQUAL(*tree.find(25), 25);
+   ASSERT_TRUE(tree.find(26) == tree.end());
+
+   ostringstream oss;
+   oss << tree;
+   ASSERT_EQUAL(oss.str(), "[ 10 20 25 30 50 70 80 90 ]");
+
+   // iteration may start from any element
+   ostringstream tail;
+   for (auto it = tree.find(30); it != tree.end(); ++it) {
+      tail << *it << " ";
+   }
+   ASSERT_EQUAL(tail.str(), "30 50 70 80 90 ");
+}
+
+TEST(test_sorted_inserts_stay_balanced) {
+   PBST tree;
+   for (int i = 0; i < 1023; ++i) {
+      tree.insert(i);
+   }
+   ASSERT_EQUAL(tree.size(), 1023u);
+   ASSERT_EQUAL(tree.height(), 10u);
+   int expected = 0;
+   for (int elt : tree) {
+      ASSERT_EQUAL(elt, expected++);
+   }
+   ASSERT_EQUAL(expected, 1023);
+}
+
+TEST(test_copy_is_snapshot) {
+   PBST tree;
+   for (int i = 0; i < 100; i += 2) {
+      tree.insert(i);
+   }
+   PBST snapshot = tree;
+   tree.insert(51);
+   snapshot.insert(-1);
+
+   ASSERT_EQUAL(tree.size(), 51u);
+   ASSERT_EQUAL(snapshot.size(), 51u);
+   ASSERT_TRUE(tree.find(-1) == tree.end());
+   ASSERT_TRUE(snapshot.find(51) == snapshot.end());
+   ASSERT_EQUAL(*tree.begin(), 0);
+   ASSERT_EQUAL(*snapshot.begin(), -1);
+
+   // elements off the updated paths are shared, not copied
+   ASSERT_EQUAL(&*tree.find(10), &*snapshot.find(10));
+   ASSERT_EQUAL(&*tree.find(90), &*snapshot.find(90));
+}
+
+TEST(test_snapshot_outlives_original) {
+   PersistentBinarySearchTree<string> *tree =
+      new PersistentBinarySearchTree<string>;
+   tree->insert("b");
+   tree->insert("a");
+   tree->insert("c");
+   PersistentBinarySearchTree<string> snapshot = *tree;
+   delete tree;
+   ostringstream oss;
+   snapshot.traverse_inorder(oss);
+   ASSERT_EQUAL(oss.str(), "a b c ");
+}
+
+// counts the comparisons made with it
+struct CountingLess {
+   static int count;
+   bool operator()(int a, int b) const {
+      ++count;
+      return a < b;
+   }
+};
+int CountingLess::count = 0;
+
+TEST(test_insert_single_descent) {
+   PersistentBinarySearchTree<int, CountingLess> tree;
+   for (int i = 0; i < 1000; ++i) {
+      tree.insert(2 * i);
+   }
+   // one descent: at most two comparisons per level, and none to find
+   // the result
+   for (int i = -1; i < 2000; i += 2) {
+      CountingLess::count = 0;
+      auto it = tree.insert(i);
+      ASSERT_TRUE(CountingLess::count <= 2 * static_cast<int>(tree.height()));
+      ASSERT_EQUAL(*it, i);
+      if (i < 1999) {
+         ASSERT_EQUAL(*++it, i + 1);
+      }
+      else {
+         ASSERT_TRUE(++it == tree.end());
+      }
+   }
+   ASSERT_EQUAL(tree.size(), 2001u);
+   int expected = -1;
+   for (int elt : tree) {
+      ASSERT_EQUAL(elt, expected++);
+   }
+}
+
+TEST(test_try_emplace_existing) {
+   PBST tree;
+   for (int i = 0; i < 100; i += 2) {
+      tree.insert(i);
+   }
+   PBST snapshot = tree;
+   auto result = tree.try_emplace(40, 40);
+   ASSERT_FALSE(result.second);
+   ASSERT_EQUAL(*result.first, 40);
+   ASSERT_EQUAL(*++result.first, 42);
+   ASSERT_EQUAL(tree.size(), 50u);
+   // nothing was copied: the tree still shares its root with the snapshot
+   ASSERT_TRUE(tree.find(40) == snapshot.find(40));
+
+   result = tree.try_emplace(41, 41);
+   ASSERT_TRUE(result.second);
+   ASSERT_EQUAL(*result.first, 41);
+   ASSERT_EQUAL(*++result.first, 42);
+   ASSERT_EQUAL(tree.size(), 51u);
+   ASSERT_TRUE(snapshot.find(41) == snapshot.end());
+
+   tree.clear();
+   ASSERT_TRUE(tree.empty());
+   ASSERT_EQUAL(snapshot.size(), 50u);
+}
+
+TEST_MAIN()
@@ -0,0 +1,558 @@
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+/* Snapshot.hpp
+ *
+ * Binary snapshot files of sorted containers: the file format shared by
+ * BinarySearchTree, Map and FrozenTree save() and load(), and read-only
+ * memory mapping of such files.
+ *
+ * A snapshot is a 64-byte header followed by the elements, one after
+ * another, in the order of a FrozenTree's array (see FrozenTree.hpp):
+ *
+ *   offset  size  contents
+ *        0     8  magic "BSTSNAP" and a 0 byte
+ *        8     4  format version (c_snapshot_version)
+ *       12     4  0x01020304, to detect a machine of other byte order
+ *       16     8  number of elements
+ *       24     8  number of bytes of elements after the header
+ *       32     8  hash of the element type's signature (see
+ *                 Snapshot_codec), to detect a file of another type
+ *       40     8  bytes per element, or 0 if elements vary in size
+ *       48    16  zero
+ *
+ * An element whose type is trivially copyable and trivially destructible
+ * (an int, a double, a struct of them, a std::pair of them) is stored as
+ * the bytes of the object itself, so the elements of a mapped file can be
+ * used in place, as an array. A std::string is stored as its length (8
+ * bytes) and then its characters, and a std::pair of other types as its
+ * first member and then its second. Numbers are stored in the byte order
+ * of the machine.
+ *
+ * Files are mapped with mmap() on POSIX systems, and read into memory
+ * elsewhere or when compiled with -DSNAPSHOT_MMAP=0. A snapshot is
+ * written to a new file that then replaces the old one by rename(), so
+ * a reader that has mapped the old file keeps it intact, and none ever
+ * sees a half-written one.
+ */
+
+#include <atomic>
+#include <cstddef>  //size_t, max_align_t
+#include <cstdint>  //uint32_t, uint64_t
+#include <cstdio>   //rename, remove
+#include <cstring>  //memcpy, memset, memcmp
+#include <exception>
+#include <fstream>
+#include <memory>   //unique_ptr
+#include <new>      //placement new
+#include <string>
+#include <type_traits>
+#include <utility>  //pair, move
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SNAPSHOT_POSIX 1
+#else
+#define SNAPSHOT_POSIX 0
+#endif
+#ifndef SNAPSHOT_MMAP
+#define SNAPSHOT_MMAP SNAPSHOT_POSIX
+#endif
+#if SNAPSHOT_POSIX
+#include <cerrno>     //errno
+#include <fcntl.h>    //open
+#include <sys/stat.h> //fstat
+#include <unistd.h>   //close, fsync, getpid, write, pwrite
+#endif
+#if SNAPSHOT_MMAP
+#include <sys/mman.h> //mmap, munmap
+#endif
+
+// Version of the snapshot format that save() writes and load() accepts.
+static const std::uint32_t c_snapshot_version = 1;
+
+// A custom exception type, thrown when a snapshot cannot be written, or
+// cannot be read because the file is missing, truncated, of another
+// version or byte order, or holds elements of another type or out of
+// order.
+class snapshot_exception : public std::exception {
+public:
+  const char * what () const noexcept override {
+    return msg.c_str();
+  }
+  const std::string msg;
+  snapshot_exception(const std::string &msg) : msg(msg) {};
+};
+
+// Whether T is a std::pair (see snapshot_raw_signature).
+template <typename T>
+struct is_snapshot_pair : std::false_type { };
+
+template <typename A, typename B>
+struct is_snapshot_pair<std::pair<A, B>> : std::true_type { };
+
+// EFFECTS: Returns a description of raw element type T for the type hash
+//          of a snapshot: its kind (bool, signed or unsigned integer,
+//          floating point, enum or pointer) and size, a pair's member
+//          types, or, for any other trivially copyable struct, which
+//          cannot be looked into, only its size and alignment.
+template <typename T>
+std::string snapshot_raw_signature() {
+  const std::string bits = std::to_string(8 * sizeof(T));
+  if constexpr (std::is_same<T, bool>::value) {
+    return "bool";
+  }
+  else if constexpr (std::is_integral<T>::value) {
+    return (std::is_signed<T>::value ? "int" : "uint") + bits;
+  }
+  else if constexpr (std::is_floating_point<T>::value) {
+    return "float" + bits;
+  }
+  else if constexpr (std::is_enum<T>::value) {
+    return "enum(" +
+           snapshot_raw_signature<std::underlying_type_t<T>>() + ")";
+  }
+  else if constexpr (std::is_pointer<T>::value) {
+    return "pointer" + bits;
+  }
+  else if constexpr (is_snapshot_pair<T>::value) {
+    return "pair(" + snapshot_raw_signature<typename T::first_type>() + "," +
+           snapshot_raw_signature<typename T::second_type>() + ")";
+  }
+  else {
+    return "struct" + std::to_string(sizeof(T)) + "/" +
+           std::to_string(alignof(T));
+  }
+}
+
+// How an element of type T is written to and read back from a snapshot.
+// Each codec provides:
+//   c_raw          whether elements are stored as their object bytes
+//   signature()    a description of the stored layout, checked on load
+//   write(out, v)  appends the encoding of v to out
+//   read(p, end)   decodes the element at p, advancing p, and throws
+//                  snapshot_exception if it runs past end
+template <typename T, typename = void>
+struct Snapshot_codec;
+
+template <typename T>
+struct Snapshot_codec<T, std::enable_if_t<
+                           std::is_trivially_copy_constructible<T>::value &&
+                           std::is_trivially_destructible<T>::value>> {
+  static constexpr bool c_raw = true;
+
+  static std::string signature() {
+    return snapshot_raw_signature<T>();
+  }
+
+  static void write(std::string &out, const T &value) {
+    // Copied into zeroed storage, so that padding is written as zeros
+    alignas(T) unsigned char bytes[sizeof(T)];
+    std::memset(bytes, 0, sizeof(T));
+    ::new (static_cast<void *>(bytes)) T(value);
+    out.append(reinterpret_cast<const char *>(bytes), sizeof(T));
+  }
+
+  static T read(const char *&p, const char *end) {
+    if (std::size_t(end - p) < sizeof(T)) {
+      throw snapshot_exception("snapshot truncated");
+    }
+    alignas(T) unsigned char bytes[sizeof(T)];
+    std::memcpy(bytes, p, sizeof(T));
+    p += sizeof(T);
+    return *reinterpret_cast<const T *>(bytes);
+  }
+};
+
+template <>
+struct Snapshot_codec<std::string> {
+  static constexpr bool c_raw = false;
+
+  static std::string signature() {
+    return "string";
+  }
+
+  static void write(std::string &out, const std::string &value) {
+    Snapshot_codec<std::uint64_t>::write(out, value.size());
+    out.append(value);
+  }
+
+  static std::string read(const char *&p, const char *end) {
+    std::uint64_t length = Snapshot_codec<std::uint64_t>::read(p, end);
+    if (std::uint64_t(end - p) < length) {
+      throw snapshot_exception("snapshot truncated");
+    }
+    std::string value(p, std::size_t(length));
+    p += length;
+    return value;
+  }
+};
+
+template <typename A, typename B>
+struct Snapshot_codec<std::pair<A, B>, std::enable_if_t<
+                        !(std::is_trivially_copy_constructible<
+                            std::pair<A, B>>::value &&
+                          std::is_trivially_destructible<
+                            std::pair<A, B>>::value)>> {
+  static constexpr bool c_raw = false;
+
+  static std::string signature() {
+    return "pair(" + Snapshot_codec<A>::signature() + "," +
+           Snapshot_codec<B>::signature() + ")";
+  }
+
+  static void write(std::string &out, const std::pair<A, B> &value) {
+    Snapshot_codec<A>::write(out, value.first);
+    Snapshot_codec<B>::write(out, value.second);
+  }
+
+  static std::pair<A, B> read(const char *&p, const char *end) {
+    A first = Snapshot_codec<A>::read(p, end);
+    return std::pair<A, B>(std::move(first), Snapshot_codec<B>::read(p, end));
+  }
+};
+
+// The fixed-size start of a snapshot file (see the table above).
+struct Snapshot_header {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t byte_order;
+  std::uint64_t count;
+  std::uint64_t payload_bytes;
+  std::uint64_t type_hash;
+  std::uint64_t element_bytes;
+  std::uint64_t reserved[2];
+};
+static_assert(sizeof(Snapshot_header) == 64, "the header takes 64 bytes");
+
+static const char c_snapshot_magic[8] = "BSTSNAP";
+static const std::uint32_t c_snapshot_byte_order = 0x01020304;
+
+// EFFECTS: Returns the 64-bit FNV-1a hash of text.
+inline std::uint64_t snapshot_hash(const std::string &text) {
+  std::uint64_t hash = 14695981039346656037ull;
+  for (unsigned char c : text) {
+    hash = (hash ^ c) * 1099511628211ull;
+  }
+  return hash;
+}
+
+// EFFECTS: Returns the header of a snapshot of count elements of type T
+//          taking payload_bytes after the header.
+template <typename T>
+Snapshot_header snapshot_header(std::uint64_t count,
+                                std::uint64_t payload_bytes) {
+  Snapshot_header header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, c_snapshot_magic, sizeof(header.magic));
+  header.version = c_snapshot_version;
+  header.byte_order = c_snapshot_byte_order;
+  header.count = count;
+  header.payload_bytes = payload_bytes;
+  header.type_hash = snapshot_hash(Snapshot_codec<T>::signature());
+  header.element_bytes = Snapshot_codec<T>::c_raw ? sizeof(T) : 0;
+  return header;
+}
+
+class Snapshot_output {
+
+  // OVERVIEW: A Snapshot_output writes a new file in the directory of the
+  // file at path, under a temporary name, and commit() moves it over
+  // path once it is complete and on disk. The old file is never written
+  // to: on POSIX systems rename() replaces it atomically, and whoever
+  // still has it open or mapped keeps reading the old contents. If
+  // commit() is not reached, the temporary file is removed.
+
+public:
+
+  // EFFECTS: Creates the temporary file, or throws snapshot_exception.
+  explicit Snapshot_output(const std::string &path)
+    : path(path) {
+    static std::atomic<unsigned> counter(0);
+    for (int attempt = 0; ; ++attempt) {
+      temp_path = path + ".tmp" + std::to_string(process_id()) + "-" +
+                  std::to_string(counter++);
+#if SNAPSHOT_POSIX
+      fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+      if (fd >= 0) {
+        return;
+      }
+      if (errno != EEXIST || attempt == 100) {
+        throw snapshot_exception("Error opening file: " + path);
+      }
+#else
+      if (!std::ifstream(temp_path)) {
+        file.open(temp_path, std::ios::binary | std::ios::trunc);
+      }
+      if (file.is_open()) {
+        return;
+      }
+      if (attempt == 100) {
+        throw snapshot_exception("Error opening file: " + path);
+      }
+#endif
+    }
+  }
+
+  Snapshot_output(const Snapshot_output &other) = delete;
+  Snapshot_output &operator=(const Snapshot_output &rhs) = delete;
+
+  ~Snapshot_output() {
+    if (!committed) {
+#if SNAPSHOT_POSIX
+      ::close(fd);
+#else
+      file.close();
+#endif
+      std::remove(temp_path.c_str());
+    }
+  }
+
+  // EFFECTS: Appends size bytes from data to the file, or throws
+  //          snapshot_exception.
+  void write(const char *data, std::size_t size) {
+#if SNAPSHOT_POSIX
+    while (size > 0) {
+      ssize_t done = ::write(fd, data, size);
+      if (done < 0 && errno == EINTR) {
+        continue;
+      }
+      if (done <= 0) {
+        fail();
+      }
+      data += done;
+      size -= std::size_t(done);
+    }
+#else
+    if (!file.write(data, std::streamsize(size))) {
+      fail();
+    }
+#endif
+  }
+
+  // EFFECTS: Overwrites the start of the file with header, or throws
+  //          snapshot_exception.
+  void write_header(const Snapshot_header &header) {
+    const char *data = reinterpret_cast<const char *>(&header);
+#if SNAPSHOT_POSIX
+    if (::pwrite(fd, data, sizeof(header), 0) != ssize_t(sizeof(header))) {
+      fail();
+    }
+#else
+    file.seekp(0);
+    if (!file.write(data, sizeof(header))) {
+      fail();
+    }
+#endif
+  }
+
+  // EFFECTS: Flushes the file to disk and moves it over path, or throws
+  //          snapshot_exception.
+  void commit() {
+#if SNAPSHOT_POSIX
+    bool synced = ::fsync(fd) == 0;
+    bool closed = ::close(fd) == 0;
+    committed = true;
+    if (!synced || !closed ||
+        std::rename(temp_path.c_str(), path.c_str()) != 0) {
+      std::remove(temp_path.c_str());
+      throw snapshot_exception("Error writing file: " + path);
+    }
+    // Make the new directory entry durable too; failing that is harmless
+    std::string::size_type slash = path.rfind('/');
+    std::string directory = slash == std::string::npos ? "."
+                            : path.substr(0, slash + 1);
+    int dir_fd = ::open(directory.c_str(), O_RDONLY);
+    if (dir_fd >= 0) {
+      ::fsync(dir_fd);
+      ::close(dir_fd);
+    }
+#else
+    file.close();
+    committed = true;
+    bool written = bool(file);
+    if (written && std::rename(temp_path.c_str(), path.c_str()) != 0) {
+      // rename() may not replace an existing file here
+      std::remove(path.c_str());
+      written = std::rename(temp_path.c_str(), path.c_str()) == 0;
+    }
+    if (!written) {
+      std::remove(temp_path.c_str());
+      throw snapshot_exception("Error writing file: " + path);
+    }
+#endif
+  }
+
+private:
+  std::string path;
+  std::string temp_path;
+  bool committed = false;
+#if SNAPSHOT_POSIX
+  int fd = -1;
+#else
+  std::ofstream file;
+#endif
+
+  static long process_id() {
+#if SNAPSHOT_POSIX
+    return long(::getpid());
+#else
+    return 0;
+#endif
+  }
+
+  [[noreturn]] void fail() const {
+    throw snapshot_exception("Error writing file: " + path);
+  }
+};
+
+// REQUIRES: at(k) returns the element at index k of a FrozenTree's array
+//           of n elements, for k from 1 to n
+// EFFECTS:  Writes a snapshot of the elements to a new file that then
+//           replaces the file at path (see Snapshot_output), or throws
+//           snapshot_exception and leaves the file at path as it was.
+//           The elements are encoded a block at a time, so it takes
+//           little memory.
+template <typename T, typename At>
+void write_snapshot(const std::string &path, std::size_t n, At at) {
+  Snapshot_output file(path);
+  // Room for the header, filled in once the payload size is known
+  std::string block(sizeof(Snapshot_header), '\0');
+  std::uint64_t payload_bytes = 0;
+  const std::size_t c_block_bytes = 1 << 16;
+  for (std::size_t k = 1; k <= n; ++k) {
+    std::size_t before = block.size();
+    Snapshot_codec<T>::write(block, at(k));
+    payload_bytes += block.size() - before;
+    if (block.size() >= c_block_bytes) {
+      file.write(block.data(), block.size());
+      block.clear();
+    }
+  }
+  file.write(block.data(), block.size());
+  file.write_header(snapshot_header<T>(n, payload_bytes));
+  file.commit();
+}
+
+class Snapshot_file {
+
+  // OVERVIEW: A Snapshot_file is a read-only view of the bytes of a
+  // snapshot file whose header has been checked. Where the system
+  // supports it, the file is memory-mapped, so opening it reads nothing
+  // but the header, and each page of elements is read in from the file
+  // the first time it is used; elsewhere the whole file is read into
+  // memory.
+
+public:
+
+  // EFFECTS: Opens the snapshot at path and checks its header against
+  //          element type T, or throws snapshot_exception.
+  template <typename T>
+  static std::unique_ptr<const Snapshot_file> open(const std::string &path) {
+    std::unique_ptr<Snapshot_file> file(new Snapshot_file(path));
+    file->check(snapshot_header<T>(0, 0));
+    return std::unique_ptr<const Snapshot_file>(std::move(file));
+  }
+
+  Snapshot_file(const Snapshot_file &other) = delete;
+  Snapshot_file &operator=(const Snapshot_file &rhs) = delete;
+
+  ~Snapshot_file() {
+#if SNAPSHOT_MMAP
+    if (mapped) {
+      munmap(mapped, bytes);
+    }
+#endif
+  }
+
+  // EFFECTS: Returns the header of the file.
+  const Snapshot_header &header() const {
+    return *reinterpret_cast<const Snapshot_header *>(begin);
+  }
+
+  // EFFECTS: Returns a pointer to the first byte after the header, which
+  //          is aligned like std::max_align_t (or more, when mapped).
+  const char *payload() const {
+    return begin + sizeof(Snapshot_header);
+  }
+
+  // EFFECTS: Returns a pointer to the end of the file.
+  const char *payload_end() const {
+    return begin + bytes;
+  }
+
+private:
+  const char *begin;
+  std::size_t bytes;
+#if SNAPSHOT_MMAP
+  void *mapped = nullptr;
+#endif
+  // The contents of the file, when it is not mapped.
+  std::vector<std::max_align_t> buffer;
+
+  explicit Snapshot_file(const std::string &path)
+    : begin(nullptr), bytes(0) {
+#if SNAPSHOT_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw snapshot_exception("Error opening file: " + path);
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0) {
+      ::close(fd);
+      throw snapshot_exception("Error reading file: " + path);
+    }
+    bytes = std::size_t(status.st_size);
+    if (bytes >= sizeof(Snapshot_header)) {
+      mapped = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapped == MAP_FAILED) {
+        mapped = nullptr;
+      }
+    }
+    ::close(fd);
+    if (mapped) {
+      begin = static_cast<const char *>(mapped);
+      return;
+    }
+#endif
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+      throw snapshot_exception("Error opening file: " + path);
+    }
+    file.seekg(0, std::ios::end);
+    bytes = std::size_t(file.tellg());
+    file.seekg(0);
+    buffer.resize(bytes / sizeof(std::max_align_t) + 1);
+    begin = reinterpret_cast<const char *>(buffer.data());
+    if (!file.read(const_cast<char *>(begin), std::streamsize(bytes))) {
+      throw snapshot_exception("Error reading file: " + path);
+    }
+  }
+
+  // EFFECTS: Throws snapshot_exception unless the header matches
+  //          'expected' and the payload fits in the file.
+  void check(const Snapshot_header &expected) const {
+    if (bytes < sizeof(Snapshot_header) ||
+        std::memcmp(header().magic, c_snapshot_magic,
+                    sizeof(c_snapshot_magic)) != 0) {
+      throw snapshot_exception("not a snapshot file");
+    }
+    if (header().version != expected.version) {
+      throw snapshot_exception("unsupported snapshot version " +
+                               std::to_string(header().version));
+    }
+    if (header().byte_order != expected.byte_order) {
+      throw snapshot_exception("snapshot of another byte order");
+    }
+    if (header().type_hash != expected.type_hash ||
+        header().element_bytes != expected.element_bytes) {
+      throw snapshot_exception("snapshot of another element type");
+    }
+    if (header().payload_bytes > bytes - sizeof(Snapshot_header) ||
+        (expected.element_bytes &&
+         header().payload_bytes / expected.element_bytes < header().count)) {
+      throw snapshot_exception("snapshot truncated");
+    }
+  }
+};
+
+#endif // SNAPSHOT_HPP
@@ -1,15 +1,23 @@
 /* TreePrint.hpp */
 
+#include <algorithm> // min
 #include <iostream>
 #include <iomanip>
 #include <string>
 #include <sstream>
-#include <cmath> // pow
 #include <set>
-#include <stack> // used in get_max_elt_width()
 
 static const char* const c_leaf_branch_special = "/\\";
 
+// Drawn in place of a subtree below the levels to_string(max_depth) draws.
+static const char* const c_cut_subtree = "...";
+
+// Most levels to_string draws. Each level doubles the width of the
+// drawing, so deeper ones are cut off even when max_depth asks for more.
+static const size_t c_max_drawn_levels = 16;
+
+static const int c_min_elt_width = 2;
+
 /*
  * A class to represent the non-whitespace squares of output using a
  * grid-based tree printing scheme.
@@ -17,8 +25,8 @@ static const char* const c_leaf_branch_special = "/\\";
  * value held by a particular tree node or one of / or \ to improve
  * readability of the printed tree.
  */
-template <typename U, typename C>
-class BinarySearchTree<U, C>::Tree_grid_square {
+template <typename U, typename C, typename B, typename A>
+class BinarySearchTree<U, C, B, A>::Tree_grid_square {
 public:
   template<typename T>
   Tree_grid_square(int x_, int y_, T value_) : x(x_), y(y_) {
@@ -72,28 +80,33 @@ private:
 /*
  * Container to build and hold a set of Tree_grid_squares.
  */
-template <typename U, typename C>
-class BinarySearchTree<U, C>::Tree_grid {
+template <typename U, typename C, typename B, typename A>
+class BinarySearchTree<U, C, B, A>::Tree_grid {
 public:
 
-  Tree_grid(const BinarySearchTree& tree) :
-          num_levels(static_cast<int>(tree.height())), leftmost_x(0),
-          rightmost_x(0) {
+  /*
+   * Lays out the top max_depth levels of the tree (at most
+   * c_max_drawn_levels), plus a level of c_cut_subtree squares if there
+   * are more.
+   */
+  Tree_grid(const BinarySearchTree& tree, size_t max_depth) :
+          max_levels(static_cast<int>(std::min({max_depth, tree.height(),
+                                                c_max_drawn_levels}))),
+          num_levels(max_levels), leftmost_x(0), rightmost_x(0),
+          max_width(c_min_elt_width) {
+      if (tree.height() > size_t(max_levels)) {
+          ++num_levels;
+      }
       build(tree.root);
   }
 
   /*
-   * Convenience wrapper of set::find(). Returns a pointer to the
-   * Tree_grid_square in the set or 0 if not found.
+   * Returns all the squares, row by row from the top, and from left to
+   * right within each row.
    */
-  const Tree_grid_square* find(const Tree_grid_square& coordinate) const {
-      typename std::set<Tree_grid_square>::iterator it =
-              coordinates.find(coordinate);
-      if (it == coordinates.end()) {
-          return 0;
-      }
-      return &*it;
-  } // find wrapper
+  const std::set<Tree_grid_square>& get_squares() const {
+      return coordinates;
+  }
 
   /*
    * Returns the number of levels in the traversed tree.
@@ -116,11 +129,21 @@ public:
       return rightmost_x;
   }
 
+  /*
+   * Returns the width of the widest value in the grid, or
+   * c_min_elt_width if that is wider.
+   */
+  int get_max_width() const {
+      return max_width;
+  }
+
 private:
   std::set<Tree_grid_square> coordinates;
+  int max_levels;
   int num_levels;
   int leftmost_x;
   int rightmost_x;
+  int max_width;
 
   /*
    * Given the height of a tree and the index of the current level (0
@@ -130,27 +153,46 @@ private:
    *
    * Note that in order for the tree to be printed elegantly, the
    * horizontal distance between nodes must increase as the tree
-   * becomes taller.
+   * becomes taller. Drawing at most c_max_drawn_levels + 1 levels keeps
+   * the shift, and every x coordinate, well within an int.
    */
   static int calculate_x_offset(int tree_height, int current_level) {
-      return int(std::pow(2, tree_height) / std::pow(2, current_level + 2));
+      int shift = tree_height - current_level - 2;
+      return shift < 0 ? 0 : 1 << shift;
   }
 
   /*
-   * Recursively fills the set of Node_coordinates
+   * Adds a square holding a value, which becomes part of the extent
+   * and the width of the grid.
    */
-  void build(const Node* root_node, int cur_x = 0, int cur_y = 0) {
-      if (!root_node) {
-          return;
+  template<typename T>
+  void add_value(int cur_x, int cur_y, const T& value) {
+      Tree_grid_square square(cur_x, cur_y, value);
+      int width = int(square.get_value().length());
+      if (width > max_width) {
+          max_width = width;
       }
-      coordinates.insert(Tree_grid_square(cur_x, cur_y,
-                                          root_node->datum));
+      coordinates.insert(square);
       if (cur_x < leftmost_x) {
           leftmost_x = cur_x;
       }
       if (cur_x > rightmost_x) {
           rightmost_x = cur_x;
       }
+  }
+
+  /*
+   * Recursively fills the set of Node_coordinates
+   */
+  void build(const Node* root_node, int cur_x = 0, int cur_y = 0) {
+      if (!root_node) {
+          return;
+      }
+      if (cur_y / 2 == max_levels) {
+          add_value(cur_x, cur_y, c_cut_subtree);
+          return;
+      }
+      add_value(cur_x, cur_y, root_node->datum);
 
       int x_offset = calculate_x_offset(num_levels, cur_y / 2);
 
@@ -191,74 +233,98 @@ private:
  * Returns an (actually) human-readable string representation of the
  * tree
  */
-template <typename U, typename C>
-std::string BinarySearchTree<U, C>::to_string() const {
+template <typename U, typename C, typename B, typename A>
+std::string BinarySearchTree<U, C, B, A>::to_string() const {
+    return to_string(height());
+} // to_string
+
+/*
+ * Returns the same drawing, cut off below max_depth levels. Only the
+ * squares in the grid are visited: the gaps between them are filled
+ * with padding.
+ */
+template <typename U, typename C, typename B, typename A>
+std::string BinarySearchTree<U, C, B, A>::to_string(size_t max_depth) const {
     if (!root) {
         return "( )";
     }
-    int node_width = get_max_elt_width();
-    Tree_grid coordinates(*this);
+    Tree_grid coordinates(*this, max_depth);
+    int node_width = coordinates.get_max_width();
 
     std::ostringstream oss;
     std::string padding(size_t(node_width), ' ');
     int farthest_left = coordinates.get_leftmost_x() - node_width;
     int farthest_right = coordinates.get_rightmost_x() + node_width;
+    typename std::set<Tree_grid_square>::const_iterator square =
+            coordinates.get_squares().begin();
+    typename std::set<Tree_grid_square>::const_iterator squares_end =
+            coordinates.get_squares().end();
     // Two printed lines per tree level: one for the values, one for the
     // slash characters (branches).
     for (int y = 0; y <= coordinates.get_num_levels() * 2; ++y) {
         oss << "\n";
-        for (int x = farthest_left; x <= farthest_right; ++x) {
-            const Tree_grid_square* tgs_ptr =
-                    coordinates.find( Tree_grid_square(x, y));
-            if (tgs_ptr) {
-                // TODO width field in square?
-                if (tgs_ptr->get_value() == "/") {
-                    oss << std::right;
-                    oss << std::setw(node_width);
-                    oss << tgs_ptr->get_value();
-                } else if (tgs_ptr->get_value() == "\\") {
-                    oss << std::left;
-                    oss << std::setw(node_width);
-                    oss << tgs_ptr->get_value();
-                } else if (tgs_ptr->get_value() == c_leaf_branch_special) {
-                    oss << '\\' << std::string(size_t(node_width - 2), ' ') << '/';
-                } else {
-                    oss << std::setw(node_width);
-                    oss << tgs_ptr->get_value();
-                }
-            } else {
+        int x = farthest_left;
+        for (; square != squares_end && square->get_y() == y; ++square) {
+            if (square->get_x() < x || square->get_x() > farthest_right) {
+                continue;
+            }
+            for (; x < square->get_x(); ++x) {
                 oss << padding;
             }
-        } // for x
-        // oss << "\n";
+            ++x;
+            if (square->get_value() == "/") {
+                oss << std::right;
+                oss << std::setw(node_width);
+                oss << square->get_value();
+            } else if (square->get_value() == "\\") {
+                oss << std::left;
+                oss << std::setw(node_width);
+                oss << square->get_value();
+            } else if (square->get_value() == c_leaf_branch_special) {
+                oss << '\\' << std::string(size_t(node_width - 2), ' ') << '/';
+            } else {
+                oss << std::setw(node_width);
+                oss << square->get_value();
+            }
+        } // for square
+        for (; x <= farthest_right; ++x) {
+            oss << padding;
+        }
     } // for y
     return oss.str();
 } // to_string
 
-static const int c_min_elt_width = 2;
-
 /*
- * Returns the width of the widest elt in this tree.
+ * Writes the tree as a DOT digraph. In pre-order, the left child of the
+ * node numbered i is numbered i + 1, and its right child comes after
+ * the whole left subtree, so the numbers follow from the cached subtree
+ * sizes without a table of nodes.
  */
-template <typename U, typename C>
-int BinarySearchTree<U, C>::get_max_elt_width() const {
-    int current_max = c_min_elt_width;
-    std::stack<Node*> nodes;
-    nodes.push(root);
-    while (!nodes.empty()) {
-        Node* current = nodes.top();
-        nodes.pop();
-        if (!current) {
-            continue;
+template <typename U, typename C, typename B, typename A>
+void BinarySearchTree<U, C, B, A>::to_dot(std::ostream &os) const {
+    os << "digraph BinarySearchTree {\n"
+       << "  node [shape=box];\n";
+    size_t index = 0;
+    std::ostringstream label;
+    visit_nodes_impl(root, [&](const Node *node) {
+        label.str("");
+        label << node->datum;
+        os << "  n" << index << " [label=\"";
+        for (char c : label.str()) {
+            if (c == '"' || c == '\\') {
+                os << '\\';
+            }
+            os << c;
+        }
+        os << "\"];\n";
+        if (node->left) {
+            os << "  n" << index << ":sw -> n" << index + 1 << ";\n";
         }
-        std::ostringstream oss;
-        oss << current->datum;
-        int width = int(oss.str().length());
-        if (width > current_max) {
-            current_max = width;
+        if (node->right) {
+            os << "  n" << index << ":se -> n"
+               << index + 1 + size_impl(node->left) << ";\n";
         }
-        nodes.push(current->left);
-        nodes.push(current->right);
-    } // while
-    return current_max;
-} // get_max_elt_width
+        ++index;
+    });
+    os << "}\n";
+} // to_dot